@@ -0,0 +1,96 @@
+#ifndef AUDITEVENT_H
+#define AUDITEVENT_H
+
+#include <cstdint>
+#include <sys/fanotify.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "PathTable.hpp"
+
+// Owns the file descriptor fanotify opened for an event and closes it
+//  exactly once, whichever way the event leaves the pipeline (written,
+//  skipped, dropped or left in the ring at shutdown). Move-only.
+class EventFd
+{
+    public:
+        EventFd() : fd(FAN_NOFD) {}
+        explicit EventFd(int fd) : fd(fd) {}
+        EventFd(EventFd&& other) : fd(other.release()) {}
+        EventFd& operator=(EventFd&& other)
+        {
+            if (this != &other)
+            {
+                reset(other.release());
+            }
+            return *this;
+        }
+        ~EventFd()
+        {
+            reset();
+        }
+
+        // The file descriptor, or FAN_NOFD if there is none
+        int get() const
+        {
+            return fd;
+        }
+
+        // Is there an open file descriptor?
+        bool is_open() const
+        {
+            return fd != FAN_NOFD;
+        }
+
+        // Gives up ownership without closing
+        int release()
+        {
+            int released_fd = fd;
+            fd = FAN_NOFD;
+            return released_fd;
+        }
+
+        // Closes the current file descriptor (if any) and takes new_fd
+        void reset(int new_fd = FAN_NOFD)
+        {
+            if (fd != FAN_NOFD && fd != new_fd)
+            {
+                close(fd);
+            }
+            fd = new_fd;
+        }
+
+    private:
+        int fd;
+
+        EventFd(const EventFd&);
+        EventFd& operator=(const EventFd&);
+};
+
+// The raw part of a struct fanotify_event_metadata that the reader hands
+//  over to the writers. Everything slow (path, user, time, formatting) is
+//  derived from this later on a writer thread, and the path's string is
+//  only read back out of the path table to format the event.
+struct AuditEvent
+{
+    // Event file descriptor, still open when the writer receives it, or
+    //  FAN_NOFD for events from the FID-reporting group
+    EventFd fd;
+    // Pid of the process that caused the event
+    pid_t pid;
+    // The fanotify event access type mask
+    uint64_t mask;
+    // When the event was read, in nanoseconds since the epoch (see
+    //  EventClock)
+    uint64_t time_ns;
+    // Path of the file, interned in the auditor's path table. The reader
+    //  sets it for events from a file handle and for permission events the
+    //  policy looked up; the writers resolve the rest from the fd when they
+    //  need it.
+    PathRef path;
+    // Number of events coalesced into this one (options.coalesce_window),
+    //  0 for an event that went through on its own
+    uint32_t repeat_count = 0;
+};
+
+#endif
@@ -0,0 +1,257 @@
+#include "AuditMetrics.hpp"
+
+#include <cstdio>
+#include <sys/fanotify.h>
+
+using namespace std;
+
+// Names and descriptions of the metrics kept per thread, in the order of the
+// Counter and Histogram enums
+static const char * const COUNTER_NAMES[][2] = {
+    {"event_reads_total", "Reads of a fanotify group that returned events."},
+    {"events_read_total", "Events read from fanotify."},
+    {"events_written_total", "Events formatted for the audit output."},
+    {"output_bytes_formatted_total",
+     "Bytes of audit output handed to the audit writer."},
+    {"events_filtered_total", "Events dropped by the event filter."}
+};
+
+static const char * const HISTOGRAM_NAMES[][2] = {
+    {"permission_response_seconds",
+     "Time from reading a permission event to answering it."},
+    {"path_resolution_seconds",
+     "Time to resolve an event's file descriptor or handle to a path."},
+    {"user_lookup_seconds",
+     "Time to find the user owning an event's process."}
+};
+
+// Label of each access type counted in dirmon_events_by_type_total
+static const struct
+{
+    unsigned long long bit;
+    const char * label;
+} EVENT_TYPE_LABELS[] = {
+    {FAN_ACCESS, "access"},
+    {FAN_OPEN, "open"},
+    {FAN_MODIFY, "modify"},
+    {FAN_CLOSE_WRITE, "close_write"},
+    {FAN_CLOSE_NOWRITE, "close_nowrite"},
+    {FAN_Q_OVERFLOW, "q_overflow"},
+    {FAN_ACCESS_PERM, "access_perm"},
+    {FAN_OPEN_PERM, "open_perm"}
+};
+
+// Give out a different id to every instance
+static atomic<uint64_t> next_metrics_id(0);
+
+// Bump a counter only the calling thread writes, without a locked add
+static inline void increment(atomic<uint64_t>& value, uint64_t amount = 1)
+{
+    value.store(value.load(memory_order_relaxed) + amount,
+                memory_order_relaxed);
+}
+
+// Append a value in seconds given in nanoseconds, e.g. 2.56e-07
+static void append_seconds(string& text, uint64_t nanoseconds)
+{
+    char seconds[32];
+    snprintf(seconds, sizeof(seconds), "%.9g", nanoseconds / 1e9);
+    text += seconds;
+}
+
+// -- PUBLIC -------------------------------------------------------------------
+
+AuditMetrics::AuditMetrics()
+{
+    timing = false;
+    id = next_metrics_id++;
+}
+
+void AuditMetrics::enable_timing()
+{
+    timing = true;
+}
+
+// Count the event once for every bit set in the low half of its mask, where
+// the access types are
+void AuditMetrics::count_event_types(unsigned long long mask)
+{
+    Shard& shard = get_shard();
+    uint32_t bits = mask;
+    while (bits)
+    {
+        increment(shard.events_by_type[__builtin_ctz(bits)]);
+        bits &= bits - 1;
+    }
+}
+
+void AuditMetrics::record_latency(Histogram histogram,
+                                  chrono::nanoseconds latency)
+{
+    Shard& shard = get_shard();
+    shard.latencies[histogram].record(latency);
+    increment(shard.latency_sums_ns[histogram], 
+              latency.count() > 0 ? latency.count() : 0);
+}
+
+uint64_t AuditMetrics::get_count(Counter counter)
+{
+    lock_guard<mutex> lock(shards_mutex);
+    uint64_t count = 0;
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        count += (*shard)->counters[counter].load(memory_order_relaxed);
+    }
+    return count;
+}
+
+void AuditMetrics::get_latencies(Histogram histogram, LatencyHistogram& total)
+{
+    lock_guard<mutex> lock(shards_mutex);
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        total.add((*shard)->latencies[histogram]);
+    }
+}
+
+// Sum the shards into one set of numbers first, then write them out
+void AuditMetrics::append_metrics(string& text)
+{
+    uint64_t counters[NUM_COUNTERS] = {};
+    uint64_t events_by_type[NUM_MASK_BITS] = {};
+    LatencyHistogram latencies[NUM_HISTOGRAMS];
+    uint64_t latency_sums_ns[NUM_HISTOGRAMS] = {};
+    {
+        lock_guard<mutex> lock(shards_mutex);
+        for (auto shard = shards.begin(); shard != shards.end(); shard++)
+        {
+            for (unsigned int i = 0; i < NUM_COUNTERS; i++)
+            {
+                counters[i] +=
+                    (*shard)->counters[i].load(memory_order_relaxed);
+            }
+            for (unsigned int i = 0; i < NUM_MASK_BITS; i++)
+            {
+                events_by_type[i] +=
+                    (*shard)->events_by_type[i].load(memory_order_relaxed);
+            }
+            for (unsigned int i = 0; i < NUM_HISTOGRAMS; i++)
+            {
+                latencies[i].add((*shard)->latencies[i]);
+                latency_sums_ns[i] +=
+                    (*shard)->latency_sums_ns[i].load(memory_order_relaxed);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < NUM_COUNTERS; i++)
+    {
+        append_counter(text, COUNTER_NAMES[i][0], COUNTER_NAMES[i][1],
+                       counters[i]);
+    }
+
+    text += "# HELP dirmon_events_by_type_total Events read from fanotify "
+            "with each access type.\n"
+            "# TYPE dirmon_events_by_type_total counter\n";
+    for (auto& event_type : EVENT_TYPE_LABELS)
+    {
+        text += "dirmon_events_by_type_total{type=\"";
+        text += event_type.label;
+        text += "\"} ";
+        text += to_string(
+            events_by_type[__builtin_ctzll(event_type.bit)]);
+        text += '\n';
+    }
+
+    // Prometheus buckets count everything up to their bound, so they add up
+    for (unsigned int i = 0; i < NUM_HISTOGRAMS; i++)
+    {
+        string name = string("dirmon_") + HISTOGRAM_NAMES[i][0];
+        text += "# HELP " + name + ' ' + HISTOGRAM_NAMES[i][1] + '\n';
+        text += "# TYPE " + name + " histogram\n";
+        uint64_t cumulative_count = 0;
+        for (unsigned int bucket = 0; bucket < LatencyHistogram::NUM_BUCKETS;
+             bucket++)
+        {
+            cumulative_count += latencies[i].get_bucket_count(bucket);
+            text += name + "_bucket{le=\"";
+            if (bucket < LatencyHistogram::NUM_BUCKETS - 1)
+            {
+                append_seconds(text, 
+                    LatencyHistogram::get_bucket_limit_us(bucket) * 1000);
+            }
+            else
+            {
+                text += "+Inf";
+            }
+            text += "\"} " + to_string(cumulative_count) + '\n';
+        }
+        text += name + "_sum ";
+        append_seconds(text, latency_sums_ns[i]);
+        text += '\n';
+        text += name + "_count " + to_string(cumulative_count) + '\n';
+    }
+}
+
+void AuditMetrics::append_counter(string& text, const char * name,
+                                  const char * help, uint64_t value)
+{
+    text += "# HELP dirmon_";
+    text += name;
+    text += ' ';
+    text += help;
+    text += "\n# TYPE dirmon_";
+    text += name;
+    text += " counter\ndirmon_";
+    text += name;
+    text += ' ';
+    text += to_string(value);
+    text += '\n';
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+AuditMetrics::Shard::Shard()
+{
+    for (auto& counter : counters)
+    {
+        counter = 0;
+    }
+    for (auto& count : events_by_type)
+    {
+        count = 0;
+    }
+    for (auto& latency_sum : latency_sums_ns)
+    {
+        latency_sum = 0;
+    }
+}
+
+// A thread almost always records into a single instance, so the last shard
+// it used is checked before the rest of its list
+AuditMetrics::Shard& AuditMetrics::get_shard()
+{
+    thread_local vector<pair<uint64_t, Shard *>> thread_shards;
+    if (!thread_shards.empty() && thread_shards.back().first == id)
+    {
+        return *thread_shards.back().second;
+    }
+    for (auto thread_shard = thread_shards.begin();
+         thread_shard != thread_shards.end(); thread_shard++)
+    {
+        if (thread_shard->first == id)
+        {
+            return *thread_shard->second;
+        }
+    }
+    lock_guard<mutex> lock(shards_mutex);
+    shards.emplace_back(new Shard());
+    thread_shards.emplace_back(id, shards.back().get());
+    return *shards.back();
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,170 @@
+#ifndef AUDITMETRICS_H
+#define AUDITMETRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "LatencyHistogram.hpp"
+
+using namespace std;
+
+// Counters and fixed-bucket latency histograms for what dirmon is doing,
+//  rendered in the Prometheus text exposition format. Every thread that
+//  records gets its own shard of counters on first use, so recording is a
+//  plain load and store to memory no other thread writes, with no lock or
+//  locked instruction on the hot path. Rendering sums the shards; a sum may
+//  miss the last few increments of a thread still recording, which the
+//  next render picks up.
+class AuditMetrics
+{
+    public:
+        // Counters kept per thread
+        enum Counter
+        {
+            // Reads of a fanotify group that returned events
+            EVENT_READS,
+            // Events those reads returned
+            EVENTS_READ,
+            // Lines or records handed to the audit writer, and their bytes
+            EVENTS_WRITTEN,
+            BYTES_FORMATTED,
+            // Events the event filter dropped before formatting
+            EVENTS_FILTERED,
+            NUM_COUNTERS
+        };
+
+        // Latencies kept per thread
+        enum Histogram
+        {
+            // From reading a permission event to answering it
+            PERMISSION_RESPONSE,
+            // Turning an event fd or file handle into a path
+            PATH_RESOLUTION,
+            // Finding the user (or uid) owning an event's pid
+            USER_LOOKUP,
+            NUM_HISTOGRAMS
+        };
+
+        AuditMetrics();
+
+        // Intro:   Starts taking latencies. Counters are always kept, but
+        //              timing costs two clock reads per latency, so
+        //              is_timing stays false (and callers skip the clock)
+        //              until something will read the histograms. Latencies
+        //              measured anyway (permission responses) are recorded
+        //              either way.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void enable_timing();
+
+        // Should callers time what they do for record_latency?
+        bool is_timing() const
+        {
+            return timing.load(memory_order_relaxed);
+        }
+
+        // Intro:   Adds to a counter of the calling thread
+        // Inputs:  counter : the counter
+        //          amount : what to add
+        // Outputs: None
+        // Return:  void
+        void add(Counter counter, uint64_t amount = 1)
+        {
+            atomic<uint64_t>& value = get_shard().counters[counter];
+            value.store(value.load(memory_order_relaxed) + amount,
+                        memory_order_relaxed);
+        }
+
+        // Intro:   Counts one event read from fanotify under each of the
+        //              access types in its mask
+        // Inputs:  mask : the struct fanotify_event_metadata.mask
+        // Outputs: None
+        // Return:  void
+        void count_event_types(unsigned long long mask);
+
+        // Intro:   Counts one latency in a histogram of the calling thread
+        // Inputs:  histogram : the histogram
+        //          latency : the latency to count
+        // Outputs: None
+        // Return:  void
+        void record_latency(Histogram histogram, chrono::nanoseconds latency);
+
+        // Intro:   Gets a counter summed over every thread
+        // Inputs:  counter : the counter
+        // Outputs: None
+        // Return:  The sum
+        uint64_t get_count(Counter counter);
+
+        // Intro:   Gets a histogram summed over every thread
+        // Inputs:  histogram : the histogram
+        //          total : an empty histogram owned by the caller
+        // Outputs: total : with the latencies of every thread added
+        // Return:  void
+        void get_latencies(Histogram histogram, LatencyHistogram& total);
+
+        // Intro:   Appends every counter and histogram kept here, in the
+        //              Prometheus text format with the metric names
+        //              prefixed by dirmon_
+        // Inputs:  text : the buffer to append to
+        // Outputs: text : with the metrics appended
+        // Return:  void
+        void append_metrics(string& text);
+
+        // Intro:   Appends one counter kept somewhere else, in the same
+        //              format as append_metrics
+        // Inputs:  text : the buffer to append to
+        //          name : the metric name, without the dirmon_ prefix
+        //          help : one line describing the metric
+        //          value : the counter's value
+        // Outputs: text : with the counter appended
+        // Return:  void
+        static void append_counter(string& text, const char * name,
+                                   const char * help, uint64_t value);
+
+    private:
+        // Every bit of the low half of an fanotify mask gets a counter; only
+        // the access types are rendered
+        static const unsigned int NUM_MASK_BITS = 32;
+
+        // One thread's counters, on cache lines of their own so threads
+        // don't contend on the lines they write. Only the owning thread
+        // writes them; rendering reads them from another thread, hence
+        // the atomics (relaxed loads and stores are plain moves).
+        struct alignas(64) Shard
+        {
+            atomic<uint64_t> counters[NUM_COUNTERS];
+            atomic<uint64_t> events_by_type[NUM_MASK_BITS];
+            LatencyHistogram latencies[NUM_HISTOGRAMS];
+            atomic<uint64_t> latency_sums_ns[NUM_HISTOGRAMS];
+
+            Shard();
+        };
+
+        // Every shard handed out, which live as long as the metrics (a
+        // thread that exits leaves its counts behind). The mutex is only
+        // taken when a thread records for the first time and to render.
+        vector<unique_ptr<Shard>> shards;
+        mutex shards_mutex;
+        atomic<bool> timing;
+        // Tells instances apart in the threads' shard lists, unlike an
+        // address that a later instance may reuse
+        uint64_t id;
+
+        AuditMetrics(const AuditMetrics&);
+        AuditMetrics& operator=(const AuditMetrics&);
+
+        // Intro:   Gets the calling thread's shard, creating it on the
+        //              thread's first call
+        // Inputs:  None
+        // Outputs: None
+        // Return:  The shard
+        Shard& get_shard();
+};
+
+#endif
@@ -0,0 +1,328 @@
+#include "AuditWriter.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+AuditWriter::AuditWriter()
+{
+    output_fd = -1;
+    batch_bytes = 0;
+    commit_latency = chrono::milliseconds(0);
+    sync_on_commit = false;
+    max_segment_bytes = 0;
+    max_segment_age = chrono::seconds(0);
+    compress_closed = false;
+    segment_bytes = 0;
+    segment_number = 0;
+    commit_count = 0;
+    bytes_written = 0;
+}
+
+AuditWriter::~AuditWriter()
+{
+    close();
+}
+
+// Open the output file for appending and preallocate both batch buffers
+bool AuditWriter::open(const string& filename, size_t batch_bytes,
+                       chrono::milliseconds commit_latency,
+                       bool sync_on_commit)
+{
+    output_fd = ::open(filename.c_str(),
+                       O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (output_fd == -1)
+    {
+        return false;
+    }
+    this->filename = filename;
+    this->batch_bytes = batch_bytes;
+    this->commit_latency = commit_latency;
+    this->sync_on_commit = sync_on_commit;
+    pending.reserve(batch_bytes);
+    committing.reserve(batch_bytes);
+
+    // An existing file counts as the start of the active segment
+    struct stat output_stat;
+    segment_bytes = fstat(output_fd, &output_stat) == 0 ? output_stat.st_size 
+                                                        : 0;
+    segment_start_time = chrono::steady_clock::now();
+    return true;
+}
+
+void AuditWriter::set_rotation(size_t max_segment_bytes,
+                               chrono::seconds max_segment_age,
+                               bool compress_closed,
+                               function<void(const string&)> on_rotate)
+{
+    this->max_segment_bytes = max_segment_bytes;
+    this->max_segment_age = max_segment_age;
+    this->compress_closed = compress_closed;
+    this->on_rotate = on_rotate;
+    // Segments the last run stopped before compressing
+    if (compress_closed)
+    {
+        compressor.compress_leftover_segments(filename);
+    }
+}
+
+// Size the buffers for a full batch, or for a few records when every
+// record is committed on its own
+bool AuditWriter::use_io_uring(unsigned int num_buffers)
+{
+    return uring_output.open(num_buffers, max(batch_bytes, (size_t) 65536));
+}
+
+bool AuditWriter::uses_fixed_buffers() const
+{
+    return uring_output.has_fixed_buffers();
+}
+
+void AuditWriter::append(const char * record, size_t length)
+{
+    append_to_segment(record, length, UINT64_MAX);
+}
+
+// Add a record to the batch, committing around it when a limit is reached.
+// UINT64_MAX as the segment accepts whichever segment is active.
+bool AuditWriter::append_to_segment(const char * record, size_t length,
+                                    uint64_t segment)
+{
+    unique_lock<mutex> buffer_lock(buffer_mutex);
+    // Make room first so that the batch never grows past batch_bytes
+    // (unless a single record is bigger than the whole batch)
+    if (!pending.empty() && pending.size() + length > batch_bytes)
+    {
+        buffer_lock.unlock();
+        commit();
+        buffer_lock.lock();
+    }
+    if (segment != UINT64_MAX && segment != segment_number)
+    {
+        return false;
+    }
+    if (pending.empty())
+    {
+        oldest_pending_time = chrono::steady_clock::now();
+    }
+    pending.insert(pending.end(), record, record + length);
+    bool commit_due = pending.size() >= batch_bytes ||
+                      chrono::steady_clock::now() - oldest_pending_time >=
+                      commit_latency;
+    buffer_lock.unlock();
+
+    if (commit_due)
+    {
+        commit();
+    }
+    return true;
+}
+
+uint64_t AuditWriter::get_segment_number()
+{
+    lock_guard<mutex> buffer_lock(buffer_mutex);
+    return segment_number;
+}
+
+// Swap out the batch and write it with one write call
+void AuditWriter::commit()
+{
+    lock_guard<mutex> commit_lock(commit_mutex);
+    bool rotate_after_commit;
+    {
+        lock_guard<mutex> buffer_lock(buffer_mutex);
+        if (pending.empty())
+        {
+            return;
+        }
+        pending.swap(committing);
+        // Everything appended from here on belongs to the next segment
+        rotate_after_commit = rotation_due(committing.size());
+        if (rotate_after_commit)
+        {
+            segment_number++;
+        }
+    }
+    // Queue the batch on the io_uring if there is one. A batch too big for
+    // its buffers is written here, after everything already queued.
+    if (!uring_output.submit_append(output_fd, committing.data(),
+                                    committing.size(), sync_on_commit))
+    {
+        uring_output.wait_all();
+        write_fully(committing);
+        if (sync_on_commit && fdatasync(output_fd) == -1)
+        {
+            cerr << "dirmon: cannot sync audit output file, errno:"
+                 << strerror(errno) << endl;
+        }
+    }
+    segment_bytes += committing.size();
+    committing.clear();
+    commit_count++;
+    if (rotate_after_commit)
+    {
+        // The queued writes have to land before the segment is renamed.
+        // If that fails, appends go back to this segment (anything encoded
+        // for the next one is still valid after its own session record),
+        // and the next try waits for another segment's worth of bytes or
+        // time instead of coming up on every commit.
+        uring_output.wait_all();
+        if (!rotate_segment())
+        {
+            segment_bytes = 0;
+            segment_start_time = chrono::steady_clock::now();
+            lock_guard<mutex> buffer_lock(buffer_mutex);
+            segment_number--;
+        }
+    }
+}
+
+// Commit whatever is left and close the file
+void AuditWriter::close()
+{
+    if (output_fd == -1)
+    {
+        return;
+    }
+    commit();
+    uring_output.close();
+    ::close(output_fd);
+    output_fd = -1;
+    compressor.stop();
+}
+
+bool AuditWriter::is_open() const
+{
+    return output_fd != -1;
+}
+
+uint64_t AuditWriter::get_commit_count() const
+{
+    return commit_count;
+}
+
+uint64_t AuditWriter::get_bytes_written() const
+{
+    return bytes_written + uring_output.get_bytes_written();
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Write the whole buffer, picking up where a short write left off
+void AuditWriter::write_fully(const vector<char>& buffer)
+{
+    size_t offset = 0;
+    while (offset < buffer.size())
+    {
+        ssize_t num_bytes_written = write(output_fd, buffer.data() + offset,
+                                          buffer.size() - offset);
+        if (num_bytes_written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "dirmon: cannot write to audit output file, errno:"
+                 << strerror(errno) << "; " << buffer.size() - offset
+                 << " bytes lost" << endl;
+            return;
+        }
+        offset += num_bytes_written;
+        bytes_written += num_bytes_written;
+    }
+}
+
+// Rotate after this batch if it fills the segment or the segment is old
+bool AuditWriter::rotation_due(size_t commit_bytes)
+{
+    if (max_segment_bytes > 0 && 
+        segment_bytes + commit_bytes >= max_segment_bytes)
+    {
+        return true;
+    }
+    return max_segment_age.count() > 0 &&
+           chrono::steady_clock::now() - segment_start_time >= max_segment_age;
+}
+
+// Rename the active segment out of the way and start a new one under the
+// audit output filename, renaming it back if the new one can't be created.
+// The new segment is created with mknod, which no permission event waits
+// on, and on_rotate gets to have it ignored before it is opened: opening it
+// unmarked inside a tree monitored for FAN_OPEN_PERM would wait on a reader
+// that may itself be waiting for this writer to free up the event ring.
+bool AuditWriter::rotate_segment()
+{
+    // Name the closed segment after when it was closed, in UTC
+    time_t now = time(0);
+    tm UTC_time;
+    gmtime_r(&now, &UTC_time);
+    char date_time[32];
+    strftime(date_time, sizeof(date_time), "%Y%m%dT%H%M%SZ", &UTC_time);
+    string segment_path = filename + "." + date_time;
+    // Don't clobber a segment closed within the same second
+    struct stat existing;
+    for (int suffix = 1; stat(segment_path.c_str(), &existing) == 0 ||
+                         stat((segment_path + ".gz").c_str(), &existing) == 0;
+         suffix++)
+    {
+        segment_path = filename + "." + date_time + "." + to_string(suffix);
+    }
+
+    if (rename(filename.c_str(), segment_path.c_str()) == -1)
+    {
+        cerr << "dirmon: cannot rotate audit output file to '" 
+             << segment_path << "', errno:" << strerror(errno) << endl;
+        return false;
+    }
+    int new_output_fd = -1;
+    if (mknod(filename.c_str(), S_IFREG | 0644, 0) == 0 || errno == EEXIST)
+    {
+        if (on_rotate)
+        {
+            on_rotate(filename);
+        }
+        // No O_CREAT: a file created in its place since would not be
+        // ignored
+        new_output_fd = ::open(filename.c_str(), 
+                               O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if (new_output_fd == -1)
+    {
+        cerr << "dirmon: cannot create new audit output file, errno:"
+             << strerror(errno) << "; not rotating" << endl;
+        if (rename(segment_path.c_str(), filename.c_str()) == -1)
+        {
+            cerr << "dirmon: cannot rename '" << segment_path 
+                 << "' back, errno:" << strerror(errno) << "; still writing "
+                 << "to it" << endl;
+        }
+        else if (on_rotate)
+        {
+            on_rotate(filename);
+        }
+        return false;
+    }
+    ::close(output_fd);
+    output_fd = new_output_fd;
+    segment_bytes = 0;
+    segment_start_time = chrono::steady_clock::now();
+
+    if (compress_closed)
+    {
+        compressor.compress(segment_path);
+    }
+    return true;
+}
@@ -0,0 +1,206 @@
+#ifndef AUDITWRITER_H
+#define AUDITWRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SegmentCompressor.hpp"
+#include "UringOutput.hpp"
+
+using namespace std;
+
+// Collects formatted audit records in a preallocated buffer and commits
+//  them to the audit output file with a single write(2) at a time (group
+//  commit), instead of one flushed write per record. Safe to share between
+//  writer threads: records are appended whole and commits are serialized,
+//  so lines never interleave.
+// The output can be rotated into segments by size and/or age. The active
+//  segment always keeps the audit output filename; a closed segment is
+//  renamed to <filename>.<UTC date-time> and optionally gzipped in the
+//  background. Rotation happens between commits, so a segment can run
+//  over the size limit by up to one batch.
+// Commits write the batch themselves by default. With use_io_uring they
+//  only queue it (see UringOutput), so a slow disk holds up appends only
+//  once every io_uring buffer is in flight.
+class AuditWriter
+{
+    public:
+        AuditWriter();
+        ~AuditWriter();
+
+        // Intro:   Opens (creating if needed) the audit output file for
+        //              appending and sets the commit policy
+        // Inputs:  filename : the audit output file
+        //          batch_bytes : commit once this many bytes are buffered.
+        //              0 commits every record as soon as it is appended.
+        //          commit_latency : commit records that have been buffered
+        //              this long even if the batch isn't full
+        //          sync_on_commit : fdatasync the file after every commit
+        // Outputs: None
+        // Return:  false (with errno set) if the file can't be opened
+        bool open(const string& filename, size_t batch_bytes,
+                  chrono::milliseconds commit_latency, bool sync_on_commit);
+
+        // Intro:   Turns on rotation of the audit output into segments.
+        //              Call after open and before the first append.
+        // Inputs:  max_segment_bytes : rotate once the active segment
+        //              holds this many bytes (0 for no size limit)
+        //          max_segment_age : rotate once the active segment is
+        //              this old (0 for no age limit)
+        //          compress_closed : gzip closed segments in the background,
+        //              starting with those an earlier run left uncompressed
+        //          on_rotate : called with the audit output filename each
+        //              time a new active segment has been created, before
+        //              the writer opens it (and again if the rotation is
+        //              undone), so the caller can have it ignored by
+        //              fanotify first
+        // Outputs: None
+        // Return:  void
+        void set_rotation(size_t max_segment_bytes, 
+                          chrono::seconds max_segment_age,
+                          bool compress_closed,
+                          function<void(const string&)> on_rotate);
+
+        // Intro:   Switches commits over to io_uring. Call after open and
+        //              before the first append.
+        // Inputs:  num_buffers : most batches in flight at once
+        // Outputs: None
+        // Return:  false (with errno set) if io_uring is unavailable, in
+        //              which case commits keep writing themselves
+        bool use_io_uring(unsigned int num_buffers);
+
+        // Are the io_uring buffers registered with the kernel?
+        bool uses_fixed_buffers() const;
+
+        // Intro:   Adds one formatted record to the batch, committing the
+        //              batch first if the record doesn't fit and afterwards
+        //              if the size or time limit has been reached
+        // Inputs:  record : the formatted record, including its newline
+        //          length : the number of bytes in record
+        // Outputs: None
+        // Return:  void
+        void append(const char * record, size_t length);
+
+        // Intro:   Like append, but only if the record will land in the given
+        //              segment. For records that refer to earlier records of
+        //              the same segment (e.g. binary path ids).
+        // Inputs:  record : the record
+        //          length : the number of bytes in record
+        //          segment : the segment number (see get_segment_number)
+        //              the record was encoded for
+        // Outputs: None
+        // Return:  false if the output has rotated past that segment, in
+        //              which case nothing was appended
+        bool append_to_segment(const char * record, size_t length, 
+                               uint64_t segment);
+
+        // Intro:   Gets the number of the segment that appended records
+        //              currently go to. Starts at 0 and goes up by one per
+        //              rotation.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  The current segment number
+        uint64_t get_segment_number();
+
+        // Intro:   Writes everything buffered so far to the file with a
+        //              single write (retrying short writes), then syncs it
+        //              if sync_on_commit was requested. With io_uring the
+        //              write and sync are only queued.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void commit();
+
+        // Intro:   Commits anything left and closes the file
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void close();
+
+        // Intro:   Is the audit output file open?
+        // Inputs:  None
+        // Outputs: None
+        // Return:  true between a successful open and close
+        bool is_open() const;
+
+        // Number of commits (write batches) issued so far
+        uint64_t get_commit_count() const;
+        // Number of bytes written to the file so far
+        uint64_t get_bytes_written() const;
+
+    private:
+        // File descriptor of the audit output file, -1 when closed
+        int output_fd;
+        // Commit policy given to open
+        size_t batch_bytes;
+        chrono::milliseconds commit_latency;
+        bool sync_on_commit;
+        // The audit output filename, which the active segment always has
+        string filename;
+
+        // Rotation policy given to set_rotation
+        size_t max_segment_bytes;
+        chrono::seconds max_segment_age;
+        bool compress_closed;
+        function<void(const string&)> on_rotate;
+        // Bytes in the active segment and when it was started
+        uint64_t segment_bytes;
+        chrono::steady_clock::time_point segment_start_time;
+        // Number of the segment appends go to. Bumped when a commit
+        // decides to rotate after writing its batch, so that later
+        // appends know they belong to the next segment, and taken back if
+        // the rotation fails.
+        uint64_t segment_number;
+        // Compresses closed segments when compress_closed is set
+        SegmentCompressor compressor;
+        // Queues the commits when use_io_uring succeeded
+        UringOutput uring_output;
+
+        // Records appended since the last commit, and the buffer the last
+        // commit is writing from. They are swapped on commit so appends
+        // don't wait on the disk, and both keep their preallocated capacity.
+        vector<char> pending;
+        vector<char> committing;
+        // When the oldest record in pending was appended
+        chrono::steady_clock::time_point oldest_pending_time;
+        // Guards pending, oldest_pending_time and segment_number
+        mutex buffer_mutex;
+        // Serializes commits so batches reach the file in order
+        mutex commit_mutex;
+
+        atomic<uint64_t> commit_count;
+        atomic<uint64_t> bytes_written;
+
+        AuditWriter(const AuditWriter&);
+        AuditWriter& operator=(const AuditWriter&);
+
+        // Intro:   Writes a whole buffer to output_fd, retrying short writes
+        //              and interrupted calls
+        // Inputs:  buffer : the bytes to write
+        // Outputs: None
+        // Return:  void, reports write errors on cerr
+        void write_fully(const vector<char>& buffer);
+
+        // Intro:   Decides whether the batch being committed is the last
+        //              one for the active segment. buffer_mutex must be held.
+        // Inputs:  commit_bytes : the size of the batch being committed
+        // Outputs: None
+        // Return:  Should the segment be rotated after this batch?
+        bool rotation_due(size_t commit_bytes);
+
+        // Intro:   Closes the active segment under a dated name, opens a new
+        //              active segment and hands the closed one to the
+        //              compressor. commit_mutex must be held.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  false if the segment couldn't be rotated (reported on
+        //              cerr), in which case the current file is kept
+        bool rotate_segment();
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef AUDITOROPTIONS_H
+#define AUDITOROPTIONS_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Tunables for the DirectoryListAuditor that are not part of the fanotify
+//  event mask. The defaults give the same audit output as running dirmon
+//  without any tuning options.
+struct AuditorOptions
+{
+    // Size the event buffer starts at (and never shrinks below)
+    size_t event_buffer_bytes = 4096;
+    // Largest the event buffer grows to while reads keep filling it (set
+    //  to event_buffer_bytes for a fixed size)
+    size_t max_event_buffer_bytes = 1024 * 1024;
+
+    // Number of formatter/writer threads draining the event ring
+    unsigned int writer_threads = 1;
+    // Number of raw events the ring between the reader and the writers can
+    //  hold (rounded up to a power of two)
+    size_t ring_capacity = 65536;
+    // When the ring is full, drop the event instead of making the reader
+    //  wait for a writer to free up a slot
+    bool drop_when_full = false;
+
+    // Split the monitored directories over this many sets of fanotify
+    //  groups (see the directory list format in the README), each drained
+    //  by a reader thread of its own into its own ring and writer threads.
+    //  With 1, the thread calling read_event reads the only set.
+    unsigned int reader_shards = 1;
+    // Pin each shard's reader thread to a CPU, spread over the CPUs dirmon
+    //  may run on (only with more than one shard)
+    bool pin_readers = true;
+    // Give each shard its own audit output file, the audit output filename
+    //  with .N appended, instead of interleaving every shard into one file
+    bool split_shard_output = false;
+
+    // Group-commit the audit output once this many bytes are buffered. 0
+    //  writes and flushes every record on its own.
+    size_t batch_bytes = 0;
+    // Longest a buffered record may wait for its batch to be committed
+    //  while the writers are kept busy
+    std::chrono::milliseconds commit_latency = std::chrono::milliseconds(10);
+    // fdatasync the audit output file after every commit
+    bool sync_on_commit = false;
+    // Queue commits on an io_uring with this many buffers, so the writers
+    //  don't wait on the disk (0 writes from the writer threads). Falls
+    //  back to writing when the kernel has no io_uring.
+    unsigned int io_uring_buffers = 0;
+
+    // Create the fanotify groups with FAN_UNLIMITED_QUEUE, so the kernel
+    //  keeps queueing events (in unreclaimable memory) while dirmon falls
+    //  behind instead of dropping them after 16384
+    bool unlimited_queue = false;
+
+    // Write text event times as ISO 8601 with nanoseconds instead of
+    //  asctime's format to the second
+    bool iso8601_time = false;
+
+    // Merge the events one process causes on one file within this window
+    //  into a single record with the masks OR'd together and a count of
+    //  the events merged (0 writes every event on its own)
+    std::chrono::milliseconds coalesce_window = std::chrono::milliseconds(0);
+
+    // Number of pids whose owning user is remembered between events
+    size_t user_cache_size = 4096;
+
+    // Number of paths kept interned (see PathTable.hpp), for the next
+    //  events on them to reuse; paths events still hold come on top
+    size_t path_cache_size = 65536;
+
+    // Receive the non-permission events (access, modify, close, open) on a
+    //  second fanotify group that reports file handles instead of open
+    //  fds, and resolve their paths through a handle cache
+    bool report_fid = false;
+
+    // Write the audit output in the compact binary format (see
+    //  BinaryAuditFormat.hpp and dirmon-decode) instead of text lines
+    bool binary_format = false;
+
+    // Rotate the audit output into a new segment once the active one holds
+    //  this many bytes (0 for no size limit)
+    size_t rotate_bytes = 0;
+    // Rotate the audit output once the active segment is this old (0 for
+    //  no age limit)
+    std::chrono::seconds rotate_interval = std::chrono::seconds(0);
+    // gzip closed segments on a low-priority background thread
+    bool compress_segments = false;
+
+    // Mark the whole filesystem of each monitored directory instead of bind
+    //  mounting every directory onto itself, and keep only the events under
+    //  a monitored directory. Permission events for the rest of those
+    //  filesystems are still answered by dirmon.
+    bool mark_filesystem = false;
+
+    // Rule file to answer permission events from (see PermissionPolicy.hpp).
+    //  Empty allows every access.
+    std::string policy_filename;
+
+    // Rule file choosing which events make it into the audit output (see
+    //  EventFilter.hpp). Empty keeps every event.
+    std::string filter_filename;
+
+    // Answer a permission event on a watchdog thread if dirmon hasn't
+    //  answered it this long after reading it (0 for no deadline), so a
+    //  stall in dirmon can't keep processes waiting on their open()
+    std::chrono::milliseconds permission_deadline = std::chrono::milliseconds(0);
+    // Answer overdue permission events with FAN_DENY instead of FAN_ALLOW
+    bool deny_on_deadline = false;
+
+    // Write the metrics (see AuditMetrics.hpp) in the Prometheus text
+    //  format to this file every metrics_interval, replacing it atomically
+    //  as node_exporter's textfile collector expects. Empty for no file.
+    std::string metrics_filename;
+    std::chrono::milliseconds metrics_interval = std::chrono::milliseconds(10000);
+    // Serve the metrics on a Unix stream socket at this path: every
+    //  connection gets the current metrics and is closed. Empty for no
+    //  socket.
+    std::string metrics_socket;
+};
+
+#endif
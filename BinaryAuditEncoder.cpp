@@ -0,0 +1,101 @@
+#include "BinaryAuditEncoder.hpp"
+
+#include <cstring>
+
+using namespace std;
+
+BinaryAuditEncoder::BinaryAuditEncoder()
+{
+    session_segment = UINT64_MAX;
+    record_buffer.reserve(4096);
+}
+
+// Put the session record (for a new segment or once the path table is
+// full), the path record (if the path is new) and the event record together
+// and append them in one go, starting over if the output rotated to a new
+// segment in the meantime
+size_t BinaryAuditEncoder::append_event(AuditWriter& audit_writer, 
+                                        uint64_t timestamp_ns, pid_t pid, 
+                                        uid_t uid, uint64_t mask,
+                                        const PathRef& path,
+                                        uint32_t repeat_count)
+{
+    // Nothing the kernel hands out gets this long, but a decoder rejects
+    // longer records as corrupt
+    string_view path_string = path.get().substr(0, BINARY_MAX_PATH_LENGTH);
+    uint64_t key = path_key(path);
+    lock_guard<mutex> lock(table_mutex);
+    do
+    {
+        record_buffer.clear();
+
+        uint64_t segment = audit_writer.get_segment_number();
+        if (segment != session_segment || 
+            path_ids.size() >= MAX_SESSION_PATHS)
+        {
+            session_segment = segment;
+            path_ids.clear();
+
+            BinarySessionRecord session;
+            memset(&session, 0, sizeof(session));
+            session.header.type = BINARY_RECORD_SESSION;
+            session.header.length = sizeof(session);
+            memcpy(session.magic, BINARY_AUDIT_MAGIC, sizeof(session.magic));
+            session.version = BINARY_AUDIT_VERSION;
+            append_bytes(&session, sizeof(session));
+        }
+
+        auto found = path_ids.find(key);
+        if (found == path_ids.end())
+        {
+            found = path_ids.emplace(key, (uint32_t) path_ids.size()).first;
+
+            BinaryPathRecord path_record;
+            memset(&path_record, 0, sizeof(path_record));
+            path_record.header.type = BINARY_RECORD_PATH;
+            path_record.header.length = 
+                binary_record_padded_length(sizeof(path_record) + 
+                                            path_string.size());
+            path_record.path_id = found->second;
+            path_record.path_length = path_string.size();
+            size_t record_start = record_buffer.size();
+            append_bytes(&path_record, sizeof(path_record));
+            append_bytes(path_string.data(), path_string.size());
+            record_buffer.resize(record_start + path_record.header.length, 
+                                 '\0');
+        }
+
+        BinaryEventRecord event_record;
+        memset(&event_record, 0, sizeof(event_record));
+        event_record.header.type = BINARY_RECORD_EVENT;
+        event_record.header.length = sizeof(event_record);
+        event_record.timestamp_ns = timestamp_ns;
+        event_record.mask = mask;
+        event_record.pid = pid;
+        event_record.uid = uid;
+        event_record.path_id = found->second;
+        event_record.repeat_count = repeat_count;
+        append_bytes(&event_record, sizeof(event_record));
+    }
+    while (!audit_writer.append_to_segment(record_buffer.data(), 
+                                           record_buffer.size(),
+                                           session_segment));
+    return record_buffer.size();
+}
+
+// An id is given to another path once its path is evicted, but never
+// within the same generation
+uint64_t BinaryAuditEncoder::path_key(const PathRef& path)
+{
+    if (!path.is_set())
+    {
+        return UINT64_MAX;
+    }
+    return (uint64_t) path.get_generation() << 32 | path.get_id();
+}
+
+void BinaryAuditEncoder::append_bytes(const void * bytes, size_t length)
+{
+    const char * first = (const char *) bytes;
+    record_buffer.insert(record_buffer.end(), first, first + length);
+}
@@ -0,0 +1,90 @@
+#ifndef BINARYAUDITENCODER_H
+#define BINARYAUDITENCODER_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include "AuditWriter.hpp"
+#include "BinaryAuditFormat.hpp"
+#include "PathTable.hpp"
+
+using namespace std;
+
+// Encodes audit events into the binary audit log format (see
+//  BinaryAuditFormat.hpp). Keeps the session's append-only path table,
+//  writing a path record the first time a path is seen. Paths are looked
+//  up by their PathTable id and generation, which name one path for as
+//  long as the table lives, so the path itself is neither copied nor
+//  hashed again. Safe to share
+//  between writer threads: a new path's record and the event using it are
+//  appended together, so a path is always defined before it is used.
+// Every segment of a rotated log is a session of its own (starting with a
+//  session record and its own path table), so segments can be decoded on
+//  their own. A session that has written MAX_SESSION_PATHS paths is
+//  followed by a new one, so that neither the encoder's nor the decoder's
+//  path table grows without bound when the log isn't rotated.
+class BinaryAuditEncoder
+{
+    public:
+        BinaryAuditEncoder();
+
+        // Intro:   Appends an event, preceded by a path record if its path
+        //              hasn't been written in this session yet, and by a
+        //              session record if this is the first event of the
+        //              run or of a new segment, or the session's path
+        //              table is full
+        // Inputs:  audit_writer : the writer of the binary audit log
+        //          timestamp_ns : time of the event, ns since the epoch
+        //          pid : pid of the accessing process
+        //          uid : real uid of the accessing process, or
+        //              BinaryEventRecord::UNKNOWN_UID
+        //          mask : the fanotify event access type mask
+        //          path : path of the accessed file, interned in the
+        //              one PathTable every event of this encoder comes from
+        //          repeat_count : number of events coalesced into this one,
+        //              or 0
+        // Outputs: None
+        // Return:  The number of bytes appended, records and padding
+        size_t append_event(AuditWriter& audit_writer, uint64_t timestamp_ns,
+                            pid_t pid, uid_t uid, uint64_t mask,
+                            const PathRef& path, uint32_t repeat_count = 0);
+
+    private:
+        // The most paths written in one session
+        static const size_t MAX_SESSION_PATHS = 1 << 20;
+
+        // Session ids of the paths written in this session, by
+        // path_key of their PathRef
+        unordered_map<uint64_t, uint32_t> path_ids;
+        // Output segment the current session was started in, UINT64_MAX
+        // before the first session
+        uint64_t session_segment;
+        // Records being put together, reused between events
+        vector<char> record_buffer;
+        // Guards the session state and record_buffer, and keeps appends
+        // in id order
+        mutex table_mutex;
+
+        BinaryAuditEncoder(const BinaryAuditEncoder&);
+        BinaryAuditEncoder& operator=(const BinaryAuditEncoder&);
+
+        // Intro:   Gets the key a path is found by in path_ids
+        // Inputs:  path : the path
+        // Outputs: None
+        // Return:  Its generation and id, or UINT64_MAX for no path
+        static uint64_t path_key(const PathRef& path);
+
+        // Intro:   Adds raw bytes to the end of record_buffer
+        // Inputs:  bytes : the bytes to add
+        //          length : the number of bytes
+        // Outputs: None
+        // Return:  void
+        void append_bytes(const void * bytes, size_t length);
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef BINARYAUDITFORMAT_H
+#define BINARYAUDITFORMAT_H
+
+#include <climits>
+#include <cstdint>
+
+// Layout of the binary audit log written with --format=binary (see
+//  dirmon-decode for turning it back into text). A log is a sequence of
+//  records, each starting with a BinaryRecordHeader and padded to a multiple
+//  of 8 bytes. Fields are in host byte order. Every dirmon run starts with
+//  a session record; paths are written once per session as path records
+//  and events refer to them by id, so ids are only meaningful within the
+//  session that defined them.
+
+// Record types
+const uint16_t BINARY_RECORD_SESSION = 1;
+const uint16_t BINARY_RECORD_PATH = 2;
+const uint16_t BINARY_RECORD_EVENT = 3;
+
+// Identifies a session record (and so the start of a binary audit log)
+const char BINARY_AUDIT_MAGIC[8] = {'D', 'I', 'R', 'M', 'O', 'N', 'B', '\0'};
+const uint32_t BINARY_AUDIT_VERSION = 1;
+
+struct BinaryRecordHeader
+{
+    // One of the BINARY_RECORD_* types
+    uint16_t type;
+    // Reserved, 0
+    uint16_t flags;
+    // Length of the whole record including this header and padding
+    uint32_t length;
+};
+
+// Starts a session (a dirmon run, a rotated segment, or the next batch of
+//  paths once a session holds too many) and resets the path table
+struct BinarySessionRecord
+{
+    BinaryRecordHeader header;
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+// Adds a path to the path table. Followed by path_length bytes of path
+//  (not NUL-terminated) and padding. A session's paths get ids 0, 1, 2...
+//  in the order their records are written.
+struct BinaryPathRecord
+{
+    BinaryRecordHeader header;
+    uint32_t path_id;
+    uint32_t path_length;
+};
+
+// One audited event
+struct BinaryEventRecord
+{
+    // uid of a process that exited before its owner could be looked up
+    static const uint32_t UNKNOWN_UID = 0xffffffff;
+
+    BinaryRecordHeader header;
+    // Time the event was read in nanoseconds since the epoch (CLOCK_MONOTONIC
+    //  shifted onto the wall clock, see EventClock)
+    uint64_t timestamp_ns;
+    // The raw fanotify event access type mask
+    uint64_t mask;
+    int32_t pid;
+    uint32_t uid;
+    // Id of the path from an earlier path record of the same session
+    uint32_t path_id;
+    // Number of events coalesced into this record, 0 for an event that
+    //  was written on its own
+    uint32_t repeat_count;
+};
+
+// Longest path a path record holds: a path read back from the kernel (less
+//  than PATH_MAX) or a directory's path with a file name (NAME_MAX) joined on
+const uint32_t BINARY_MAX_PATH_LENGTH = PATH_MAX + NAME_MAX + 1;
+
+static_assert(sizeof(BinaryRecordHeader) == 8, "unexpected padding");
+static_assert(sizeof(BinarySessionRecord) == 24, "unexpected padding");
+static_assert(sizeof(BinaryPathRecord) == 16, "unexpected padding");
+static_assert(sizeof(BinaryEventRecord) == 40, "unexpected padding");
+
+// Intro:   Rounds a record length up to the record alignment
+// Inputs:  length : the unpadded length of a record
+// Outputs: None
+// Return:  The padded length
+inline uint32_t binary_record_padded_length(uint32_t length)
+{
+    return (length + 7) & ~(uint32_t) 7;
+}
+
+// Longest record of any type there is, a path record of the longest path.
+//  A reader can reject anything longer as corrupt.
+const uint32_t BINARY_MAX_RECORD_LENGTH = 
+    binary_record_padded_length(sizeof(BinaryPathRecord) + 
+                                BINARY_MAX_PATH_LENGTH);
+
+#endif
@@ -30,214 +30,1960 @@ DirectoryListAuditor* DirectoryListAuditor::get_instance()
 // TODO Possible Improvement:
 //      Pass in an error_stream that would allow us to write to cerr or
 //          a file depending on whether we are using a terminal or the service
-// TODO Possible Improvement:
-//      Directory auditor should separately mark audit_output_filename
-//          because it needs to update other marks anytime that the user
-//          decides to add or remove something from the list of files    
 //  Initialize the singleton instance to be ready to start auditing the given
 //  event types for the given directories to the given output file.
 //  DirectoryListAuditor is ready to call DirectoryListAuditor::audit_activity() 
 //  after this. 
 void DirectoryListAuditor::initialize(uint64_t event_types_mask, 
                                       string dir_list_filename,
-                                      string audit_output_filename)
-{
-    // TODO Possible Improvement:
-    //      Should change this comment to say "when the system shuts down"
-    // Create a signal handler to catch the SIGTERM shutdown signal to clean
-    // things up when the program ends     
-    signal(SIGTERM, signal_handler); 
-    // Create a signal handler to catch the SIGINT CTRL-C signal to clean
-    // things up if a user is running dirmon from the command line     
-    signal(SIGINT, signal_handler); 
-
-    // Try to initialize fanotify
-    // Set fanotify to give notifications on both accesses & attempted accesses    
-    unsigned int monitoring_flags = FAN_CLASS_CONTENT;
-    // Set event file to read-only and allow large files
-    unsigned int event_flags = O_RDONLY | O_LARGEFILE;
-    fanotify_fd = fanotify_init(monitoring_flags, event_flags);
-    if (fanotify_fd == -1)
+                                      string audit_output_filename,
+                                      AuditorOptions options)
+{
+    this->options = options;
+    user_cache.set_capacity(options.user_cache_size);
+    path_table.set_capacity(options.path_cache_size);
+
+    // Take SIGTERM (system shutdown) and SIGINT (CTRL-C from the command
+    // line) through a signalfd in the event loop instead of a handler, so
+    // shutdown happens on the reader thread between reads. Blocking them
+    // here also blocks them in every thread started from now on.
+    sigset_t termination_signals;
+    sigemptyset(&termination_signals);
+    sigaddset(&termination_signals, SIGINT);
+    sigaddset(&termination_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &termination_signals, NULL);
+    signal_fd = signalfd(-1, &termination_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1)
     {
-        cerr << "dirmon: cannot initialize fanotify file descriptor, errno:" 
+        cerr << "dirmon: cannot create signal file descriptor, errno:" 
              << strerror(errno) << endl;
         exit(errno);
     }
 
+    // Every event queued between the reader and the writers holds an open
+    // fd, so make room for a full ring before fanotify starts opening them
+    raise_open_file_limit();
+
+    // Every shard reads its own groups. The FID group can fail to come up
+    // on older kernels, in which case no shard gets one.
+    for (unsigned int i = 0; i < options.reader_shards; i++)
+    {
+        shards.emplace_back(new ReaderShard(i));
+        shards.back()->event_coalescer.set_window(options.coalesce_window);
+        create_fanotify_groups(*shards.back());
+    }
+    uint64_t fid_event_types_mask = 0;
+    if (shards[0]->fid_fanotify_fd != -1)
+    {
+        uint64_t fid_event_types = FAN_ACCESS | FAN_MODIFY | FAN_CLOSE | FAN_OPEN;
+        fid_event_types_mask = event_types_mask & 
+                               (fid_event_types | FAN_ONDIR | 
+                                FAN_EVENT_ON_CHILD);
+        event_types_mask &= ~fid_event_types;
+    }
+
+    // Compile the permission policy before anything is marked, so a bad
+    // rule file stops dirmon before it can hold up any access
+    if (!options.policy_filename.empty())
+    {
+        shared_ptr<PermissionPolicy> policy = make_shared<PermissionPolicy>();
+        string error_message;
+        if (!policy->load(options.policy_filename, error_message))
+        {
+            cerr << "dirmon: " << error_message << endl;
+            clean_up();
+            exit(EINVAL);
+        }
+        permission_policy = policy;
+    }
+    if (!options.filter_filename.empty())
+    {
+        shared_ptr<EventFilter> filter = make_shared<EventFilter>();
+        string error_message;
+        if (!filter->load(options.filter_filename, error_message))
+        {
+            cerr << "dirmon: " << error_message << endl;
+            clean_up();
+            exit(EINVAL);
+        }
+        event_filter = filter;
+    }
+
     // Open the directory list file
     fstream dir_list_file = open_fstream_safely(dir_list_filename);
+    this->dir_list_filename = dir_list_filename;
+    
+    // Create or append to given audit output file (or one file per shard)
+    unsigned int num_outputs = options.split_shard_output ? shards.size() : 1;
+    for (unsigned int i = 0; i < num_outputs; i++)
+    {
+        outputs.emplace_back(new AuditOutput());
+        open_audit_output(*outputs.back(), num_outputs == 1 ? 
+            audit_output_filename : 
+            audit_output_filename + "." + to_string(i));
+    }
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        (*shard)->output = outputs[(*shard)->index % num_outputs].get();
+    }
+
+    // Retrieve all of the directories to monitor and store them in a set,
+    // and share them out between the shards
+    map<string, unsigned int> requested_shards;
+    monitored_directories = read_directory_list(dir_list_file, 
+                                                requested_shards);
+    for (auto directory_name = monitored_directories.begin();
+         directory_name != monitored_directories.end();
+         directory_name++)
+    {
+        directory_shards[*directory_name] = 
+            pick_shard(*directory_name, requested_shards);
+    }
+    update_monitored_paths();
+
+    // Mount all of the directories that will be monitored (required
+    // for recursive monitoring of directories and all subdirectories).
+    // Filesystem marks cover them without any mounts, and the writers
+    // filter out events from the rest of each filesystem instead.
+    if (!options.mark_filesystem)
+    {
+        mount_directories(monitored_directories);
+    }
+
+    // Keep each monitored directory open for resolving file handles. This
+    // has to happen before marking, since opening a directory that is
+    // already marked for permission events would wait on a response that
+    // nobody is around to give yet.
+    if (shards[0]->fid_fanotify_fd != -1)
+    {
+        for (auto directory_name = monitored_directories.begin();
+             directory_name != monitored_directories.end();
+             directory_name++)
+        {
+            ReaderShard& shard = *shards[directory_shards[*directory_name]];
+            if (!shard.file_handle_cache.add_directory(*directory_name))
+            {
+                cerr << "dirmon: cannot open directory '" << *directory_name
+                     << "' for resolving file handles, errno:" 
+                     << strerror(errno) << endl;
+            }
+        }
+    }
+
+    // Specifically ignore events for the output file as to avoid
+    // rapidly generating an infinite feedback loop of modify events if
+    // the user wants to monitor the directory containing their 
+    // output file. The directory list file is ignored too, since reading
+    // it on a reload from the reader thread must never wait on a
+    // permission event only that same thread can answer.
+    set<string> excluded_directories;
+    for (auto output = outputs.begin(); output != outputs.end(); output++)
+    {
+        excluded_directories.insert((*output)->filename);
+    }
+    excluded_directories.insert(dir_list_filename);
+    if (!options.policy_filename.empty())
+    {
+        excluded_directories.insert(options.policy_filename);
+    }
+    if (!options.filter_filename.empty())
+    {
+        excluded_directories.insert(options.filter_filename);
+    }
     
-    // Create or append to given audit output file
-    audit_output_file = ofstream(audit_output_filename, 
-                               ofstream::out | ofstream::app);
-    output_filename = audit_output_filename;
+    // Mark all of the directories for monitoring, and exclude the
+    // audit output file (skipping a group that was left with no events)
+    uint64_t event_flags_mask = FAN_ONDIR | FAN_EVENT_ON_CHILD;
+    if (event_types_mask & ~event_flags_mask)
+    {
+        ignored_event_types_mask = event_types_mask;
+    }
+    if (fid_event_types_mask & ~event_flags_mask)
+    {
+        ignored_fid_event_types_mask = fid_event_types_mask;
+    }
+    mark_on_shards(monitored_directories, excluded_directories);
+    if (event_filter)
+    {
+        update_filter_ignore_marks(*event_filter);
+    }
+
+    // Pick up edits to the configuration files without a restart
+    watch_config_files();
+}
+
+//  Begin to audit according to the guidelines configured in 
+//  DirectoryListAuditor::initialize(...)
+int DirectoryListAuditor::audit_activity(const size_t event_buf_size)
+{
+    start_auditing(event_buf_size);
+    while (read_event())
+    {
+    }
+    cout << "dirmon: Ending gracefully due to signal (" 
+         << termination_signal << ")" << endl;
+    stop_auditing();
+    cout << "dirmon: Done with post-signal cleanup, exiting..." << endl;
+    return termination_signal;
+}
 
-    // We want to add the marked directories as recursively monitored mounts
-    unsigned int mark_flags = FAN_MARK_ADD | FAN_MARK_ONLYDIR | FAN_MARK_MOUNT;
+// Start the writers and put every descriptor the reader waits on into one
+// epoll set
+void DirectoryListAuditor::start_auditing(const size_t event_buf_size)
+{
+    // Create a buffer for each shard to read events into, which grows up
+    // to options.max_event_buffer_bytes under bursts
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        if (!(*shard)->event_buffer.set_limits(event_buf_size, 
+                                       options.max_event_buffer_bytes))
+        {
+            cerr << "dirmon: cannot allocate event buffer" << endl;
+            clean_up();
+            exit(ENOMEM);
+        }
+    }
+    audit_start_time = chrono::steady_clock::now();
     
-    // Retrieve all of the directories to monitor and store them in a set
+    // Keep the fds the full rings of all shards can hold to half of the
+    // open file limit, so a backlog can't starve the readers of fds for
+    // new events
+    size_t max_ring_capacity = 2;
+    while (max_ring_capacity * 2 * shards.size() <= open_file_limit / 2)
+    {
+        max_ring_capacity *= 2;
+    }
+    if (options.ring_capacity > max_ring_capacity)
+    {
+        cerr << "dirmon: ring size " << options.ring_capacity 
+             << " exceeds half the open file limit; using " 
+             << max_ring_capacity << endl;
+        options.ring_capacity = max_ring_capacity;
+    }
+    writers_running = true;
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        (*shard)->event_ring.reset(
+            new EventRing<AuditEvent>(options.ring_capacity));
+        for (unsigned int i = 0; i < options.writer_threads; i++)
+        {
+            (*shard)->writer_threads.emplace_back(
+                &DirectoryListAuditor::run_writer, this, ref(**shard));
+        }
+    }
+    start_readers();
+    if (options.permission_deadline.count() > 0)
+    {
+        watchdog_running = true;
+        permission_watchdog = 
+            thread(&DirectoryListAuditor::run_permission_watchdog, this);
+    }
+
+    // Batched output gets committed at least every commit_latency even
+    // while every writer is held up formatting a long burst: the tick has
+    // them commit between two events. The same tick
+    // lets a single shard's event buffer shrink once traffic stops (reader
+    // threads check their own), so it runs every idle_interval even
+    // without batching.
+    if (options.batch_bytes > 0 && options.commit_latency.count() > 0)
+    {
+        flush_timer_fd = create_interval_timer(options.commit_latency);
+    }
+    else if (shards.size() == 1 && shards[0]->event_buffer.is_adaptive())
+    {
+        flush_timer_fd = create_interval_timer(EventBuffer::idle_interval);
+    }
+    start_metrics();
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+    {
+        cerr << "dirmon: cannot create epoll file descriptor, errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    // A single shard is read right here, more have reader threads
+    int fanotify_fd = shards.size() == 1 ? shards[0]->fanotify_fd : -1;
+    int fid_fanotify_fd = shards.size() == 1 ? shards[0]->fid_fanotify_fd 
+                                             : -1;
+    int loop_fds[] = {fanotify_fd, fid_fanotify_fd, config_watch_fd,
+                      flush_timer_fd, metrics_timer_fd, metrics_socket_fd,
+                      signal_fd};
+    for (int loop_fd : loop_fds)
+    {
+        if (loop_fd == -1)
+        {
+            continue;
+        }
+        struct epoll_event readable;
+        readable.events = EPOLLIN;
+        readable.data.fd = loop_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, loop_fd, &readable) == -1)
+        {
+            cerr << "dirmon: cannot add file descriptor to epoll, errno:" 
+                 << strerror(errno) << endl;
+            clean_up();
+            exit(errno);
+        }
+    }
+}
+
+// Handle everything epoll reports ready in one go. The descriptors are
+// level-triggered and non-blocking, so whatever one read leaves behind is
+// simply reported again on the next call.
+bool DirectoryListAuditor::read_event(int timeout_ms)
+{
+    struct epoll_event ready[MAX_LOOP_FDS];
+    int num_ready = epoll_wait(epoll_fd, ready, MAX_LOOP_FDS, timeout_ms);
+    if (num_ready == -1)
+    {
+        if (errno == EINTR)
+        {
+            return true;
+        }
+        cerr << "dirmon: error waiting for events, errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    for (int i = 0; i < num_ready; i++)
+    {
+        int ready_fd = ready[i].data.fd;
+        if (ready_fd == shards[0]->fanotify_fd)
+        {
+            read_events(*shards[0]);
+        }
+        else if (ready_fd == shards[0]->fid_fanotify_fd)
+        {
+            read_fid_events(*shards[0]);
+        }
+        else if (ready_fd == config_watch_fd)
+        {
+            read_config_changes();
+        }
+        else if (ready_fd == flush_timer_fd)
+        {
+            flush_output();
+        }
+        else if (ready_fd == metrics_timer_fd)
+        {
+            write_metrics_file();
+        }
+        else if (ready_fd == metrics_socket_fd)
+        {
+            serve_metrics();
+        }
+        else if (ready_fd == signal_fd)
+        {
+            read_termination_signal();
+        }
+    }
+    return termination_signal == 0;
+}
+
+void DirectoryListAuditor::stop_auditing()
+{
+    clean_up();
+}
+
+// Apply the difference between the directory list file and the directories
+// currently monitored
+void DirectoryListAuditor::reload_directory_list()
+{
+    // The list file may have been replaced by a new one, which needs its
+    // own ignore mark before we open it
+    set<string> no_directories;
+    set<string> excluded_files;
+    excluded_files.insert(dir_list_filename);
+    mark_on_shards(no_directories, excluded_files);
+
+    fstream dir_list_file(dir_list_filename, ios::in);
+    if (!dir_list_file.is_open())
+    {
+        cerr << "dirmon: cannot reload directory list file '"
+             << dir_list_filename << "', errno:" << strerror(errno)
+             << "; keeping the current directories" << endl;
+        return;
+    }
+    map<string, unsigned int> requested_shards;
+    set<string> listed_directories = read_directory_list(dir_list_file,
+                                                         requested_shards);
+
+    set<string> removed_directories;
+    set_difference(monitored_directories.begin(), monitored_directories.end(),
+                   listed_directories.begin(), listed_directories.end(),
+                   inserter(removed_directories, removed_directories.end()));
+    set<string> added_directories;
+    set_difference(listed_directories.begin(), listed_directories.end(),
+                   monitored_directories.begin(), monitored_directories.end(),
+                   inserter(added_directories, added_directories.end()));
+
+    for (auto directory_name = removed_directories.begin();
+         directory_name != removed_directories.end();
+         directory_name++)
+    {
+        monitored_directories.erase(*directory_name);
+        // Our descriptor on the directory would keep its detached mount
+        // around, and handles resolved through it would go stale
+        ReaderShard& shard = *shards[directory_shards[*directory_name]];
+        if (shard.fid_fanotify_fd != -1)
+        {
+            lock_guard<mutex> lock(shard.file_handle_cache_mutex);
+            shard.file_handle_cache.remove_directory(*directory_name);
+        }
+        unmonitor_directory(*directory_name);
+        directory_shards.erase(*directory_name);
+        cout << "dirmon: stopped monitoring directory '" 
+             << *directory_name << "'" << endl;
+    }
+
+    // Same order as initialize: mount, open for the handle cache, mark.
+    // Directories on both lists keep their shard, even if the list now
+    // asks for another one.
+    set<string> started_directories;
+    for (auto directory_name = added_directories.begin();
+         directory_name != added_directories.end();
+         directory_name++)
+    {
+        if (!options.mark_filesystem && !mount_directory(*directory_name))
+        {
+            cerr << "dirmon: cannot mount directory '" << *directory_name
+                 << "' for monitoring, errno:" << strerror(errno) 
+                 << "; skipping directory..." << endl;
+            continue;
+        }
+        started_directories.insert(*directory_name);
+        monitored_directories.insert(*directory_name);
+        unsigned int shard_index = pick_shard(*directory_name, 
+                                              requested_shards);
+        directory_shards[*directory_name] = shard_index;
+        ReaderShard& shard = *shards[shard_index];
+        if (shard.fid_fanotify_fd != -1)
+        {
+            lock_guard<mutex> lock(shard.file_handle_cache_mutex);
+            if (!shard.file_handle_cache.add_directory(*directory_name))
+            {
+                cerr << "dirmon: cannot open directory '" << *directory_name
+                     << "' for resolving file handles, errno:" 
+                     << strerror(errno) << endl;
+            }
+        }
+        cout << "dirmon: started monitoring directory '" 
+             << *directory_name << "'" << endl;
+    }
+    set<string> no_exclusions;
+    mark_on_shards(started_directories, no_exclusions);
+    update_monitored_paths();
+}
+
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Mark a freshly rotated active segment to be ignored like the original
+// audit output file was in initialize (by every shard, since any of them
+// may monitor the directory it is in). The writer hasn't opened it yet.
+void DirectoryListAuditor::ignore_output_segment(AuditOutput& output,
+                                                 const string& active_segment)
+{
+    remember_output_identity(output, active_segment);
+    set<string> no_directories;
+    set<string> excluded_files;
+    excluded_files.insert(active_segment);
+    mark_on_shards(no_directories, excluded_files);
+}
+
+// Ignore the excluded access types on each path in every shard's groups,
+// after taking back what the previous filter had ignored. A path that is
+// gone can't have its old marks removed, but they went with its inode.
+void DirectoryListAuditor::update_filter_ignore_marks(const EventFilter& filter)
+{
+    uint64_t never_ignored = options.policy_filename.empty() ? 0 :
+                             FAN_OPEN_PERM | FAN_ACCESS_PERM;
+    vector<pair<int, uint64_t>> groups;
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        if (ignored_event_types_mask)
+        {
+            groups.push_back(make_pair((*shard)->fanotify_fd,
+                                       ignored_event_types_mask));
+        }
+        if ((*shard)->fid_fanotify_fd != -1 && ignored_fid_event_types_mask)
+        {
+            groups.push_back(make_pair((*shard)->fid_fanotify_fd,
+                                       ignored_fid_event_types_mask));
+        }
+    }
+
+    for (auto mark = filter_ignore_marks.begin(); 
+         mark != filter_ignore_marks.end();
+         mark++)
+    {
+        for (auto group = groups.begin(); group != groups.end(); group++)
+        {
+            uint64_t mask = mark->second & group->second;
+            if (mask)
+            {
+                fanotify_mark(group->first, 
+                              FAN_MARK_REMOVE | FAN_MARK_IGNORED_MASK,
+                              mask, AT_FDCWD, mark->first.c_str());
+            }
+        }
+    }
+
+    filter_ignore_marks.clear();
+    vector<pair<string, uint64_t>> ignore_marks;
+    filter.get_static_exclusions(ignore_marks);
+    for (auto mark = ignore_marks.begin(); mark != ignore_marks.end(); mark++)
+    {
+        // An ignore mark on a directory only covers the directory itself,
+        // while the rule also covers everything beneath it, so directories
+        // are left to the filter
+        struct stat path_stat;
+        if (stat(mark->first.c_str(), &path_stat) == 0 && 
+            S_ISDIR(path_stat.st_mode))
+        {
+            continue;
+        }
+        mark->second &= ~never_ignored;
+        bool marked = true;
+        for (auto group = groups.begin(); group != groups.end(); group++)
+        {
+            uint64_t mask = mark->second & group->second;
+            if (mask && 
+                fanotify_mark(group->first, FAN_MARK_ADD | 
+                              FAN_MARK_IGNORED_MASK |
+                              FAN_MARK_IGNORED_SURV_MODIFY,
+                              mask, AT_FDCWD, mark->first.c_str()) == -1)
+            {
+                marked = false;
+            }
+        }
+        if (!marked)
+        {
+            cerr << "dirmon: cannot ignore filtered events on '" 
+                 << mark->first << "'; (errno: " << strerror(errno)
+                 << "), filtering them in dirmon instead" << endl;
+        }
+        filter_ignore_marks.push_back(*mark);
+    }
+}
+
+// Compile the policy file into a new policy and swap it in, keeping the
+// current one if the file has an error
+void DirectoryListAuditor::reload_policy()
+{
+    if (options.policy_filename.empty())
+    {
+        return;
+    }
+    // A replaced policy file needs its own ignore mark before we open it
+    set<string> no_directories;
+    set<string> excluded_files;
+    excluded_files.insert(options.policy_filename);
+    mark_on_shards(no_directories, excluded_files);
+
+    shared_ptr<PermissionPolicy> policy = make_shared<PermissionPolicy>();
+    string error_message;
+    if (!policy->load(options.policy_filename, error_message))
+    {
+        cerr << "dirmon: " << error_message 
+             << "; keeping the current policy" << endl;
+        return;
+    }
+    atomic_store(&permission_policy, shared_ptr<const PermissionPolicy>(policy));
+    cout << "dirmon: loaded " << policy->get_rule_count() 
+         << " policy rules" << endl;
+}
+
+// Compile the filter file into a new filter and swap it in, keeping the
+// current one if the file has an error
+void DirectoryListAuditor::reload_filter()
+{
+    if (options.filter_filename.empty())
+    {
+        return;
+    }
+    set<string> no_directories;
+    set<string> excluded_files;
+    excluded_files.insert(options.filter_filename);
+    mark_on_shards(no_directories, excluded_files);
+
+    shared_ptr<EventFilter> filter = make_shared<EventFilter>();
+    string error_message;
+    if (!filter->load(options.filter_filename, error_message))
+    {
+        cerr << "dirmon: " << error_message 
+             << "; keeping the current filter" << endl;
+        return;
+    }
+    update_filter_ignore_marks(*filter);
+    atomic_store(&event_filter, shared_ptr<const EventFilter>(filter));
+    cout << "dirmon: loaded " << filter->get_rule_count() 
+         << " filter rules" << endl;
+}
+
+// Read the directory list, one directory per line, each optionally
+// preceded by @N to put it on reader shard N
+set<string> DirectoryListAuditor::read_directory_list(fstream& dir_list_file,
+                                map<string, unsigned int>& requested_shards)
+{
+    set<string> directories;
     string directory_name;
+    bool shard_requested = false;
+    unsigned int requested_shard = 0;
     while(dir_list_file >> directory_name)
     {
-        monitored_directories.insert(directory_name);
+        if (directory_name[0] == '@')
+        {
+            requested_shard = strtoul(directory_name.c_str() + 1, NULL, 10);
+            shard_requested = true;
+            continue;
+        }
+        directories.insert(directory_name);
+        if (shard_requested)
+        {
+            requested_shards[directory_name] = requested_shard;
+            shard_requested = false;
+        }
+    }
+    return directories;
+}
+
+// A directory goes to the shard the list asked for, or else to the one its
+// path hashes to (FNV-1a, which unlike std::hash gives the same shards
+// from run to run). Filesystem marks cover a whole filesystem, so there
+// the filesystem picks the shard for all of its directories instead.
+unsigned int DirectoryListAuditor::pick_shard(const string& directory_name,
+                        const map<string, unsigned int>& requested_shards)
+{
+    if (options.mark_filesystem)
+    {
+        struct stat directory_stat;
+        if (stat(directory_name.c_str(), &directory_stat) == -1)
+        {
+            return 0;
+        }
+        return directory_stat.st_dev % shards.size();
+    }
+    auto requested = requested_shards.find(directory_name);
+    if (requested != requested_shards.end())
+    {
+        if (requested->second >= shards.size())
+        {
+            cerr << "dirmon: no reader shard " << requested->second 
+                 << " for directory '" << directory_name << "'; using "
+                 << requested->second % shards.size() << endl;
+        }
+        return requested->second % shards.size();
+    }
+    uint64_t path_hash = 14695981039346656037ULL;
+    for (char c : directory_name)
+    {
+        path_hash = (path_hash ^ (unsigned char) c) * 1099511628211ULL;
+    }
+    return path_hash % shards.size();
+}
+
+// Open the main group of a shard, and its FID group if asked for. Directory
+// handles + names are preferred for the FID group (one cache entry per
+// directory), plain file handles are the fallback for kernels before 5.9.
+// FID reporting can't be combined with FAN_CLASS_CONTENT, hence the second
+// group.
+void DirectoryListAuditor::create_fanotify_groups(ReaderShard& shard)
+{
+    // Set fanotify to give notifications on both accesses & attempted
+    // accesses. Non-blocking, since the event loop only reads what epoll
+    // reported.
+    unsigned int monitoring_flags = FAN_CLASS_CONTENT | FAN_NONBLOCK;
+    // Optionally let the kernel queue events without limit rather than
+    // overflow after 16384 of them
+    unsigned int queue_flags = options.unlimited_queue ? FAN_UNLIMITED_QUEUE
+                                                       : 0;
+    monitoring_flags |= queue_flags;
+    // Set event file to read-only and allow large files
+    unsigned int event_flags = O_RDONLY | O_LARGEFILE;
+    shard.fanotify_fd = fanotify_init(monitoring_flags, event_flags);
+    if (shard.fanotify_fd == -1)
+    {
+        cerr << "dirmon: cannot initialize fanotify file descriptor, errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+
+    // Only try for a FID group where the first shard got one, so that
+    // either every shard has one or none does
+    if (!options.report_fid || 
+        (shard.index > 0 && shards[0]->fid_fanotify_fd == -1))
+    {
+        return;
+    }
+    shard.fid_fanotify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_NONBLOCK |
+                                          queue_flags | FAN_REPORT_DFID_NAME,
+                                          event_flags);
+    if (shard.fid_fanotify_fd == -1)
+    {
+        shard.fid_fanotify_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_NONBLOCK |
+                                              queue_flags | FAN_REPORT_FID,
+                                              event_flags);
+    }
+    if (shard.fid_fanotify_fd != -1)
+    {
+        return;
+    }
+    if (shard.index > 0)
+    {
+        cerr << "dirmon: cannot initialize FID-reporting fanotify file "
+             << "descriptor for reader shard " << shard.index << ", errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    cerr << "dirmon: cannot initialize FID-reporting fanotify file "
+         << "descriptor, errno:" << strerror(errno) 
+         << "; using event file descriptors instead" << endl;
+}
+
+// Open the audit output file, and have every new segment after a rotation
+// ignored like the file itself
+void DirectoryListAuditor::open_audit_output(AuditOutput& output,
+                                             const string& filename)
+{
+    if (!output.writer.open(filename, options.batch_bytes,
+                            options.commit_latency, options.sync_on_commit))
+    {
+        cerr << "dirmon: cannot open audit output file '" 
+             << filename << "', errno:" << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    char * full_path = realpath(filename.c_str(), NULL);
+    output.filename = full_path ? full_path : filename;
+    free(full_path);
+    remember_output_identity(output, filename);
+    AuditOutput * rotated_output = &output;
+    output.writer.set_rotation(options.rotate_bytes, options.rotate_interval,
+                               options.compress_segments,
+                               [this, rotated_output](const string& segment) {
+                                   ignore_output_segment(*rotated_output,
+                                                         segment);
+                               });
+    if (options.io_uring_buffers > 0 &&
+        !output.writer.use_io_uring(options.io_uring_buffers))
+    {
+        cerr << "dirmon: cannot set up io_uring for the audit output, errno:"
+             << strerror(errno) << "; writing it directly instead" << endl;
+    }
+}
+
+// Watch the directories holding the configuration files rather
+// than the files themselves, so that replacing a file (as most editors do)
+// is noticed too
+void DirectoryListAuditor::watch_config_files()
+{
+    config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (config_watch_fd == -1)
+    {
+        cerr << "dirmon: cannot watch configuration files for changes, "
+             << "errno:" << strerror(errno) << endl;
+        return;
+    }
+    dir_list_watch = add_config_watch(dir_list_filename);
+    if (!options.policy_filename.empty())
+    {
+        policy_watch = add_config_watch(options.policy_filename);
+    }
+    if (!options.filter_filename.empty())
+    {
+        filter_watch = add_config_watch(options.filter_filename);
+    }
+}
+
+// Add an inotify watch on the directory holding a file
+int DirectoryListAuditor::add_config_watch(const string& filename)
+{
+    size_t slash_pos = filename.rfind('/');
+    string directory = slash_pos == string::npos ? "." :
+                       slash_pos == 0 ? "/" :
+                       filename.substr(0, slash_pos);
+    int watch = inotify_add_watch(config_watch_fd, directory.c_str(),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch == -1)
+    {
+        cerr << "dirmon: cannot watch '" << filename << "' for changes, "
+             << "errno:" << strerror(errno) << endl;
+    }
+    return watch;
+}
+
+// Does an inotify event say that the given file was written or replaced?
+bool DirectoryListAuditor::is_change_to(const struct inotify_event * change,
+                                        int watch, const string& filename)
+{
+    if (watch == -1 || change->wd != watch || change->len == 0)
+    {
+        return false;
+    }
+    size_t slash_pos = filename.rfind('/');
+    return filename.compare(slash_pos == string::npos ? 0 : slash_pos + 1,
+                            string::npos, change->name) == 0;
+}
+
+// Reload each changed file once for any number of changes to it that
+// arrived together
+void DirectoryListAuditor::read_config_changes()
+{
+    bool list_changed = false;
+    bool policy_changed = false;
+    bool filter_changed = false;
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t num_bytes_read;
+    while ((num_bytes_read = read(config_watch_fd, buffer, 
+                                  sizeof(buffer))) > 0)
+    {
+        for (char * position = buffer; position < buffer + num_bytes_read;)
+        {
+            struct inotify_event * change = (struct inotify_event *) position;
+            list_changed |= is_change_to(change, dir_list_watch, 
+                                         dir_list_filename);
+            policy_changed |= is_change_to(change, policy_watch,
+                                           options.policy_filename);
+            filter_changed |= is_change_to(change, filter_watch,
+                                           options.filter_filename);
+            position += sizeof(struct inotify_event) + change->len;
+        }
+    }
+    if (list_changed)
+    {
+        reload_directory_list();
+    }
+    if (policy_changed)
+    {
+        reload_policy();
+    }
+    if (filter_changed)
+    {
+        reload_filter();
+    }
+}
+
+// Raise the soft open file limit to the hard limit, and the hard limit to
+// fs.nr_open when we are allowed to (i.e. running as root)
+void DirectoryListAuditor::raise_open_file_limit()
+{
+    struct rlimit file_limit;
+    if (getrlimit(RLIMIT_NOFILE, &file_limit) == -1)
+    {
+        return;
+    }
+    rlim_t system_max = 0;
+    ifstream nr_open_file("/proc/sys/fs/nr_open");
+    nr_open_file >> system_max;
+
+    struct rlimit raised_limit = file_limit;
+    raised_limit.rlim_max = max(file_limit.rlim_max, system_max);
+    raised_limit.rlim_cur = raised_limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &raised_limit) == -1)
+    {
+        raised_limit = file_limit;
+        raised_limit.rlim_cur = raised_limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &raised_limit) == -1)
+        {
+            cerr << "dirmon: cannot raise open file limit, errno:"
+                 << strerror(errno) << endl;
+            raised_limit = file_limit;
+        }
+    }
+    open_file_limit = raised_limit.rlim_cur;
+}
+
+// Mount the given set of directories, exiting with errno set if mount fails
+// on any of them
+void DirectoryListAuditor::mount_directories(set<string> directories)
+{
+    for (auto directory_name = directories.begin();
+         directory_name != directories.end();
+         directory_name++)
+    {
+        // Mount each of our directories
+        // NOTE: We need to mount the directory as itself because: 
+        // 1. fanotify requires that a directory be mounted to support the
+        //    FA_MARK_MOUNT recursive directory monitoring flag.
+        // 2. fanotify has a bug in Linux Kernel 3.17 onwards (see man) where 
+        //    it is only able to pick up notifications from mountpoints 
+        //    through the target mount point, and not the source. 
+        //     
+        // NOTE:This has a vulnerability in that any process that is already
+        //      inside the directory before this mount occurs will not have
+        //      any of its accesses monitored.
+        if (!mount_directory(*directory_name))
+        {
+            cerr << "dirmon: cannot mount directory '" << *directory_name
+                 << "'for monitoring, errno:" << strerror(errno) << endl;
+            clean_up();
+            exit(errno);
+        }
+    }
+}
+
+// Bind mount one directory onto itself
+bool DirectoryListAuditor::mount_directory(const string& directory_name)
+{
+    return mount(directory_name.c_str(), directory_name.c_str(), 
+                 "", MS_BIND, "") == 0;
+}
+
+// Remove a directory's mount marks, then the mount itself. A filesystem
+// mark stays until no monitored directory is left on that filesystem.
+void DirectoryListAuditor::unmonitor_directory(const string& directory_name)
+{
+    if (options.mark_filesystem && 
+        is_filesystem_monitored(directory_name))
+    {
+        return;
+    }
+    ReaderShard& shard = *shards[directory_shards[directory_name]];
+    unsigned int mark_flags = FAN_MARK_REMOVE | get_monitoring_mark_flags();
+    if (ignored_event_types_mask &&
+        fanotify_mark(shard.fanotify_fd, mark_flags, ignored_event_types_mask,
+                      AT_FDCWD, directory_name.c_str()) == -1)
+    {
+        cerr << "dirmon: cannot unmark pathname '" << directory_name
+             << "'; (errno: " << strerror(errno) << ")" << endl;
+    }
+    if (shard.fid_fanotify_fd != -1 && ignored_fid_event_types_mask &&
+        fanotify_mark(shard.fid_fanotify_fd, mark_flags, 
+                      ignored_fid_event_types_mask,
+                      AT_FDCWD, directory_name.c_str()) == -1)
+    {
+        cerr << "dirmon: cannot unmark pathname '" << directory_name
+             << "'; (errno: " << strerror(errno) << ")" << endl;
+    }
+    // MNT_DETACH for the same reason as in clean_up
+    if (!options.mark_filesystem &&
+        umount2(directory_name.c_str(), MNT_DETACH) == -1)
+    {
+        cerr << "dirmon: cannot unmount directory '" << directory_name
+             << "', errno:" << strerror(errno) << endl;
+    }
+}
+
+// Monitoring marks cover the bind mount of each directory, or with
+// options.mark_filesystem the whole filesystem it is on
+unsigned int DirectoryListAuditor::get_monitoring_mark_flags()
+{
+    return FAN_MARK_ONLYDIR | 
+           (options.mark_filesystem ? FAN_MARK_FILESYSTEM : FAN_MARK_MOUNT);
+}
+
+// Is another monitored directory on the same filesystem as this one?
+bool DirectoryListAuditor::is_filesystem_monitored(const string& directory_name)
+{
+    struct stat directory_stat;
+    if (stat(directory_name.c_str(), &directory_stat) == -1)
+    {
+        return false;
+    }
+    for (auto monitored_directory = monitored_directories.begin();
+         monitored_directory != monitored_directories.end();
+         monitored_directory++)
+    {
+        struct stat monitored_stat;
+        if (stat(monitored_directory->c_str(), &monitored_stat) == 0 &&
+            monitored_stat.st_dev == directory_stat.st_dev)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Build a fresh trie of the monitored directories and hand it to the
+// writers; a writer still using the old trie keeps it alive until it's done
+void DirectoryListAuditor::update_monitored_paths()
+{
+    shared_ptr<PathTrie> paths = make_shared<PathTrie>();
+    for (auto directory_name = monitored_directories.begin();
+         directory_name != monitored_directories.end();
+         directory_name++)
+    {
+        // Event paths are read back from the kernel, so compare against
+        // the same canonical form
+        char * full_path = realpath(directory_name->c_str(), NULL);
+        paths->insert(full_path ? full_path : *directory_name);
+        free(full_path);
+    }
+    atomic_store(&monitored_paths, shared_ptr<const PathTrie>(paths));
+}
+
+//  Mark the given directories for monitoring for the specified types of
+//  access events using the open fanotify file descriptor. Exlcude the
+//  other set of directories for the same types of access events.
+void DirectoryListAuditor::mark_directories(int fanotify_fd, 
+                                            unsigned int mark_flags,
+                                            uint64_t event_types_mask,
+                                            set<string> monitored_directories, 
+                                            set<string> excluded_directories)
+{
+    for (auto directory_name = monitored_directories.begin();
+         directory_name != monitored_directories.end();
+         directory_name++)
+    {
+        // Mark the mounted directory for monitoring
+        // (Pass in AT_FDCWD for directory file descriptor so that we can
+        //  use relative pathnames if desired)
+        if (fanotify_mark(fanotify_fd, mark_flags,
+                          event_types_mask,
+                          AT_FDCWD,
+                          directory_name->c_str()) == -1)
+        {
+            cerr << "dirmon: cannot mark pathname '" 
+                 << *directory_name << "'; (errno: " << strerror(errno)
+                 << "); skipping directory..." << endl;
+        }
+    }
+
+    for (auto directory_name = excluded_directories.begin();
+         directory_name != excluded_directories.end();
+         directory_name++)
+    {
+        // Use IGNORED_MASK here to say that this should be ignored, and
+        // IGNORED_SURV_MODIFY so that the kernel doesn't drop the ignore
+        // mask the first time the (audit output) file is written to
+        if (fanotify_mark(fanotify_fd, FAN_MARK_ADD | FAN_MARK_IGNORED_MASK |
+                                       FAN_MARK_IGNORED_SURV_MODIFY,
+                          event_types_mask,
+                          AT_FDCWD,
+                          directory_name->c_str()) == -1)
+        {
+            cerr << "diraudit: cannot unmark audit output file '" 
+                 << *directory_name << "'; (errno: " 
+                 << strerror(errno) << ")" << endl;
+        }
+    }
+}
+
+// Mark each directory on its own shard's groups, and the excluded files on
+// every shard's groups, since any shard may monitor where they are
+void DirectoryListAuditor::mark_on_shards(const set<string>& directories,
+                                          const set<string>& excluded_files)
+{
+    unsigned int mark_flags = FAN_MARK_ADD | get_monitoring_mark_flags();
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        set<string> shard_directories;
+        for (auto directory_name = directories.begin();
+             directory_name != directories.end();
+             directory_name++)
+        {
+            if (directory_shards[*directory_name] == (*shard)->index)
+            {
+                shard_directories.insert(*directory_name);
+            }
+        }
+        if (ignored_event_types_mask)
+        {
+            mark_directories((*shard)->fanotify_fd, mark_flags, 
+                             ignored_event_types_mask,
+                             shard_directories, excluded_files);
+        }
+        if ((*shard)->fid_fanotify_fd != -1 && ignored_fid_event_types_mask)
+        {
+            mark_directories((*shard)->fid_fanotify_fd, mark_flags, 
+                             ignored_fid_event_types_mask,
+                             shard_directories, excluded_files);
+        }
+    }
+}
+
+// With more than one shard, every shard gets a reader thread that does
+// nothing but read its groups
+void DirectoryListAuditor::start_readers()
+{
+    if (shards.size() == 1)
+    {
+        return;
+    }
+    reader_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reader_stop_fd == -1)
+    {
+        cerr << "dirmon: cannot create reader stop file descriptor, errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        (*shard)->reader = thread(&DirectoryListAuditor::run_reader, this,
+                                  ref(**shard));
+    }
+}
+
+// Wait on the shard's groups and the stop fd. The groups are
+// level-triggered and non-blocking like in read_event. The wait times out
+// every idle_interval so the event buffer can shrink once traffic stops.
+void DirectoryListAuditor::run_reader(ReaderShard& shard)
+{
+    if (options.pin_readers)
+    {
+        pin_reader(shard.index);
+    }
+    // poll skips the FID group's entry when its fd is -1
+    struct pollfd loop_fds[] = {{shard.fanotify_fd, POLLIN, 0},
+                                {shard.fid_fanotify_fd, POLLIN, 0},
+                                {reader_stop_fd, POLLIN, 0}};
+    int timeout_ms = shard.event_buffer.is_adaptive() ? 
+                     EventBuffer::idle_interval.count() : -1;
+    for (;;)
+    {
+        int num_ready = poll(loop_fds, 3, timeout_ms);
+        if (num_ready == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            cerr << "dirmon: error waiting for events, errno:" 
+                 << strerror(errno) << endl;
+            clean_up();
+            exit(errno);
+        }
+        if (num_ready == 0)
+        {
+            shard.event_buffer.adapt_to_idle(chrono::steady_clock::now());
+            continue;
+        }
+        if (loop_fds[2].revents)
+        {
+            return;
+        }
+        if (loop_fds[0].revents)
+        {
+            read_events(shard);
+        }
+        if (loop_fds[1].revents)
+        {
+            read_fid_events(shard);
+        }
+    }
+}
+
+// Shard i goes on the i-th CPU the process may run on (wrapping around), so
+// the readers neither share a CPU nor move between CPUs while more CPUs
+// than shards are available
+void DirectoryListAuditor::pin_reader(unsigned int shard_index)
+{
+    cpu_set_t allowed_cpus;
+    if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) == -1)
+    {
+        return;
+    }
+    unsigned int skip = shard_index % CPU_COUNT(&allowed_cpus);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed_cpus) || skip-- > 0)
+        {
+            continue;
+        }
+        cpu_set_t reader_cpu;
+        CPU_ZERO(&reader_cpu);
+        CPU_SET(cpu, &reader_cpu);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(reader_cpu),
+                                           &reader_cpu);
+        if (error != 0)
+        {
+            cerr << "dirmon: cannot pin reader " << shard_index 
+                 << " to CPU " << cpu << ", errno:" << strerror(error) 
+                 << endl;
+        }
+        return;
+    }
+}
+
+// Wake every reader through the stop fd and wait for them. A reader that
+// is itself cleaning up (after a fatal error) can't wait for itself.
+void DirectoryListAuditor::stop_readers()
+{
+    if (reader_stop_fd == -1)
+    {
+        return;
+    }
+    uint64_t stop = 1;
+    if (write(reader_stop_fd, &stop, sizeof(stop)) == -1)
+    {
+        cerr << "dirmon: cannot stop the reader threads, errno:" 
+             << strerror(errno) << endl;
+    }
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        if (!(*shard)->reader.joinable())
+        {
+            continue;
+        }
+        if ((*shard)->reader.get_id() == this_thread::get_id())
+        {
+            (*shard)->reader.detach();
+            continue;
+        }
+        (*shard)->reader.join();
+    }
+    close(reader_stop_fd);
+    reader_stop_fd = -1;
+}
+
+// Read one batch from the main fanotify group, answering permission events
+// before queueing anything
+void DirectoryListAuditor::read_events(ReaderShard& shard)
+{
+    // A read only returns whole events, so a buffer that is (nearly) full
+    // just means more events are left for the next read; the event buffer
+    // grows when that keeps happening
+    ssize_t num_bytes_read = read_event_batch(shard, shard.fanotify_fd);
+    struct fanotify_event_metadata * events = shard.event_buffer.get();
+    chrono::steady_clock::time_point read_time = chrono::steady_clock::now();
+    // Every event of the batch is stamped with the time it was read, not
+    // the time a writer gets around to it
+    uint64_t read_time_ns = event_clock.now_ns();
+    if (num_bytes_read == -1)
+    {
+        // Running out of file descriptors only costs the event the kernel
+        // couldn't open one for (it denies it if it was a permission
+        // event), so keep going rather than take down every other event
+        if (errno == EMFILE || errno == ENFILE)
+        {
+            event_fd_failures++;
+            return;
+        }
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            return;
+        }
+        cerr << "dirmon: error reading from fanotify file descriptor" << endl;
+        clean_up();            
+        exit(errno);
+    }
+    // Let the watchdog answer whatever we can't answer in time
+    if (options.permission_deadline.count() > 0)
+    {
+        track_permission_events(shard, num_bytes_read, read_time);
+    }
+    // Answer every permission event in the batch first, with a single
+    // writev, so no accessing process waits on the rest of the batch being
+    // queued (which can block on a full ring)
+    // (FAN_EVENT_NEXT counts down the length it is given, hence the copy)
+    shard.batch_responses.clear();
+    size_t event_index = 0;
+    size_t permission_index = 0;
+    ssize_t num_bytes_left = num_bytes_read;
+    for (struct fanotify_event_metadata * event = events; 
+         FAN_EVENT_OK(event,num_bytes_left); 
+         event = FAN_EVENT_NEXT(event,num_bytes_left), event_index++)
+    {
+        if (shard.batch_policy_paths.size() <= event_index)
+        {
+            shard.batch_policy_paths.resize(event_index + 1);
+        }
+        shard.batch_policy_paths[event_index].reset();
+        if(event->fd >= 0 && requires_permission_response(event->mask))
+        {
+            uint32_t response = decide_permission(event->fd, event->pid,
+                                     shard.batch_policy_paths[event_index]);
+            if (claim_permission_event(shard, permission_index++))
+            {
+                shard.batch_responses.push_back(
+                    fanotify_response{event->fd, response});
+            }
+        }
+    }
+    send_permission_responses(shard);
+    chrono::steady_clock::duration response_latency = 
+        chrono::steady_clock::now() - read_time;
+    for (size_t i = 0; i < shard.batch_responses.size(); i++)
+    {
+        metrics.record_latency(AuditMetrics::PERMISSION_RESPONSE, 
+                               response_latency);
+    }
+
+    // Iterate over the variably-sized event metadata structs   
+    event_index = 0;
+    num_bytes_left = num_bytes_read;
+    for (struct fanotify_event_metadata * event = events; 
+         FAN_EVENT_OK(event,num_bytes_left); 
+         event = FAN_EVENT_NEXT(event,num_bytes_left), event_index++)
+    {
+        // From here on the event fd is closed whenever event_fd goes
+        // out of scope without being handed to the writers
+        EventFd event_fd(event->fd);
+        PathRef& policy_path = shard.batch_policy_paths[event_index];
+        // The kernel lost events after this one. The overflow event has
+        // no process (pid 0) and no file.
+        if (event->mask & FAN_Q_OVERFLOW)
+        {
+            record_queue_overflow(shard, read_time_ns);
+            continue;
+        }
+        // If we have the same PID as the auditing process, it means
+        // we should skip this event (events for the audit output file
+        // itself are mostly ignored by the kernel, and the writers skip
+        // the rest)
+        if (event->pid == getpid()) 
+        { 
+            continue;
+        }
+        // Hand over the path the policy already looked up, if it did
+        AuditEvent audit_event{move(event_fd), event->pid, event->mask,
+                               read_time_ns, move(policy_path)};
+        enqueue_event(shard, audit_event);
+    }
+    shard.event_buffer.adapt_to_read(num_bytes_read);
+}
+
+// Read one batch from the FID-reporting group, resolving each event's file
+// handle to a path through the handle cache
+void DirectoryListAuditor::read_fid_events(ReaderShard& shard)
+{
+    ssize_t num_bytes_read = read_event_batch(shard, shard.fid_fanotify_fd);
+    struct fanotify_event_metadata * events = shard.event_buffer.get();
+    if (num_bytes_read == -1)
+    {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            return;
+        }
+        cerr << "dirmon: error reading from fanotify file descriptor" << endl;
+        clean_up();            
+        exit(errno);
+    }
+    uint64_t read_time_ns = event_clock.now_ns();
+    // Paths are resolved into a buffer of the reader's, which only the
+    // path table copies out of
+    thread_local string fid_path;
+    // Held for the batch, so a reload adding a filesystem waits at most
+    // one batch
+    lock_guard<mutex> lock(shard.file_handle_cache_mutex);
+    ssize_t num_bytes_left = num_bytes_read;
+    for (struct fanotify_event_metadata * event = events; 
+         FAN_EVENT_OK(event,num_bytes_left); 
+         event = FAN_EVENT_NEXT(event,num_bytes_left))
+    {
+        if (event->mask & FAN_Q_OVERFLOW)
+        {
+            record_queue_overflow(shard, read_time_ns);
+            continue;
+        }
+        if (event->pid == getpid()) 
+        { 
+            continue;
+        }
+        AuditEvent audit_event{EventFd(), event->pid, event->mask, 
+                               read_time_ns, PathRef()};
+        // The fid info record directly follows the event metadata
+        struct fanotify_event_info_fid * fid = 
+            (struct fanotify_event_info_fid *) (event + 1);
+        bool timing = metrics.is_timing();
+        chrono::steady_clock::time_point resolve_start;
+        if (timing)
+        {
+            resolve_start = chrono::steady_clock::now();
+        }
+        if (event->event_len < event->metadata_len + sizeof(*fid))
+        {
+            fid_path = "FILE_NOT_FOUND";
+        }
+        else if (!shard.file_handle_cache.resolve(fid, fid_path))
+        {
+            fid_path = errno == ENAMETOOLONG ? "PATH_TOO_LONG" : 
+                                               "FILE_NOT_FOUND";
+        }
+        audit_event.path = path_table.intern(fid_path);
+        if (timing)
+        {
+            metrics.record_latency(AuditMetrics::PATH_RESOLUTION,
+                chrono::steady_clock::now() - resolve_start);
+        }
+        enqueue_event(shard, audit_event);
+    }
+    shard.event_buffer.adapt_to_read(num_bytes_read);
+}
+
+// Read whatever fits in the event buffer from one fanotify group, counting
+// reads and events (by access type) for the metrics
+ssize_t DirectoryListAuditor::read_event_batch(ReaderShard& shard, 
+                                               int group_fd)
+{
+    ssize_t num_bytes_read = read(group_fd, shard.event_buffer.get(), 
+                                  shard.event_buffer.get_size());
+    if (num_bytes_read > 0)
+    {
+        ssize_t num_bytes_left = num_bytes_read;
+        uint64_t num_events = 0;
+        for (struct fanotify_event_metadata * event = 
+                 shard.event_buffer.get(); 
+             FAN_EVENT_OK(event,num_bytes_left); 
+             event = FAN_EVENT_NEXT(event,num_bytes_left))
+        {
+            metrics.count_event_types(event->mask);
+            num_events++;
+        }
+        metrics.add(AuditMetrics::EVENT_READS);
+        metrics.add(AuditMetrics::EVENTS_READ, num_events);
+    }
+    return num_bytes_read;
+}
+
+// Remember the first termination signal; read_event reports it to its caller
+void DirectoryListAuditor::read_termination_signal()
+{
+    struct signalfd_siginfo signal_info;
+    while (read(signal_fd, &signal_info, sizeof(signal_info)) == 
+           sizeof(signal_info))
+    {
+        if (termination_signal == 0)
+        {
+            termination_signal = signal_info.ssi_signo;
+        }
+    }
+}
+
+// Have the writers commit whatever they have buffered, on each flush timer
+// tick, and shrink the event buffer if this thread is its reader and
+// traffic stopped. The commit itself is left to the writers: this thread
+// may be answering permission events, and a commit can wait on the disk.
+void DirectoryListAuditor::flush_output()
+{
+    uint64_t expirations;
+    if (read(flush_timer_fd, &expirations, sizeof(expirations)) > 0)
+    {
+        for (auto shard = shards.begin(); shard != shards.end(); shard++)
+        {
+            (*shard)->commit_requested = true;
+            if ((*shard)->idle_writers.load() > 0)
+            {
+                (*shard)->ring_not_empty.notify_one();
+            }
+        }
+        if (shards.size() == 1)
+        {
+            shards[0]->event_buffer.adapt_to_idle(
+                chrono::steady_clock::now());
+        }
+    }
+}
+
+// Create a timerfd ticking every interval, for the event loop
+int DirectoryListAuditor::create_interval_timer(chrono::milliseconds interval)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec timer_interval;
+    timer_interval.it_interval.tv_sec = interval.count() / 1000;
+    timer_interval.it_interval.tv_nsec = interval.count() % 1000 * 1000000;
+    timer_interval.it_value = timer_interval.it_interval;
+    if (timer_fd == -1 ||
+        timerfd_settime(timer_fd, 0, &timer_interval, NULL) == -1)
+    {
+        cerr << "dirmon: cannot create timer, errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    return timer_fd;
+}
+
+// The histograms only fill while something reads them, so that nobody pays
+// for the clock otherwise
+void DirectoryListAuditor::start_metrics()
+{
+    if (!options.metrics_filename.empty() && 
+        options.metrics_interval.count() > 0)
+    {
+        metrics_timer_fd = create_interval_timer(options.metrics_interval);
+        metrics.enable_timing();
+    }
+    if (options.metrics_socket.empty())
+    {
+        return;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (options.metrics_socket.size() >= sizeof(address.sun_path))
+    {
+        cerr << "dirmon: metrics socket path '" << options.metrics_socket
+             << "' is too long" << endl;
+        clean_up();
+        exit(ENAMETOOLONG);
+    }
+    strcpy(address.sun_path, options.metrics_socket.c_str());
+    // A socket left behind by an earlier run would make bind fail
+    unlink(address.sun_path);
+    metrics_socket_fd = socket(AF_UNIX, 
+                               SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (metrics_socket_fd == -1 ||
+        bind(metrics_socket_fd, (struct sockaddr *) &address, 
+             sizeof(address)) == -1 ||
+        listen(metrics_socket_fd, 16) == -1)
+    {
+        cerr << "dirmon: cannot listen on metrics socket '" 
+             << options.metrics_socket << "', errno:" 
+             << strerror(errno) << endl;
+        clean_up();
+        exit(errno);
+    }
+    metrics.enable_timing();
+}
+
+// The counters kept in metrics, followed by the ones the other parts of
+// dirmon keep for themselves (summed over the shards and outputs)
+void DirectoryListAuditor::render_metrics()
+{
+    uint64_t bytes_written = 0;
+    uint64_t commit_count = 0;
+    for (auto output = outputs.begin(); output != outputs.end(); output++)
+    {
+        bytes_written += (*output)->writer.get_bytes_written();
+        commit_count += (*output)->writer.get_commit_count();
+    }
+    uint64_t events_coalesced = 0;
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        events_coalesced += (*shard)->event_coalescer.get_merged_count();
+    }
+    metrics_text.clear();
+    metrics.append_metrics(metrics_text);
+    AuditMetrics::append_counter(metrics_text, "output_bytes_written_total",
+        "Bytes of audit output written to the file.", bytes_written);
+    AuditMetrics::append_counter(metrics_text, "output_commits_total",
+        "Batches of audit output committed to the file.", commit_count);
+    AuditMetrics::append_counter(metrics_text, "events_dropped_total",
+        "Events dropped because the event ring was full.", events_dropped);
+    AuditMetrics::append_counter(metrics_text, "events_backpressured_total",
+        "Events the reader waited on because the event ring was full.",
+        events_backpressured);
+    AuditMetrics::append_counter(metrics_text, "event_fd_failures_total",
+        "Events lost because no file descriptor could be opened for them.",
+        event_fd_failures);
+    AuditMetrics::append_counter(metrics_text, "queue_overflows_total",
+        "Times the kernel's fanotify event queue overflowed.",
+        queue_overflows);
+    AuditMetrics::append_counter(metrics_text, "events_coalesced_total",
+        "Events merged into an earlier record.", events_coalesced);
+    AuditMetrics::append_counter(metrics_text, "permission_denials_total",
+        "Permission events denied by the policy.", permission_denials);
+    AuditMetrics::append_counter(metrics_text, "permission_timeouts_total",
+        "Permission events answered by the watchdog.", permission_timeouts);
+    AuditMetrics::append_counter(metrics_text, 
+        "permission_response_failures_total",
+        "Permission responses the kernel did not take.",
+        permission_response_failures);
+    AuditMetrics::append_counter(metrics_text, "user_cache_hits_total",
+        "User lookups answered from the user cache.",
+        user_cache.get_pid_hits());
+    AuditMetrics::append_counter(metrics_text, "user_cache_misses_total",
+        "User lookups that had to read /proc.",
+        user_cache.get_pid_misses());
+    AuditMetrics::append_counter(metrics_text, "path_table_hits_total",
+        "Event paths found already interned.", path_table.get_hits());
+    AuditMetrics::append_counter(metrics_text, "path_table_misses_total",
+        "Event paths copied into the path table.", path_table.get_misses());
+    AuditMetrics::append_counter(metrics_text, "path_table_evictions_total",
+        "Unreferenced paths dropped from the path table.",
+        path_table.get_evictions());
+}
+
+// Write the metrics next to the file and rename them over it, so a reader
+// never sees a half-written file
+void DirectoryListAuditor::write_metrics_file()
+{
+    // Take the tick off the timer; there is none for the last file at exit
+    uint64_t expirations;
+    if (read(metrics_timer_fd, &expirations, sizeof(expirations)) == -1 &&
+        errno != EAGAIN)
+    {
+        return;
+    }
+    render_metrics();
+    string temporary_filename = options.metrics_filename + ".tmp";
+    int metrics_fd = open(temporary_filename.c_str(), 
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (metrics_fd == -1)
+    {
+        cerr << "dirmon: cannot open metrics file '" << temporary_filename 
+             << "', errno:" << strerror(errno) << endl;
+        return;
+    }
+    bool written = write(metrics_fd, metrics_text.data(), 
+                         metrics_text.size()) == (ssize_t) metrics_text.size();
+    close(metrics_fd);
+    if (!written || 
+        rename(temporary_filename.c_str(), 
+               options.metrics_filename.c_str()) == -1)
+    {
+        cerr << "dirmon: cannot write metrics file '" 
+             << options.metrics_filename << "', errno:" 
+             << strerror(errno) << endl;
+        unlink(temporary_filename.c_str());
+    }
+}
+
+// Every client gets one render. The clients' sockets are non-blocking, so a
+// client that doesn't read can't hold up the reader; it just gets cut off.
+void DirectoryListAuditor::serve_metrics()
+{
+    bool rendered = false;
+    for (;;)
+    {
+        int client_fd = accept4(metrics_socket_fd, NULL, NULL, 
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1)
+        {
+            return;
+        }
+        if (!rendered)
+        {
+            render_metrics();
+            rendered = true;
+        }
+        send(client_fd, metrics_text.data(), metrics_text.size(), 
+             MSG_NOSIGNAL);
+        close(client_fd);
     }
+}
 
-    // Mount all of the directories that will be monitored (required
-    // for recursive monitoring of directories and all subdirectories)
-    mount_directories(monitored_directories);
+// Count the overflow and put a marker into the audit output where the
+// missing events would have been, under dirmon's own pid. The marker is
+// never dropped.
+void DirectoryListAuditor::record_queue_overflow(ReaderShard& shard,
+                                                 uint64_t time_ns)
+{
+    uint64_t overflow_number = ++queue_overflows;
+    last_overflow_time_ns = time_ns;
+    cerr << "dirmon: fanotify event queue overflowed, events were lost "
+         << "(overflow " << overflow_number << ")" << endl;
+    AuditEvent marker{EventFd(), getpid(), FAN_Q_OVERFLOW, time_ns,
+                      path_table.intern("FANOTIFY_QUEUE_OVERFLOW")};
+    enqueue_event(shard, marker, false);
+}
 
-    // Specifically ignore events for the output file as to avoid
-    // rapidly generating an infinite feedback loop of modify events if
-    // the user wants to monitor the directory containing their 
-    // output file 
-    set<string> excluded_directories;
-    excluded_directories.insert(audit_output_filename);
-    
-    // Mark all of the directories for monitoring, and exclude the
-    // audit output file
-    mark_directories(fanotify_fd, mark_flags, event_types_mask,
-                     monitored_directories, excluded_directories);
+// Queue a raw event for the writer threads. A full ring either drops the
+// event or holds up the reader until a writer frees a slot.
+void DirectoryListAuditor::enqueue_event(ReaderShard& shard, 
+                                         AuditEvent& event, bool may_drop)
+{
+    if (!shard.event_ring->push(move(event)))
+    {
+        if (options.drop_when_full && may_drop)
+        {
+            // The event's fd is closed when the caller lets go of it
+            events_dropped++;
+            return;
+        }
+        events_backpressured++;
+        while (!shard.event_ring->push(move(event)))
+        {
+            this_thread::yield();
+        }
+    }
+    if (shard.idle_writers.load() > 0)
+    {
+        shard.ring_not_empty.notify_one();
+    }
 }
 
-//  Begin to audit according to the guidelines configured in 
-//  DirectoryListAuditor::initialize(...)
-void DirectoryListAuditor::audit_activity(const size_t event_buf_size)
+// Drain the event ring until told to stop, writing every event that isn't
+// for the audit output file itself
+void DirectoryListAuditor::run_writer(ReaderShard& shard)
 {
-    // Create buffer for reading events
-    events = (struct fanotify_event_metadata *) malloc(event_buf_size);
-    
-    ssize_t num_bytes_read;
-    
-    // Loop until program is terminated externally
     for (;;)
     {
-        // TODO Possible Improvement 
-        //      What is the behavior of read when the return is equal to 
-        //          the buffer size?    
-        num_bytes_read = read(fanotify_fd, events, event_buf_size);
-        cout << "audit_activity(...): num_bytes_read == " << num_bytes_read << endl;
-        if (num_bytes_read == -1)
+        // The flush timer's tick, which lands here even while the ring
+        // never runs dry
+        if (shard.commit_requested.load() && 
+            shard.commit_requested.exchange(false))
         {
-            cerr << "dirmon: error reading from fanotify file descriptor" << endl;
-            clean_up();            
-            exit(errno);
+            shard.output->writer.commit();
         }
-        // Iterate over the variably-sized event metadata structs   
-        for (struct fanotify_event_metadata * event = events; 
-             FAN_EVENT_OK(event,num_bytes_read); 
-             event = FAN_EVENT_NEXT(event,num_bytes_read))
+        // Scoped to one iteration so the event fd is closed as soon as the
+        // event has been written or skipped
+        AuditEvent event;
+        if (shard.event_ring->pop(event))
         {
-            // Send the permission event response if required
-            if(requires_permission_response(event->mask))
+            // Overflow markers go out as they are, whatever the filters
+            if (event.mask & FAN_Q_OVERFLOW)
+            {
+                write_event(event, *shard.output);
+                continue;
+            }
+            // Skip events generated for the audit output file, since
+            // writing them would cause an infinite feedback loop of
+            // repeated file access and auditing. The ignore marks keep
+            // the kernel from sending these in the first place, this only
+            // catches what slips past them (e.g. during a rotation).
+            if (is_audit_output(event))
             {
-                send_permission_response(event->fd, fanotify_fd);
+                continue;
+            }
+            if (!filter_event(event))
+            {
+                continue;
             }
-            // If we have the same PID as the auditing process, it means
-            // we should skip this event, We should also skip this event 
-            // if it is generated for the audit output file iself because
-            // if we write to the audit file, it will cause an infinite
-            // feedback loop of repeated file access and auditing 
-            if (event->pid == getpid() || 
-                get_filepath_from_fd(event->fd) == output_filename) 
-            { 
-                close(event->fd);
+            if (options.coalesce_window.count() > 0)
+            {
+                coalesce_event(shard, event);
+                write_coalesced_events(shard, false);
+                continue;
+            }
+            resolve_event_path(event);
+            if (!is_monitored_path(event.path.get()))
+            {
                 continue;
             }
-            write_event(event, audit_output_file);
+            write_event(event, *shard.output);
+            continue;
         }
+        // The ring ran dry, so everything the reader handed over so far
+        // has been formatted; commit it as one batch (along with all the
+        // coalesced records when stopping)
+        bool stopping = !writers_running;
+        if (options.coalesce_window.count() > 0)
+        {
+            write_coalesced_events(shard, stopping);
+        }
+        shard.output->writer.commit();
+        if (stopping)
+        {
+            return;
+        }
+        // The ring is empty, so sleep until the reader queues something.
+        // The timeout covers a notify racing with us going to sleep.
+        unique_lock<mutex> lock(shard.ring_wait_mutex);
+        shard.idle_writers++;
+        shard.ring_not_empty.wait_for(lock, chrono::milliseconds(10), 
+                                      [this, &shard] {
+            return !shard.event_ring->empty() || !writers_running ||
+                   shard.commit_requested.load();
+        });
+        shard.idle_writers--;
     }
 }
-// TODO Possible improvement:
-//      Have two signal handlers, one for SIGINT that just 
-//          interrupts the audit_activity loop, and another 
-//          for SIGTERM that also performs cleanup
-// Handle a signal by cleaning up the class and then exiting
-void DirectoryListAuditor::signal_handler(int signal_number)
+
+// Remember when each permission event of a batch was read, before any of
+// them is answered. Every event of the previous batch has been claimed by
+// now, so the list starts over.
+void DirectoryListAuditor::track_permission_events(ReaderShard& shard,
+                                    ssize_t num_bytes_read,
+                                    chrono::steady_clock::time_point read_time)
 {
-    cout << "dirmon: Ending gracefully due to signal (" 
-         << signal_number << ")" << endl;
-    instance->clean_up();
-    cout << "dirmon: Done with post-signal cleanup, exiting..." << endl;
-    exit(signal_number);
+    lock_guard<mutex> lock(shard.pending_permissions_mutex);
+    shard.pending_permissions.clear();
+    shard.first_unclaimed_permission = 0;
+    for (struct fanotify_event_metadata * event = shard.event_buffer.get(); 
+         FAN_EVENT_OK(event,num_bytes_read); 
+         event = FAN_EVENT_NEXT(event,num_bytes_read))
+    {
+        if (event->fd >= 0 && requires_permission_response(event->mask))
+        {
+            shard.pending_permissions.push_back(
+                PendingPermission{event->fd, read_time});
+        }
+    }
 }
 
-// -----------------------------------------------------------------------------
-
-
-
-// -- PRIVATE ------------------------------------------------------------------
+// Take a permission event back from the watchdog. Once this returns the
+// watchdog is done with the fd, so it can be handed on and closed safely.
+bool DirectoryListAuditor::claim_permission_event(ReaderShard& shard,
+                                                  size_t permission_index)
+{
+    if (options.permission_deadline.count() == 0)
+    {
+        return true;
+    }
+    lock_guard<mutex> lock(shard.pending_permissions_mutex);
+    PendingPermission& pending = shard.pending_permissions[permission_index];
+    shard.first_unclaimed_permission = permission_index + 1;
+    if (pending.fd == -1)
+    {
+        // The watchdog already answered it
+        return false;
+    }
+    pending.fd = -1;
+    return true;
+}
 
-// Mount the given set of directories, exiting with errno set if mount fails
-// on any of them
-void DirectoryListAuditor::mount_directories(set<string> directories)
+// Answer every permission event still pending past its deadline with the
+// configured default, shard by shard. A reader is never waited on: if it
+// holds its pending list (or was stopped while holding it), try that shard
+// again next round.
+void DirectoryListAuditor::run_permission_watchdog()
 {
-    for (auto directory_name = directories.begin();
-         directory_name != directories.end();
-         directory_name++)
+    chrono::milliseconds check_interval = 
+        max(options.permission_deadline / 4, chrono::milliseconds(1));
+    uint32_t response = options.deny_on_deadline ? FAN_DENY : FAN_ALLOW;
+    while (watchdog_running)
     {
-        // Mount each of our directories
-        // NOTE: We need to mount the directory as itself because: 
-        // 1. fanotify requires that a directory be mounted to support the
-        //    FA_MARK_MOUNT recursive directory monitoring flag.
-        // 2. fanotify has a bug in Linux Kernel 3.17 onwards (see man) where 
-        //    it is only able to pick up notifications from mountpoints 
-        //    through the target mount point, and not the source. 
-        //     
-        // NOTE:This has a vulnerability in that any process that is already
-        //      inside the directory before this mount occurs will not have
-        //      any of its accesses monitored.
-        if (mount(directory_name->c_str(), directory_name->c_str(), 
-                  "", MS_BIND, "") == -1)
         {
-            cerr << "dirmon: cannot mount directory '" << *directory_name
-                 << "'for monitoring, errno:" << strerror(errno) << endl;
-            clean_up();
-            exit(errno);
+            unique_lock<mutex> wait_lock(watchdog_wait_mutex);
+            watchdog_wakeup.wait_for(wait_lock, check_interval, [this] {
+                return !watchdog_running;
+            });
+        }
+        uint64_t num_timed_out = 0;
+        for (auto shard = shards.begin(); shard != shards.end(); shard++)
+        {
+            num_timed_out += answer_overdue_permissions(**shard, response);
+        }
+        if (num_timed_out)
+        {
+            permission_timeouts += num_timed_out;
+            cerr << "dirmon: " << num_timed_out << " permission events not "
+                 << "answered within " << options.permission_deadline.count()
+                 << "ms; answered with "
+                 << (options.deny_on_deadline ? "FAN_DENY" : "FAN_ALLOW")
+                 << endl;
         }
     }
 }
 
-//  Mark the given directories for monitoring for the specified types of
-//  access events using the open fanotify file descriptor. Exlcude the
-//  other set of directories for the same types of access events.
-void DirectoryListAuditor::mark_directories(int fanotify_fd, 
-                                            unsigned int mark_flags,
-                                            uint64_t event_types_mask,
-                                            set<string> monitored_directories, 
-                                            set<string> excluded_directories)
+// Answer the shard's overdue permission events, unless its reader holds
+// the pending list right now
+uint64_t DirectoryListAuditor::answer_overdue_permissions(ReaderShard& shard,
+                                                          uint32_t response)
 {
-    for (auto directory_name = monitored_directories.begin();
-         directory_name != monitored_directories.end();
-         directory_name++)
+    unique_lock<mutex> lock(shard.pending_permissions_mutex, try_to_lock);
+    if (!lock.owns_lock())
     {
-        // Mark the mounted directory for monitoring
-        // (Pass in AT_FDCWD for directory file descriptor so that we can
-        //  use relative pathnames if desired)
-        if (fanotify_mark(fanotify_fd, mark_flags,
-                          event_types_mask,
-                          AT_FDCWD,
-                          directory_name->c_str()) == -1)
+        return 0;
+    }
+    vector<PendingPermission>& pending_permissions = 
+        shard.pending_permissions;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    uint64_t num_timed_out = 0;
+    for (size_t i = shard.first_unclaimed_permission; 
+         i < pending_permissions.size(); i++)
+    {
+        if (pending_permissions[i].fd == -1 ||
+            now - pending_permissions[i].read_time < 
+            options.permission_deadline)
         {
-            cerr << "dirmon: cannot mark pathname '" 
-                 << *directory_name << "'; (errno: " << strerror(errno)
-                 << "); skipping directory..." << endl;
+            continue;
         }
+        send_permission_response(pending_permissions[i].fd, 
+                                 shard.fanotify_fd, response);
+        chrono::steady_clock::duration response_latency = 
+            chrono::steady_clock::now() - pending_permissions[i].read_time;
+        metrics.record_latency(AuditMetrics::PERMISSION_RESPONSE, 
+                               response_latency);
+        pending_permissions[i].fd = -1;
+        num_timed_out++;
+    }
+    return num_timed_out;
+}
+
+// Stop the watchdog, if it was started
+void DirectoryListAuditor::stop_permission_watchdog()
+{
+    if (!permission_watchdog.joinable())
+    {
+        return;
     }
+    {
+        lock_guard<mutex> wait_lock(watchdog_wait_mutex);
+        watchdog_running = false;
+    }
+    watchdog_wakeup.notify_all();
+    permission_watchdog.join();
+}
 
-    for (auto directory_name = excluded_directories.begin();
-         directory_name != excluded_directories.end();
-         directory_name++)
+// Merge an event into the record of its process and file, or start a new
+// record with it. Only the first event of a record has its path resolved.
+void DirectoryListAuditor::coalesce_event(ReaderShard& shard, 
+                                          AuditEvent& event)
+{
+    if (shard.event_coalescer.merge(event))
     {
-        // Use IGNORED_MASK here to say that this should be ignored
-        if (fanotify_mark(fanotify_fd, FAN_MARK_ADD | FAN_MARK_IGNORED_MASK,
-                          event_types_mask,
-                          AT_FDCWD,
-                          directory_name->c_str()) == -1)
+        return;
+    }
+    resolve_event_path(event);
+    bool write = is_monitored_path(event.path.get());
+    // The record is written when its window is over, by which time a
+    // short-lived process may be gone, so get its user cached now
+    uid_t uid;
+    if (write)
+    {
+        user_cache.get_uid_of_pid(event.pid, uid);
+    }
+    shard.event_coalescer.add(move(event), write);
+}
+
+// Write the coalesced records whose window has passed
+void DirectoryListAuditor::write_coalesced_events(ReaderShard& shard, 
+                                                  bool all)
+{
+    vector<AuditEvent> records;
+    shard.event_coalescer.take_expired(records, all);
+    for (auto record = records.begin(); record != records.end(); record++)
+    {
+        write_event(*record, *shard.output);
+    }
+}
+
+// Filesystem marks report the whole filesystem, so keep only what happened
+// inside a monitored directory
+bool DirectoryListAuditor::is_monitored_path(string_view path)
+{
+    return !options.mark_filesystem ||
+           atomic_load(&monitored_paths)->contains_prefix_of(path);
+}
+
+// The filter first goes without the path, which most rules don't need, and
+// only if it asks for the path is it resolved and the filter run again.
+// The subject is kept per thread so its strings are allocated only once.
+bool DirectoryListAuditor::filter_event(AuditEvent& event)
+{
+    if (options.filter_filename.empty())
+    {
+        return true;
+    }
+    thread_local FilterSubject subject;
+    subject.reset(event.pid);
+    shared_ptr<const EventFilter> filter = atomic_load(&event_filter);
+    uint64_t mask = filter->filter(event.mask, subject, user_cache);
+    if (subject.needs_path)
+    {
+        resolve_event_path(event);
+        subject.has_path = true;
+        subject.path = event.path.get();
+        subject.needs_path = false;
+        mask = filter->filter(event.mask, subject, user_cache);
+    }
+    if ((event.mask & EventFilter::FILTERED_EVENT_TYPES) &&
+        !(mask & EventFilter::FILTERED_EVENT_TYPES))
+    {
+        metrics.add(AuditMetrics::EVENTS_FILTERED);
+        return false;
+    }
+    event.mask = mask;
+    return true;
+}
+
+// Let the writer threads finish the queued events, then wait for them
+void DirectoryListAuditor::stop_writers()
+{
+    writers_running = false;
+    for (auto shard = shards.begin(); shard != shards.end(); shard++)
+    {
+        (*shard)->ring_not_empty.notify_all();
+        for (auto writer = (*shard)->writer_threads.begin();
+             writer != (*shard)->writer_threads.end();
+             writer++)
         {
-            cerr << "diraudit: cannot unmark audit output file '" 
-                 << *directory_name << "'; (errno: " 
-                 << strerror(errno) << ")" << endl;
+            writer->join();
         }
+        (*shard)->writer_threads.clear();
     }
 }
 
@@ -252,166 +1998,257 @@ bool DirectoryListAuditor::requires_permission_response(unsigned long long mask)
     return false;
 }
 
-// Send an fantofiy_response for the given event to the given fanotify
-// file descriptor (so that it can access the file it wants to access 
+// Send the given response for the permission event with the given fd
 void DirectoryListAuditor::send_permission_response(int event_fd, 
-                                                    int fanotify_fd)
+                                                    int fanotify_fd,
+                                                    uint32_t response)
 {
     struct fanotify_response permission_event_response;
     permission_event_response.fd = event_fd;
-    // TODO Possible Imrovement:
-    // Create option to map directories to yes/no access.
-    //  Best approach would probably be to start with the full path of the file
-    //  and cut down the path one directory at a time until we reach the
-    //  directory from the directory list, and then checking the mapping on that
-    //  for yes/no access.
-    permission_event_response.response = FAN_ALLOW;
-    write (fanotify_fd, &permission_event_response, 
-           sizeof(struct fanotify_response));
-}
-
-// Process the given event into a line of information including filepath,
-// time of access, username of accessing process, pid of accessing process,
-// and type of access. Write this line of info to the given audit output file 
-void DirectoryListAuditor::write_event(struct fanotify_event_metadata * event,
-                                       ofstream& audit_output_file)
-{
-    string event_str = "";
-    // Get the filename of the file descriptor accessed
-    event_str += get_filepath_from_fd(event->fd) + ",";
-
-    // Get the time and date in UTC and add it to the string
-    event_str += get_UTC_time_date() + ",";
-    
-    // Get the username of the process and add it to the string
-    event_str += get_user_of_pid(event->pid) + ",";
-    
-    // Put the pid of the accessing process into the string
-    event_str += to_string(event->pid) + ",";
-    
-    // Create string of access types to file
-    event_str += access_type_mask_to_string(event->mask) + ",";
-    
-    // Write the string of info to the output file
-    audit_output_file << event_str << endl;
-    
-    // Flush output to the output file to be sure that the info is actually
-    // written
-    audit_output_file.flush();
+    permission_event_response.response = response;
+    if (write(fanotify_fd, &permission_event_response, 
+              sizeof(struct fanotify_response)) == -1)
+    {
+        permission_response_failures++;
+    }
 }
 
-// Return the filepath that the given open file descriptor corresponds to
-string DirectoryListAuditor::get_filepath_from_fd(int fd)
+// fanotify takes exactly one response per write, so give each response its
+// own iovec: the kernel then loops over them within the one syscall. A
+// short count means the response after the last whole one failed (e.g.
+// the process gave up waiting), so skip that one and carry on.
+void DirectoryListAuditor::send_permission_responses(ReaderShard& shard)
 {
-    // Buffer for retrieving the filepaths of accessed files later
-    char filepath[1024];
-
-    // Read the filepath from the /proc/self/fd subsystem 
-    // for this file descriptor 
-    string fd_path = "/proc/self/fd/";
-    fd_path += to_string(fd);
-    size_t num_chars_retrieved = readlink(fd_path.c_str(), filepath, sizeof(filepath)-1);            
-    
-    // If we retrieved a filepath, return it
-    if (num_chars_retrieved != -1)
+    vector<struct iovec>& batch_iovecs = shard.batch_iovecs;
+    batch_iovecs.resize(shard.batch_responses.size());
+    for (size_t i = 0; i < shard.batch_responses.size(); i++)
     {
-        filepath[num_chars_retrieved] = '\0';
-        return filepath;
+        batch_iovecs[i].iov_base = &shard.batch_responses[i];
+        batch_iovecs[i].iov_len = sizeof(struct fanotify_response);
     }
-    // Otherwise, we couldn't find it
-    else
+    size_t next_response = 0;
+    while (next_response < batch_iovecs.size())
     {
-        return "FILE_NOT_FOUND";
+        int num_iovecs = min(batch_iovecs.size() - next_response,
+                             (size_t) IOV_MAX);
+        ssize_t num_bytes_written = writev(shard.fanotify_fd, 
+                                           &batch_iovecs[next_response],
+                                           num_iovecs);
+        if (num_bytes_written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            permission_response_failures++;
+            next_response++;
+            continue;
+        }
+        next_response += num_bytes_written / sizeof(struct fanotify_response);
     }
 }
 
-// Get the current time and date in UTC and return it as a string
-string DirectoryListAuditor::get_UTC_time_date()
-{
-    time_t system_time = time(0);
-    tm * UTC_time = gmtime(&system_time);
-    string UTC_time_str(asctime(UTC_time));
-    // Remove trailing newline
-    UTC_time_str.erase(UTC_time_str.end()-1);
-    // Add (UTC) identifier
-    UTC_time_str += "(UTC)"; 
-    return UTC_time_str;
-}
-
-// Return the username of the user who owns the given pid
-string DirectoryListAuditor::get_user_of_pid(pid_t pid)
+// Look the event's path up in the permission policy. Everything up to the
+// decision works on the stack, since the accessing process is waiting.
+uint32_t DirectoryListAuditor::decide_permission(int event_fd, pid_t pid,
+                                                 PathRef& path)
 {
-    // We want to get the info from /proc/#pid/status and resolve
-    // the UIDs to usernames, but only do these ops for a specific PID  
-    int proc_flags = PROC_FILLSTATUS | PROC_FILLUSR | PROC_PID;
-    // Create 0-terminated pid list            
-    pid_t pid_list[2];
-    pid_list[0] = pid;
-    pid_list[1] = 0;
-    PROCTAB * proc_tab = openproc(proc_flags, pid_list);
-    
-    proc_t * found = readproc(proc_tab, NULL);
-    if (found)
+    // Reader shards run this while a reload swaps the policy, so take one
+    // reference to it up front. dirmon's own accesses are never held to it.
+    shared_ptr<const PermissionPolicy> policy =
+        atomic_load(&permission_policy);
+    if (!policy || pid == getpid())
     {
-        // Extract the username, free the proc structure, and return
-        string username(found->ruser);        
-        freeproc(found);   
-        return username;
+        return FAN_ALLOW;
     }
-    else
+    thread_local string filepath;
+    bool timing = metrics.is_timing();
+    chrono::steady_clock::time_point resolve_start;
+    if (timing)
+    {
+        resolve_start = chrono::steady_clock::now();
+    }
+    bool path_read = read_fd_path(event_fd, filepath);
+    if (timing)
+    {
+        metrics.record_latency(AuditMetrics::PATH_RESOLUTION,
+                               chrono::steady_clock::now() - resolve_start);
+    }
+    uint32_t response;
+    if (!path_read)
+    {
+        // A path we can't read (e.g. ENAMETOOLONG) might be under any deny
+        // rule, so it gets what an event past its deadline would get
+        if (!policy->has_deny_rules())
+        {
+            return FAN_ALLOW;
+        }
+        response = options.deny_on_deadline ? FAN_DENY : FAN_ALLOW;
+        if (response == FAN_DENY)
+        {
+            permission_denials++;
+        }
+        return response;
+    }
+    PolicySubject subject(pid);
+    response = policy->decide(filepath, subject);
+    if (response == FAN_DENY)
     {
-        return "CANNOT_FIND_USER_DEAD_PROCESS";
+        permission_denials++;
     }
+    path = path_table.intern(filepath);
+    return response;
 }
 
-// Given an fanotify_mark access type mask, generate a string representing
-// the different access types found
-// Argument is an unsigned long long because __aligned is not allowed
-string DirectoryListAuditor::access_type_mask_to_string(unsigned long long mask)
+// Process the given event into a line of information including filepath,
+// time of access, username of accessing process, pid of accessing process,
+// and type of access. Write this line of info to the given audit output file 
+void DirectoryListAuditor::write_event(AuditEvent& event,
+                                       AuditOutput& output)
 {
-    string access_string = "(";
-    if (mask & FAN_ACCESS)
+    bool timing = metrics.is_timing();
+    chrono::steady_clock::time_point lookup_start;
+    if (timing)
     {
-        access_string += "FAN_ACCESS;";
+        lookup_start = chrono::steady_clock::now();
     }
-    if (mask & FAN_OPEN)
+    metrics.add(AuditMetrics::EVENTS_WRITTEN);
+    if (options.binary_format)
     {
-        access_string += "FAN_OPEN;";
+        // Binary records carry the uid; the decoder turns it into a name
+        uid_t uid = BinaryEventRecord::UNKNOWN_UID;
+        user_cache.get_uid_of_pid(event.pid, uid);
+        if (timing)
+        {
+            metrics.record_latency(AuditMetrics::USER_LOOKUP,
+                                   chrono::steady_clock::now() - lookup_start);
+        }
+        metrics.add(AuditMetrics::BYTES_FORMATTED,
+                    output.binary_encoder.append_event(output.writer, 
+                                                event.time_ns,
+                                                event.pid, uid, event.mask,
+                                                event.path,
+                                                event.repeat_count));
+        return;
     }
-    if (mask & FAN_MODIFY)
+
+    // Line up the filepath, the time and date in UTC, the username and
+    // pid of the accessing process and the access types. Each writer thread
+    // formats into its own buffers, which keep their capacity from event
+    // to event, so this doesn't allocate.
+    thread_local string username;
+    thread_local string event_str;
+    get_user_of_pid(event.pid, username);
+    if (timing)
     {
-        access_string += "FAN_MODIFY;";
+        metrics.record_latency(AuditMetrics::USER_LOOKUP,
+                               chrono::steady_clock::now() - lookup_start);
     }
-    if (mask & FAN_CLOSE_WRITE)
+    event_str.clear();
+    append_text_event(event_str, event.path.get(), event.time_ns, username, 
+                      event.pid, event.mask, event.repeat_count,
+                      options.iso8601_time);
+    
+    // Hand the line to the writer, which commits it to the output file
+    // according to the configured batching policy
+    output.writer.append(event_str.data(), event_str.size());
+    metrics.add(AuditMetrics::BYTES_FORMATTED, event_str.size());
+}
+
+// Compare the event's file to the active segment of every audit output by
+// device and inode (fd events) or by path (events the reader already
+// resolved)
+bool DirectoryListAuditor::is_audit_output(const AuditEvent& event)
+{
+    struct stat event_stat;
+    if (event.fd.is_open() && fstat(event.fd.get(), &event_stat) == -1)
     {
-        access_string += "FAN_CLOSE_WRITE;";
+        return false;
     }
-    if (mask & FAN_CLOSE_NOWRITE)
+    for (auto output = outputs.begin(); output != outputs.end(); output++)
     {
-        access_string += "FAN_CLOSE_NOWRITE;";
+        if (!event.fd.is_open())
+        {
+            if (event.path.get() == (*output)->filename)
+            {
+                return true;
+            }
+            continue;
+        }
+        shared_ptr<const OutputIdentity> identity = 
+            atomic_load(&(*output)->identity);
+        if (identity && event_stat.st_ino == identity->inode &&
+            event_stat.st_dev == identity->device)
+        {
+            return true;
+        }
     }
-    if (mask & FAN_Q_OVERFLOW)
+    return false;
+}
+
+// Fill in the event's path from its fd, unless the reader already did
+void DirectoryListAuditor::resolve_event_path(AuditEvent& event)
+{
+    if (!event.fd.is_open() || event.path.is_set())
     {
-        access_string += "FAN_Q_OVERFLOW;";
+        return;
     }
-    if (mask & FAN_ACCESS_PERM)
+    if (!metrics.is_timing())
     {
-        access_string += "FAN_ACCESS_PERM;";
+        event.path = get_filepath_from_fd(event.fd.get());
+        return;
     }
-    if (mask & FAN_OPEN_PERM)
+    chrono::steady_clock::time_point resolve_start = 
+        chrono::steady_clock::now();
+    event.path = get_filepath_from_fd(event.fd.get());
+    metrics.record_latency(AuditMetrics::PATH_RESOLUTION,
+                           chrono::steady_clock::now() - resolve_start);
+}
+
+// Swap in the device and inode of the active audit output segment as a
+// whole, so that a writer never sees one segment's device with another's
+// inode
+void DirectoryListAuditor::remember_output_identity(AuditOutput& output,
+                                            const string& active_segment)
+{
+    struct stat output_stat;
+    if (stat(active_segment.c_str(), &output_stat) == 0)
     {
-        access_string += "FAN_OPEN_PERM;";                
+        shared_ptr<OutputIdentity> identity = make_shared<OutputIdentity>();
+        identity->device = output_stat.st_dev;
+        identity->inode = output_stat.st_ino;
+        atomic_store(&output.identity, 
+                     shared_ptr<const OutputIdentity>(identity));
     }
-    // Remove terminating semicolon if needed, then add closing parens
-    if (access_string[access_string.length()-1] == ';')
+}
+
+// Return the filepath that the given open file descriptor corresponds to,
+// interned in the path table
+PathRef DirectoryListAuditor::get_filepath_from_fd(int fd)
+{
+    // Each writer reads paths into a buffer of its own, which grows to the
+    // longest path it has seen and is only copied out of by the path table
+    // (and only for a path it doesn't hold already)
+    thread_local string filepath;
+
+    // Read the filepath from the /proc/self/fd subsystem 
+    // for this file descriptor 
+    if (read_fd_path(fd, filepath))
     {
-        access_string[access_string.length()-1] = ')';
+        return path_table.intern(filepath);
     }
+    // Otherwise, we couldn't find it
     else
     {
-        access_string += ")";
+        return path_table.intern(errno == ENAMETOOLONG ? "PATH_TOO_LONG" : 
+                                                         "FILE_NOT_FOUND");
     }
-    return access_string;
+}
+
+// Fetch the username of the user who owns the given pid
+void DirectoryListAuditor::get_user_of_pid(pid_t pid, string& username)
+{
+    user_cache.get_user_of_pid(pid, username);
 }
 
 // Open an fstream safely, exiting with an appropriate error message
@@ -455,17 +2292,86 @@ fstream DirectoryListAuditor::open_fstream_safely(string dir_list_filename)
 //       does that automatically
 void DirectoryListAuditor::clean_up() {
 
-    close(instance->fanotify_fd);
-    if(instance->audit_output_file.is_open())
+    // Let the writers finish what the readers already handed them before
+    // the output file goes away
+    instance->stop_readers();
+    instance->stop_writers();
+    // The watchdog answers through the fanotify fds, so it goes first
+    instance->stop_permission_watchdog();
+    uint64_t handle_cache_hits = 0;
+    uint64_t handle_cache_misses = 0;
+    size_t event_buffer_bytes = 0;
+    uint64_t event_buffer_resizes = 0;
+    uint64_t events_coalesced = 0;
+    for (auto shard = instance->shards.begin(); 
+         shard != instance->shards.end(); shard++)
+    {
+        if ((*shard)->fanotify_fd != -1)
+        {
+            close((*shard)->fanotify_fd);
+        }
+        if ((*shard)->fid_fanotify_fd != -1)
+        {
+            close((*shard)->fid_fanotify_fd);
+        }
+        handle_cache_hits += (*shard)->file_handle_cache.get_hits();
+        handle_cache_misses += (*shard)->file_handle_cache.get_misses();
+        event_buffer_bytes += (*shard)->event_buffer.get_size();
+        event_buffer_resizes += (*shard)->event_buffer.get_resize_count();
+        events_coalesced += (*shard)->event_coalescer.get_merged_count();
+    }
+    if (instance->epoll_fd != -1)
+    {
+        close(instance->epoll_fd);
+    }
+    if (instance->flush_timer_fd != -1)
+    {
+        close(instance->flush_timer_fd);
+    }
+    if (instance->metrics_socket_fd != -1)
+    {
+        close(instance->metrics_socket_fd);
+        unlink(instance->options.metrics_socket.c_str());
+    }
+    if (instance->signal_fd != -1)
+    {
+        close(instance->signal_fd);
+    }
+    if (instance->config_watch_fd != -1)
+    {
+        close(instance->config_watch_fd);
+    }
+    if (!instance->shards.empty() && 
+        instance->shards[0]->fid_fanotify_fd != -1)
+    {
+        cout << "dirmon: file handle cache " << handle_cache_hits 
+             << " hits, " << handle_cache_misses << " misses" << endl;
+    }
+    uint64_t bytes_written = 0;
+    uint64_t commit_count = 0;
+    for (auto output = instance->outputs.begin(); 
+         output != instance->outputs.end(); output++)
+    {
+        if ((*output)->writer.is_open())
+        {
+            (*output)->writer.close();
+        }
+        bytes_written += (*output)->writer.get_bytes_written();
+        commit_count += (*output)->writer.get_commit_count();
+    }
+    // The last metrics file has the final counts of the run
+    if (instance->metrics_timer_fd != -1)
     {
-        instance->audit_output_file.close();
+        instance->write_metrics_file();
+        close(instance->metrics_timer_fd);
     }
     for (auto monitored_directory = instance->monitored_directories.begin();
+              !instance->options.mark_filesystem &&
               monitored_directory != instance->monitored_directories.end(); 
               monitored_directory++)
     {
         
-        cout << "signal_handler(...): Unmounting directory '" 
+        cout << "clean_up(...): Unmounting directory '" 
              << *monitored_directory << "'" << endl;
         // Use the MNT_DETACH flag because the monitored directories
         // are likely in use frequently, and we should wait until
@@ -477,18 +2383,110 @@ void DirectoryListAuditor::clean_up() {
         }
     }
 
-    // Free memory of fanotify events buffer
-    if (events) 
+    cout << "dirmon: " << instance->events_dropped << " events dropped, "
+         << instance->events_backpressured 
+         << " events back-pressured (event ring full), "
+         << instance->event_fd_failures 
+         << " events lost to fd exhaustion, "
+         << instance->permission_denials << " accesses denied by policy, "
+         << instance->permission_response_failures 
+         << " permission responses failed" << endl;
+    cout << "dirmon: " << instance->queue_overflows 
+         << " fanotify queue overflows";
+    if (instance->queue_overflows > 0)
+    {
+        cout << ", the last at " 
+             << UTC_time_date_to_string(instance->last_overflow_time_ns / 
+                                        1000000000);
+    }
+    cout << endl;
+    LatencyHistogram permission_latency;
+    instance->metrics.get_latencies(AuditMetrics::PERMISSION_RESPONSE,
+                                    permission_latency);
+    cout << "dirmon: " << instance->permission_timeouts 
+         << " permission events answered by the watchdog; response "
+         << "latency p50 " << permission_latency.get_percentile_string(0.5)
+         << ", p99 " << permission_latency.get_percentile_string(0.99)
+         << " (" << permission_latency.to_string() << ")" << endl;
+    if (instance->event_filter)
+    {
+        cout << "dirmon: " 
+             << instance->metrics.get_count(AuditMetrics::EVENTS_FILTERED)
+             << " events dropped by " 
+             << instance->event_filter->get_rule_count()
+             << " filter rules (" << instance->filter_ignore_marks.size()
+             << " of them left to the kernel)" << endl;
+    }
+    if (instance->options.coalesce_window.count() > 0)
     {
-        free(events);
+        cout << "dirmon: " << events_coalesced
+             << " events coalesced into earlier records" << endl;
     }
+    cout << "dirmon: " << bytes_written << " bytes written in " 
+         << commit_count << " commits" << endl;
+    cout << "dirmon: user cache " << instance->user_cache.get_pid_hits()
+         << " pid hits, " << instance->user_cache.get_pid_misses()
+         << " pid misses (" << instance->user_cache.get_pid_recycles()
+         << " recycled pids), " << instance->user_cache.get_uid_hits()
+         << " uid hits, " << instance->user_cache.get_uid_misses()
+         << " uid misses" << endl;
+    cout << "dirmon: path table " << instance->path_table.get_hits()
+         << " hits, " << instance->path_table.get_misses() << " misses, "
+         << instance->path_table.get_evictions() << " evictions, "
+         << instance->path_table.get_path_count() << " paths in "
+         << instance->path_table.get_arena_bytes() << " arena bytes" << endl;
+    double audit_seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - instance->audit_start_time).count();
+    uint64_t event_reads = 
+        instance->metrics.get_count(AuditMetrics::EVENT_READS);
+    uint64_t events_read = 
+        instance->metrics.get_count(AuditMetrics::EVENTS_READ);
+    cout << "dirmon: " << event_reads << " reads ("
+         << (audit_seconds > 0 ? event_reads / audit_seconds : 0)
+         << " reads/s), "
+         << (event_reads ? (double) events_read / event_reads : 0)
+         << " events/read, event buffers " << event_buffer_bytes 
+         << " bytes after " << event_buffer_resizes << " resizes" << endl;
 }
 
 // Constructor
 DirectoryListAuditor::DirectoryListAuditor()
 {    
-    fanotify_fd = 0;
-    events = NULL;
+    reader_stop_fd = -1;
+    config_watch_fd = -1;
+    epoll_fd = -1;
+    signal_fd = -1;
+    flush_timer_fd = -1;
+    metrics_timer_fd = -1;
+    metrics_socket_fd = -1;
+    termination_signal = 0;
+    dir_list_watch = -1;
+    policy_watch = -1;
+    filter_watch = -1;
+    ignored_event_types_mask = 0;
+    ignored_fid_event_types_mask = 0;
+    writers_running = false;
+    events_dropped = 0;
+    events_backpressured = 0;
+    event_fd_failures = 0;
+    permission_denials = 0;
+    permission_timeouts = 0;
+    permission_response_failures = 0;
+    queue_overflows = 0;
+    last_overflow_time_ns = 0;
+    watchdog_running = false;
+    open_file_limit = 1024;
+}
+
+DirectoryListAuditor::ReaderShard::ReaderShard(unsigned int index)
+{
+    this->index = index;
+    fanotify_fd = -1;
+    fid_fanotify_fd = -1;
+    first_unclaimed_permission = 0;
+    idle_writers = 0;
+    commit_requested = false;
+    output = NULL;
 }
 
 
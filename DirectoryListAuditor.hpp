@@ -6,15 +6,41 @@
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <poll.h>
 #include <proc/readproc.h>
 #include <signal.h>
 #include <sys/fanotify.h>
 #include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include "AuditEvent.hpp"
+#include "AuditMetrics.hpp"
+#include "AuditorOptions.hpp"
+#include "AuditWriter.hpp"
+#include "BinaryAuditEncoder.hpp"
+#include "EventBuffer.hpp"
+#include "EventClock.hpp"
+#include "EventCoalescer.hpp"
+#include "EventFilter.hpp"
+#include "EventFormat.hpp"
+#include "EventRing.hpp"
+#include "FileHandleCache.hpp"
+#include "PathTable.hpp"
+#include "PathTrie.hpp"
+#include "PermissionPolicy.hpp"
+#include "UserCache.hpp"
+
 using namespace std;
 
 // This singleton class is used to recursively monitor a set of directories 
@@ -22,7 +48,8 @@ using namespace std;
 //  The monitored activities will be written to the specified output file.
 // Use get_instance() to get the instance of the class, call initialize() to
 //  prepare it for auditing, and then call audit_activity() to start recording
-//  to the output file
+//  to the output file (or drive the auditing yourself with start_auditing(),
+//  read_event() and stop_auditing())
 class DirectoryListAuditor
 {
     public:
@@ -50,50 +77,292 @@ class DirectoryListAuditor
         //              file containing the list of directories to monitor
         //          audit_output_filename : A full or relative path + filename
         //              where the activity should get audited to
+        //          options : Tunables for how events are processed (see
+        //              AuditorOptions.hpp)
         // Outputs: None
         // Return:  void
         void initialize(uint64_t event_types_mask, 
                          string dir_list_filename,
-                         string audit_output_filename);
+                         string audit_output_filename,
+                         AuditorOptions options = AuditorOptions());
 
         // Intro:   Begin auditing to the audit output file prepared in
         //              initialize. Do not call this method until initialize has
-        //              been called.
-        // Inputs:  event_buf_size : The size of the event buffer. A good size is
-        //              at least several times the size of a single struct 
+        //              been called. The calling thread becomes the reader: it
+        //              only drains the fanotify file descriptor, answers
+        //              permission events and hands the raw events to the
+        //              writer threads started here, which do the formatting
+        //              and writing. With options.reader_shards above one,
+        //              every shard gets a reader thread of its own instead
+        //              and the calling thread only looks after the rest.
+        //              Runs until SIGINT (^C from the command line) or
+        //              SIGTERM (system shutdown) arrives, then stops
+        //              auditing and cleans up.
+        // Inputs:  event_buf_size : The starting size of the event buffer,
+        //              which grows up to options.max_event_buffer_bytes
+        //              while reads keep filling it. A good size is at least
+        //              several times the size of a single struct 
         //              fanotify_event_metadata
         // Outputs: None
+        // Return:  The number of the signal that ended auditing
+        int audit_activity(const size_t event_buf_size);
+
+        // Intro:   Starts the writer threads (the reader threads and the
+        //              permission watchdog too, if needed) and sets up the
+        //              event loop, for callers that drive
+        //              auditing themselves with read_event instead of
+        //              calling audit_activity
+        // Inputs:  event_buf_size : see audit_activity
+        // Outputs: None
         // Return:  void
-        void audit_activity(const size_t event_buf_size);
+        void start_auditing(const size_t event_buf_size);
 
-        // Intro:   This will allow the program to gracefully clean up all
-        //              the extra mounted directories and the fanotify file
-        //              descriptor on exit (important because it releases
-        //              outstanding permissions accesses that could lock up
-        //              the system)
-        // Inputs:  signal_number : Just denotes what signal was sent. We will
-        //              be catching SIGINT and SIGTERM, for command-line usage
-        //              and service-style usage respectively (Catches ^C from
-        //              command-line and SIGTERM when system shuts down)
+        // Intro:   Waits until something is ready and handles all of it:
+        //              fanotify events (unless the shards have reader
+        //              threads), changes to the config files, the timers,
+        //              metrics requests and termination signals. Call only
+        //              after start_auditing.
+        // Inputs:  timeout_ms : longest to wait, or -1 to wait until
+        //              something is ready
+        // Outputs: None
+        // Return:  false once SIGINT or SIGTERM has arrived (call
+        //              stop_auditing then), true otherwise
+        bool read_event(int timeout_ms = -1);
+
+        // Intro:   Writes the events already read, then releases the marks,
+        //              the mounted directories and the fanotify file
+        //              descriptors (which also allows any outstanding
+        //              permission events, so nothing stays locked up)
+        // Inputs:  None
         // Outputs: None
         // Return:  void
-        static void signal_handler(int signal_number);
+        void stop_auditing();
 
-        // TODO Possible Improvement:
-        //      Public methods for changing the directory list file
-        //      could be useful
+        // Intro:   Re-reads the directory list file given to initialize and
+        //              applies the difference to the monitored directories.
+        //              Added directories are mounted and marked, removed ones
+        //              are unmarked and unmounted, and the ones on both
+        //              lists are left alone so none of their events are
+        //              lost. read_event calls this whenever the file
+        //              changes, so it only needs calling directly when
+        //              auditing is driven some other way.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, keeps the current directories if the file can't
+        //              be read
+        void reload_directory_list();
+
+        // Intro:   Compiles the policy file given in the options again and
+        //              switches permission events over to it. Events
+        //              already being decided finish with the old policy.
+        //              read_event calls this whenever the file changes.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, keeps the current policy if the file has an error
+        void reload_policy();
+
+        // Intro:   Compiles the filter file given in the options again and
+        //              switches the writers over to it, moving the ignore
+        //              marks of its static exclusions along with it.
+        //              read_event calls this whenever the file changes.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, keeps the current filter if the file has an error
+        void reload_filter();
 
     private:
-        // The fanotify file descriptor for the singleton
-        int fanotify_fd;
-        // A stream for the audit output file
-        ofstream audit_output_file;
-        // The filename of the audit output file
-        string output_filename;
+        // Device and inode of an audit output's active segment, for
+        // recognizing events on it without resolving their path. Never
+        // changed once published, so a rotation swaps in a new one.
+        struct OutputIdentity
+        {
+            dev_t device;
+            ino_t inode;
+        };
+
+        // One audit output file and what writes it: the file given to
+        // initialize, or with options.split_shard_output one file per
+        // reader shard
+        struct AuditOutput
+        {
+            // Batching writer for the file
+            AuditWriter writer;
+            // Encodes events when the output is in the binary format
+            BinaryAuditEncoder binary_encoder;
+            // The full path of the file, set once when it is opened (every
+            // active segment has it)
+            string filename;
+            // The active segment, read by the writers with atomic_load
+            shared_ptr<const OutputIdentity> identity;
+        };
+
+        // A permission event that was read but not answered yet
+        struct PendingPermission
+        {
+            int fd;
+            chrono::steady_clock::time_point read_time;
+        };
+
+        // Everything that reads one share of the monitored directories
+        // (options.reader_shards) and gets its events written, so the
+        // shards never wait on each other. With a single shard the
+        // thread calling read_event is its reader.
+        struct ReaderShard
+        {
+            // Position in shards, which also numbers its output file
+            unsigned int index;
+            // The shard's fanotify group, and the group reporting file
+            // handles for non-permission events (options.report_fid) or -1
+            int fanotify_fd;
+            int fid_fanotify_fd;
+            // Resolves the file handles from fid_fanotify_fd into paths.
+            // Reloads add filesystems to it while the reader resolves
+            // handles, hence the mutex.
+            FileHandleCache file_handle_cache;
+            mutex file_handle_cache_mutex;
+            // The buffer events are read into
+            EventBuffer event_buffer;
+            // Responses for the batch being read, sent with one writev, and
+            // the iovecs pointing at them (reused between batches)
+            vector<struct fanotify_response> batch_responses;
+            vector<struct iovec> batch_iovecs;
+            // Path each event of the batch got from the permission policy,
+            // if it was looked up (reused between batches)
+            vector<PathRef> batch_policy_paths;
+            // Permission events of the current batch, in the order they
+            // were read (only kept with options.permission_deadline).
+            // Whoever takes an event off this list by setting its fd to
+            // -1, the reader or the watchdog, answers it. The reader takes
+            // them in order, so none before first_unclaimed is left.
+            vector<PendingPermission> pending_permissions;
+            size_t first_unclaimed_permission;
+            mutex pending_permissions_mutex;
+            // Ring of raw events going from the reader to the writer threads
+            unique_ptr<EventRing<AuditEvent>> event_ring;
+            // Formatter/writer threads draining event_ring
+            vector<thread> writer_threads;
+            // Idle writers sleep on this instead of spinning on an empty
+            // ring
+            mutex ring_wait_mutex;
+            condition_variable ring_not_empty;
+            // Number of writers currently sleeping on ring_not_empty, so
+            // the reader only pays for a notify when someone is waiting
+            atomic<unsigned int> idle_writers;
+            // Set by the flush timer when the output's commit_latency is
+            // up; the next writer to see it commits. The reader never
+            // touches the output itself.
+            atomic<bool> commit_requested;
+            // Merges repeated events within options.coalesce_window
+            EventCoalescer event_coalescer;
+            // Where the writers write to (one of outputs)
+            AuditOutput * output;
+            // The reader thread, when there is more than one shard
+            thread reader;
+
+            ReaderShard(unsigned int index);
+        };
+
+        // Every path the events in flight refer to, and the recently
+        // written ones. Ahead of the shards, so it outlives their events.
+        PathTable path_table;
+        // The reader shards, options.reader_shards of them
+        vector<unique_ptr<ReaderShard>> shards;
+        // The audit output files: one shared by every shard, or one per
+        // shard with options.split_shard_output
+        vector<unique_ptr<AuditOutput>> outputs;
+        // Shard each monitored directory was given (see pick_shard), so a
+        // directory stays with its shard across reloads
+        map<string, unsigned int> directory_shards;
+        // Readable once the reader threads should stop, or -1
+        int reader_stop_fd;
+        // Event types each group was marked for, which the ignore marks
+        // for the audit output (and each new segment of it) must cover,
+        // and which directories added by a reload get marked for
+        uint64_t ignored_event_types_mask;
+        uint64_t ignored_fid_event_types_mask;
         // The set of directories to monitor access for
         set<string> monitored_directories;
-        // A pointer to the event buffer used during auditing
-        struct fanotify_event_metadata * events;
+        // The monitored directories for filtering the events of filesystem
+        // marks (options.mark_filesystem). Replaced as a whole, through
+        // atomic_load/atomic_store, whenever the directory list changes.
+        shared_ptr<const PathTrie> monitored_paths;
+        // The directory list file given to initialize
+        string dir_list_filename;
+        // inotify file descriptor watching the directories that hold
+        // dir_list_filename and the policy and filter files (editors
+        // usually replace a file rather than write it in place), or -1
+        int config_watch_fd;
+        // Descriptors the event loop waits on besides the groups and
+        // config_watch_fd: SIGINT/SIGTERM (blocked in every thread), the
+        // output flush timer (-1 without options.batch_bytes), the metrics
+        // file timer (-1 without options.metrics_filename) and the
+        // listening metrics socket (-1 without options.metrics_socket)
+        int signal_fd;
+        int flush_timer_fd;
+        int metrics_timer_fd;
+        int metrics_socket_fd;
+        // epoll set over every descriptor above, and the most it can report
+        // at once
+        int epoll_fd;
+        static const int MAX_LOOP_FDS = 7;
+        // The signal that asked dirmon to stop, or 0
+        int termination_signal;
+        // Watch descriptors of those directories, or -1
+        int dir_list_watch;
+        int policy_watch;
+        int filter_watch;
+        // Decides permission events (options.policy_filename), or null to
+        // allow everything. Replaced as a whole, through
+        // atomic_load/atomic_store, whenever the policy file changes.
+        shared_ptr<const PermissionPolicy> permission_policy;
+        // Drops events before they are formatted (options.filter_filename),
+        // or null to keep them all. Replaced as a whole, through
+        // atomic_load/atomic_store, whenever the filter file changes.
+        shared_ptr<const EventFilter> event_filter;
+        // The filter's static exclusions, as ignore marks on every shard's
+        // groups: the path and the access types ignored on it
+        vector<pair<string, uint64_t>> filter_ignore_marks;
+        // Counters and latency histograms of every stage, for the metrics
+        // file and socket and the summary printed on exit
+        AuditMetrics metrics;
+        // The metrics text, reused between renders
+        string metrics_text;
+        // When audit_activity started, for the read rate
+        chrono::steady_clock::time_point audit_start_time;
+        // Tunables given to initialize
+        AuditorOptions options;
+
+        // Cleared to ask the writer threads to drain their rings and stop
+        atomic<bool> writers_running;
+        // Remembers which user owns each recently seen pid
+        UserCache user_cache;
+        // Stamps each batch of events as it is read
+        EventClock event_clock;
+
+        // Events thrown away because the ring was full (drop_when_full)
+        atomic<uint64_t> events_dropped;
+        // Events the reader had to wait on because the ring was full
+        atomic<uint64_t> events_backpressured;
+        // Reads that failed because no fd could be opened for an event
+        atomic<uint64_t> event_fd_failures;
+        // Permission events the policy answered with FAN_DENY
+        atomic<uint64_t> permission_denials;
+
+        // Answers pending permission events that are past their deadline
+        thread permission_watchdog;
+        atomic<bool> watchdog_running;
+        mutex watchdog_wait_mutex;
+        condition_variable watchdog_wakeup;
+        // Permission events the watchdog had to answer
+        atomic<uint64_t> permission_timeouts;
+        // Permission responses the kernel didn't take
+        atomic<uint64_t> permission_response_failures;
+        // FAN_Q_OVERFLOW events seen (each means the kernel dropped events
+        // because its queue was full) and when the last one was read
+        atomic<uint64_t> queue_overflows;
+        atomic<uint64_t> last_overflow_time_ns;
+        // Soft RLIMIT_NOFILE after raise_open_file_limit
+        rlim_t open_file_limit;
         
         // Single private instance of the class
         static DirectoryListAuditor* instance;
@@ -112,23 +381,314 @@ class DirectoryListAuditor
         // Return:  An open fstream for the filename, exits if impossible
         fstream open_fstream_safely(string dir_list_filename);
 
+        // Intro:   Reads the set of directories in a directory list file
+        // Inputs:  dir_list_file : the open directory list file
+        // Outputs: requested_shards : the reader shard of each directory
+        //              listed with an @N in front of it
+        // Return:  The directories listed in the file, one per line
+        set<string> read_directory_list(fstream& dir_list_file,
+                                map<string, unsigned int>& requested_shards);
+
+        // Intro:   Picks the reader shard a newly monitored directory goes to
+        // Inputs:  directory_name : the directory
+        //          requested_shards : shards the directory list asked for
+        // Outputs: None
+        // Return:  The index into shards
+        unsigned int pick_shard(const string& directory_name,
+                        const map<string, unsigned int>& requested_shards);
+
+        // Intro:   Creates a shard's fanotify groups: the main group, and
+        //              the group reporting file handles with
+        //              options.report_fid
+        // Inputs:  shard : the shard
+        // Outputs: None
+        // Return:  void, exits if the main group can't be created
+        void create_fanotify_groups(ReaderShard& shard);
+
+        // Intro:   Opens an audit output file and sets up its rotation
+        // Inputs:  output : the output to open
+        //          filename : the file to create or append to
+        // Outputs: None
+        // Return:  void, exits if the file can't be opened
+        void open_audit_output(AuditOutput& output, const string& filename);
+
+        // Intro:   Starts watching dir_list_filename and the policy and
+        //              filter files for changes, leaving config_watch_fd at
+        //              -1 if they can't be watched
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void watch_config_files();
+
+        // Intro:   Watches the directory holding a file on config_watch_fd
+        // Inputs:  filename : the file to watch
+        // Outputs: None
+        // Return:  The watch descriptor, or -1
+        int add_config_watch(const string& filename);
+
+        // Intro:   Checks whether an inotify event is about a file
+        // Inputs:  change : the inotify event
+        //          watch : the watch descriptor of the file's directory
+        //          filename : the file
+        // Outputs: None
+        // Return:  Was the file written or replaced?
+        bool is_change_to(const struct inotify_event * change, int watch,
+                          const string& filename);
+
+        // Intro:   Drains config_watch_fd and reloads the directory list,
+        //              the policy and/or the filter if their file was
+        //              written or replaced
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void read_config_changes();
+
+        // Intro:   Drains signal_fd, remembering the first signal
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void read_termination_signal();
+
+        // Intro:   Asks every shard's writers to commit their buffered
+        //              output on a flush_timer_fd tick
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void flush_output();
+
+        // Intro:   Creates a non-blocking timerfd that fires every interval
+        // Inputs:  interval : time between ticks
+        // Outputs: None
+        // Return:  The timerfd, exits if it can't be created
+        int create_interval_timer(chrono::milliseconds interval);
+
+        // Intro:   Sets up the metrics file timer and the metrics socket
+        //              the options ask for
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, exits if the socket can't be bound
+        void start_metrics();
+
+        // Intro:   Renders the current metrics into metrics_text, in the
+        //              Prometheus text format
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void render_metrics();
+
+        // Intro:   Replaces options.metrics_filename with the current
+        //              metrics, on a metrics_timer_fd tick (or at exit)
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, reports failures on cerr and keeps auditing
+        void write_metrics_file();
+
+        // Intro:   Accepts every pending connection on metrics_socket_fd,
+        //              sends it the current metrics and closes it
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void serve_metrics();
+
+        // Intro:   Starts a reader thread for every shard, when there is
+        //              more than one
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void start_readers();
+
+        // Intro:   Body of a reader thread. Reads the shard's groups until
+        //              reader_stop_fd becomes readable.
+        // Inputs:  shard : the shard to read
+        // Outputs: None
+        // Return:  void
+        void run_reader(ReaderShard& shard);
+
+        // Intro:   Pins the calling reader thread to one of the CPUs the
+        //              process may run on, spreading the shards over them
+        // Inputs:  shard_index : the reader's shard
+        // Outputs: None
+        // Return:  void, reports failures on cerr and keeps the thread
+        //              unpinned
+        void pin_reader(unsigned int shard_index);
+
+        // Intro:   Stops the reader threads, if they were started
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void stop_readers();
+
+        // Intro:   Reads one batch of events from the shard's fanotify_fd,
+        //              answers the permission events in it and queues the
+        //              rest for the shard's writers
+        // Inputs:  shard : the shard to read
+        // Outputs: None
+        // Return:  void, exits if the read fails
+        void read_events(ReaderShard& shard);
+
+        // Intro:   Reads one batch of events from the shard's
+        //              fid_fanotify_fd, resolves their file handles to paths
+        //              and queues them for the shard's writers
+        // Inputs:  shard : the shard to read
+        // Outputs: None
+        // Return:  void, exits if the read fails
+        void read_fid_events(ReaderShard& shard);
+
+        // Intro:   Reads one batch of events from a fanotify group into
+        //              the shard's event_buffer and counts it
+        // Inputs:  shard : the shard the group belongs to
+        //          group_fd : the group's fanotify file descriptor
+        // Outputs: None
+        // Return:  What read() returned
+        ssize_t read_event_batch(ReaderShard& shard, int group_fd);
+
+        // Intro:   Hands a raw event to the shard's writer threads, waiting
+        //              for room or dropping it when the ring is full,
+        //              depending on options.drop_when_full
+        // Inputs:  shard : the shard that read the event
+        //          event : the raw event to queue
+        //          may_drop : false to always wait for room
+        // Outputs: None
+        // Return:  void
+        void enqueue_event(ReaderShard& shard, AuditEvent& event,
+                           bool may_drop = true);
+
+        // Intro:   Accounts for a FAN_Q_OVERFLOW event and queues a marker
+        //              record for the audit output in its place
+        // Inputs:  shard : the shard whose group overflowed
+        //          time_ns : when the overflow event was read
+        // Outputs: None
+        // Return:  void
+        void record_queue_overflow(ReaderShard& shard, uint64_t time_ns);
+
+        // Intro:   Body of a writer thread. Drains the shard's event ring,
+        //              formatting and writing each event, until
+        //              writers_running is cleared and the ring is empty.
+        // Inputs:  shard : the shard the writer belongs to
+        // Outputs: None
+        // Return:  void
+        void run_writer(ReaderShard& shard);
+
+        // Intro:   Replaces the shard's pending_permissions with the
+        //              permission events of a batch that was just read
+        // Inputs:  shard : the shard that read the batch
+        //          num_bytes_read : the size of the batch in events
+        //          read_time : when the batch was read
+        // Outputs: None
+        // Return:  void
+        void track_permission_events(ReaderShard& shard,
+                                     ssize_t num_bytes_read,
+                                     chrono::steady_clock::time_point read_time);
+
+        // Intro:   Takes a permission event off the shard's
+        //              pending_permissions so the reader can answer it
+        // Inputs:  shard : the shard that read the event
+        //          permission_index : how many permission events came
+        //              before it in the batch
+        // Outputs: None
+        // Return:  Should the reader answer it? false if the watchdog
+        //              already did
+        bool claim_permission_event(ReaderShard& shard, 
+                                    size_t permission_index);
+
+        // Intro:   Body of the watchdog thread. Answers permission events
+        //              that were not answered within
+        //              options.permission_deadline with the default
+        //              response, until stop_permission_watchdog is called.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void run_permission_watchdog();
+
+        // Intro:   Answers the shard's permission events that are past
+        //              options.permission_deadline, for the watchdog
+        // Inputs:  shard : the shard whose pending events to check
+        //          response : FAN_ALLOW or FAN_DENY
+        // Outputs: None
+        // Return:  The number of events answered
+        uint64_t answer_overdue_permissions(ReaderShard& shard,
+                                            uint32_t response);
+
+        // Intro:   Stops the watchdog thread, if it was started
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void stop_permission_watchdog();
+
+        // Intro:   Hands an event to the shard's event_coalescer, resolving
+        //              its path if it starts a new record
+        // Inputs:  shard : the shard the event came from
+        //          event : the raw event
+        // Outputs: None
+        // Return:  void
+        void coalesce_event(ReaderShard& shard, AuditEvent& event);
+
+        // Intro:   Writes the shard's coalesced records that are done
+        //              collecting events
+        // Inputs:  shard : the shard whose records to write
+        //          all : write every record, done or not (when stopping)
+        // Outputs: None
+        // Return:  void
+        void write_coalesced_events(ReaderShard& shard, bool all);
+
+        // Intro:   Checks whether a path should be audited, which with
+        //              filesystem marks means it is inside a monitored
+        //              directory
+        // Inputs:  path : the resolved path of an event
+        // Outputs: None
+        // Return:  Should events on the path be written?
+        bool is_monitored_path(string_view path);
+
+        // Intro:   Runs an event through the event filter, resolving its
+        //              path only if a rule gets as far as asking for it
+        // Inputs:  event : the event to filter
+        // Outputs: event : the excluded access types are cleared from its
+        //              mask, and its path may be resolved
+        // Return:  Does the event have anything left to write?
+        bool filter_event(AuditEvent& event);
+
+        // Intro:   Asks the writer threads to finish the events left in the
+        //              rings and waits for them to exit
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void stop_writers();
+
         // Intro:   Extracts the pertinent information from an fanotify event
-        //              to a string and writes it to the given stream
-        // Input:   event : The fanotify event to write to a stream
-        //          audit_output_file : The stream to write the info to
+        //              to a line (or a binary record, with
+        //              options.binary_format) and appends it to the given
+        //              output
+        // Input:   event : The raw event to write, with its path resolved
+        //          output : The output to append the line to
         // Outputs: None
         // Return:  void 
-        void write_event(struct fanotify_event_metadata * event,
-                  ofstream& audit_output_file);
+        void write_event(AuditEvent& event,
+                  AuditOutput& output);
 
-        // Intro:   Forms a string listing all the access types in the
-        //              given fanotify_mark event access type mask
-        // Inputs:   mask : the struct fanotify_event_metadata.mask
-        //              event access type mask
+        // Intro:   Checks whether an event is for the active segment of an
+        //              audit output, without resolving the event's path
+        // Inputs:  event : the raw event
+        // Outputs: None
+        // Return:  Is the event for the audit output?
+        bool is_audit_output(const AuditEvent& event);
+
+        // Intro:   Resolves the path of the file an event happened on from
+        //              the event fd, unless the reader already resolved it.
+        //              Each event's path is resolved only once.
+        // Inputs:  event : the raw event
+        // Outputs: event : event.path is the filepath, FILE_NOT_FOUND or
+        //              PATH_TOO_LONG (see get_filepath_from_fd)
+        // Return:  void
+        void resolve_event_path(AuditEvent& event);
+
+        // Intro:   Publishes the device and inode of the active segment
+        //              of an audit output
+        // Inputs:  output : the audit output
+        //          active_segment : path of the active segment
         // Outputs: None
-        // Return:  A string of all the access types, enclosed in
-        //              parentheses and separated by semicolons
-        string access_type_mask_to_string(unsigned long long mask);
+        // Return:  void
+        void remember_output_identity(AuditOutput& output,
+                                      const string& active_segment);
 
         // Intro:   Sends a struct fanotify_response for the given permission
         //              event file descriptor to the fanotify file descriptor
@@ -136,9 +696,29 @@ class DirectoryListAuditor
         //              permissions response for
         //          fanotify_fd : the fanotify file descriptor to send
         //              the permission response to
+        //          response : FAN_ALLOW or FAN_DENY
         // Outputs: None
         // Return:  void
-        void send_permission_response(int event_fd, int fanotify_fd);
+        void send_permission_response(int event_fd, int fanotify_fd,
+                                      uint32_t response);
+
+        // Intro:   Sends all of the shard's batch_responses to its
+        //              fanotify_fd with as few writev calls as possible
+        // Inputs:  shard : the shard that read the batch
+        // Outputs: None
+        // Return:  void, counts responses the kernel refused in
+        //              permission_response_failures
+        void send_permission_responses(ReaderShard& shard);
+
+        // Intro:   Decides a permission event with the permission policy
+        // Inputs:  event_fd : the event file descriptor
+        //          pid : the accessing process
+        // Outputs: path : the file's interned path, if the policy had to
+        //              look it up
+        // Return:  FAN_ALLOW or FAN_DENY (always FAN_ALLOW without a
+        //              policy). An unreadable path gets the deadline
+        //              response if the policy denies anything.
+        uint32_t decide_permission(int event_fd, pid_t pid, PathRef& path);
 
         // Intro:   Determines whether the given fanotify_mark event access
         //              type mask denotes a permission event requiring
@@ -151,26 +731,23 @@ class DirectoryListAuditor
         bool requires_permission_response(unsigned long long mask);
 
         // Intro:   Gets the username who owned the process of the given pid
-        // Inputs:  pid : the pid to fetch the username for using readproc()
-        // Outputs: None
-        // Return:  Real username of user who owned pid, or 
+        // Inputs:  pid : the pid to fetch the username for, from the user
+        //              cache or else using readproc()
+        // Outputs: username : Real username of user who owned pid, or 
         //              CANNOT_FIND_USER_DEAD_PROCESS if readproc() didn't
         //              find the pid
-        string get_user_of_pid(pid_t pid);
+        // Return:  void
+        void get_user_of_pid(pid_t pid, string& username);
 
-        // Intro:   Gets the current UTC time and date as a string
-        // Inputs:  None
-        // Outputs: None
-        // Return:  A string containing the current UTC time and date
-        string get_UTC_time_date();
-        
-        // Intro:   Takes an open file descriptor and returns the filepath
+        // Intro:   Takes an open file descriptor and interns the filepath
         //              of the file it was opened for
         // Inputs:  fd : the open file descriptor
         // Outputs: None
         // Return:  The filepath that the file descriptor was opened for,
-        //              or FILE_NOT_FOUND if the file descriptor wasn't open
-        string get_filepath_from_fd(int fd);
+        //              FILE_NOT_FOUND if the file descriptor wasn't open,
+        //              or PATH_TOO_LONG if the kernel won't spell the path
+        //              out (PATH_MAX bytes or more)
+        PathRef get_filepath_from_fd(int fd);
         
         // Intro:   Marks a set of directories for monitoring on the given
         //              fanotify file descriptor for the given types of
@@ -194,6 +771,81 @@ class DirectoryListAuditor
                       set<string> monitored_directories, 
                       set<string> excluded_directories);
 
+        // Intro:   Marks directories for monitoring on the groups of the
+        //              shards they were given in directory_shards, with the
+        //              event types each group was marked for in initialize,
+        //              and marks files to ignore on every group
+        // Inputs:  directories : directories to mark for monitoring
+        //          excluded_files : files (or directories) to ignore
+        // Outputs: None
+        // Return:  void
+        void mark_on_shards(const set<string>& directories,
+                            const set<string>& excluded_files);
+
+        // Intro:   Adds the ignore marks for a new active segment of an
+        //              audit output, which is a new file after a rotation
+        // Inputs:  output : the audit output that rotated
+        //          active_segment : path of the new active segment
+        // Outputs: None
+        // Return:  void
+        void ignore_output_segment(AuditOutput& output,
+                                   const string& active_segment);
+
+        // Intro:   Replaces the ignore marks of the previous filter's static
+        //              exclusions with those of a new filter. Only files
+        //              are marked, directories are filtered by dirmon.
+        //              Permission events are never ignored while a policy
+        //              is loaded, since the kernel would allow them without
+        //              asking it.
+        // Inputs:  filter : the new filter
+        // Outputs: None
+        // Return:  void
+        void update_filter_ignore_marks(const EventFilter& filter);
+
+        // Intro:   Raises the soft open file limit as far as allowed, since
+        //              every event waiting in the ring holds an open fd
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, records the resulting limit in open_file_limit
+        void raise_open_file_limit();
+
+        // Intro:   Gets the fanotify_mark flags for monitoring a directory
+        // Inputs:  None
+        // Outputs: None
+        // Return:  FAN_MARK_MOUNT or FAN_MARK_FILESYSTEM (depending on
+        //              options.mark_filesystem) and the flags they go with,
+        //              but not FAN_MARK_ADD/FAN_MARK_REMOVE
+        unsigned int get_monitoring_mark_flags();
+
+        // Intro:   Checks whether a monitored directory shares a
+        //              filesystem (and so a filesystem mark) with a directory
+        // Inputs:  directory_name : the directory to check
+        // Outputs: None
+        // Return:  Is any of monitored_directories on the same filesystem?
+        bool is_filesystem_monitored(const string& directory_name);
+
+        // Intro:   Rebuilds monitored_paths from monitored_directories
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void update_monitored_paths();
+
+        // Intro:   Mounts a directory as itself with bind option
+        // Inputs:  directory_name : directory to mount as itself
+        // Outputs: None
+        // Return:  Did the mount succeed? errno is set if not
+        bool mount_directory(const string& directory_name);
+
+        // Intro:   Stops monitoring a directory: removes its marks from both
+        //              groups of its shard and unmounts it. With filesystem marks, the
+        //              marks are only removed once no other monitored
+        //              directory is on the same filesystem.
+        // Inputs:  directory_name : a directory just removed from
+        //              monitored_directories
+        // Outputs: None
+        // Return:  void
+        void unmonitor_directory(const string& directory_name);
+
         // Intro:   Mounts a set of directories as themselves with bind option
         // Inputs:  directories : set of directories to mount as themselves
         //              (e.g. mount --bind /path/of/dir /path/of/dir)
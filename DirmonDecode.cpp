@@ -0,0 +1,320 @@
+// dirmon-decode: turns a binary audit log written by dirmon --format=binary
+//  back into the same text lines dirmon writes by default.
+//
+// Usage: dirmon-decode [--time-format=iso8601] [--merge] [BINARY_AUDIT_FILE]...
+//  Reads standard input if no files are given and writes to standard
+//  output. Gzipped (rotated and compressed) segments are read as they are.
+//  --merge interleaves the files by event time instead of printing one
+//  after the other, e.g. to put the per-shard outputs of dirmon
+//  --shard-output=split back into a single time-ordered log.
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <pwd.h>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+#include "BinaryAuditFormat.hpp"
+#include "EventFormat.hpp"
+
+using namespace std;
+
+// Usernames by uid, so each uid goes through NSS once
+unordered_map<uint32_t, string> usernames;
+// Print times as ISO 8601 with nanoseconds (like dirmon 
+// --time-format=iso8601)
+bool iso8601_time = false;
+
+// One binary audit log being read, with the path table of its current
+// session
+struct BinaryStream
+{
+    gzFile input;
+    string name;
+    vector<string> paths;
+    // The last record read
+    vector<char> record;
+    bool in_session = false;
+    // Set when the stream turned out to be corrupt or not a binary log
+    bool failed = false;
+};
+
+// Decodes one binary audit log stream to standard output
+bool decode_stream(gzFile input, const string& input_name);
+
+// Decodes several binary audit log streams to standard output, ordered by
+// event time across the streams
+bool merge_streams(vector<BinaryStream>& streams);
+
+// Reads records up to the next event record, learning the paths on the
+// way. Returns the event (pointing into stream.record), or NULL at the end
+// of the stream or on an error (which also sets stream.failed).
+const BinaryEventRecord * read_next_event(BinaryStream& stream);
+
+// Prints an event record in dirmon's text format
+void print_event(const BinaryStream& stream, const BinaryEventRecord& event);
+
+// Resolves a uid from an event record to a username
+const string& get_username_of_uid(uint32_t uid);
+
+int main(int argc, char * argv[])
+{
+    if (argc == 2 && (string(argv[1]) == "--help" || string(argv[1]) == "-h"))
+    {
+        cout << "Usage: dirmon-decode [--time-format=iso8601] [--merge] "
+             << "[BINARY_AUDIT_FILE]..." << endl;
+        cout << "   Prints a binary audit log written by " << endl;
+        cout << "   dirmon --format=binary in dirmon's text format." << endl;
+        cout << "   Reads standard input if no file is given." << endl;
+        cout << "   --merge interleaves the files by event time" << endl;
+        cout << "   (e.g. the files of dirmon --shard-output=split)." << endl;
+        return 0;
+    }
+    int first_file = 1;
+    bool merge = false;
+    for (; first_file < argc; first_file++)
+    {
+        if (string(argv[first_file]) == "--time-format=iso8601")
+        {
+            iso8601_time = true;
+        }
+        else if (string(argv[first_file]) == "--merge")
+        {
+            merge = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    bool all_decoded = true;
+    // gzread passes uncompressed input through unchanged
+    if (argc == first_file)
+    {
+        gzFile input = gzdopen(fileno(stdin), "rb");
+        all_decoded = input && decode_stream(input, "standard input");
+        if (input)
+        {
+            gzclose(input);
+        }
+    }
+    vector<BinaryStream> streams;
+    for (int i = first_file; i < argc; i++)
+    {
+        gzFile input = gzopen(argv[i], "rb");
+        if (!input)
+        {
+            cerr << "dirmon-decode: cannot open '" << argv[i] << "', errno:"
+                 << strerror(errno) << endl;
+            all_decoded = false;
+            continue;
+        }
+        if (merge)
+        {
+            streams.emplace_back();
+            streams.back().input = input;
+            streams.back().name = argv[i];
+            continue;
+        }
+        all_decoded &= decode_stream(input, argv[i]);
+        gzclose(input);
+    }
+    if (merge)
+    {
+        all_decoded &= merge_streams(streams);
+        for (auto stream = streams.begin(); stream != streams.end(); stream++)
+        {
+            gzclose(stream->input);
+        }
+    }
+    return all_decoded ? 0 : 1;
+}
+
+bool decode_stream(gzFile input, const string& input_name)
+{
+    BinaryStream stream;
+    stream.input = input;
+    stream.name = input_name;
+    const BinaryEventRecord * event;
+    while ((event = read_next_event(stream)))
+    {
+        print_event(stream, *event);
+    }
+    return !stream.failed;
+}
+
+// Keep the next event of every stream in a heap and always print the
+// earliest. Each stream is in time order on its own (give dirmon
+// --writer-threads=1 for that), so the result is too.
+bool merge_streams(vector<BinaryStream>& streams)
+{
+    typedef pair<uint64_t, size_t> NextEvent;
+    priority_queue<NextEvent, vector<NextEvent>, greater<NextEvent>> 
+        next_events;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+        const BinaryEventRecord * event = read_next_event(streams[i]);
+        if (event)
+        {
+            next_events.push(NextEvent(event->timestamp_ns, i));
+        }
+    }
+    while (!next_events.empty())
+    {
+        BinaryStream& stream = streams[next_events.top().second];
+        next_events.pop();
+        print_event(stream, *(const BinaryEventRecord *) stream.record.data());
+        const BinaryEventRecord * event = read_next_event(stream);
+        if (event)
+        {
+            next_events.push(NextEvent(event->timestamp_ns, 
+                                       &stream - streams.data()));
+        }
+    }
+    bool all_decoded = true;
+    for (auto stream = streams.begin(); stream != streams.end(); stream++)
+    {
+        all_decoded &= !stream->failed;
+    }
+    return all_decoded;
+}
+
+// Read the stream a record at a time, keeping the session's path table
+const BinaryEventRecord * read_next_event(BinaryStream& stream)
+{
+    const string& input_name = stream.name;
+    vector<string>& paths = stream.paths;
+    vector<char>& record = stream.record;
+    BinaryRecordHeader header;
+
+    while (gzread(stream.input, &header, sizeof(header)) == 
+           (int) sizeof(header))
+    {
+        if (header.length < sizeof(header) || header.length % 8 != 0 ||
+            header.length > BINARY_MAX_RECORD_LENGTH)
+        {
+            cerr << "dirmon-decode: corrupt record in '" << input_name 
+                 << "'" << endl;
+            stream.failed = true;
+            return NULL;
+        }
+        // Read the rest of the record after the header
+        record.resize(header.length);
+        memcpy(record.data(), &header, sizeof(header));
+        if (gzread(stream.input, record.data() + sizeof(header), 
+                   header.length - sizeof(header)) != 
+            (int) (header.length - sizeof(header)))
+        {
+            cerr << "dirmon-decode: '" << input_name 
+                 << "' ends in the middle of a record" << endl;
+            stream.failed = true;
+            return NULL;
+        }
+
+        if (header.type == BINARY_RECORD_SESSION && 
+            header.length >= sizeof(BinarySessionRecord))
+        {
+            BinarySessionRecord * session = 
+                (BinarySessionRecord *) record.data();
+            if (memcmp(session->magic, BINARY_AUDIT_MAGIC, 
+                       sizeof(session->magic)) != 0 ||
+                session->version > BINARY_AUDIT_VERSION)
+            {
+                cerr << "dirmon-decode: '" << input_name 
+                     << "' is not a binary audit log this version of "
+                     << "dirmon-decode understands" << endl;
+                stream.failed = true;
+                return NULL;
+            }
+            paths.clear();
+            stream.in_session = true;
+        }
+        else if (!stream.in_session)
+        {
+            cerr << "dirmon-decode: '" << input_name 
+                 << "' is not a binary audit log" << endl;
+            stream.failed = true;
+            return NULL;
+        }
+        else if (header.type == BINARY_RECORD_PATH && 
+                 header.length >= sizeof(BinaryPathRecord))
+        {
+            BinaryPathRecord * path_record = 
+                (BinaryPathRecord *) record.data();
+            // Ids are handed out in order, so a new path always takes the
+            // next one; anything further on would have the table grow to
+            // whatever size the file asks for
+            if (path_record->path_length > 
+                header.length - sizeof(BinaryPathRecord) ||
+                path_record->path_id > paths.size())
+            {
+                cerr << "dirmon-decode: corrupt path record in '" 
+                     << input_name << "'" << endl;
+                stream.failed = true;
+                return NULL;
+            }
+            if (path_record->path_id == paths.size())
+            {
+                paths.emplace_back();
+            }
+            paths[path_record->path_id].assign(
+                record.data() + sizeof(BinaryPathRecord), 
+                path_record->path_length);
+        }
+        else if (header.type == BINARY_RECORD_EVENT &&
+                 header.length >= sizeof(BinaryEventRecord))
+        {
+            return (const BinaryEventRecord *) record.data();
+        }
+        // Records of unknown types are skipped, for forward compatibility
+    }
+    return NULL;
+}
+
+void print_event(const BinaryStream& stream, const BinaryEventRecord& event)
+{
+    string event_str = format_text_event(
+        event.path_id < stream.paths.size() ? stream.paths[event.path_id] 
+                                            : "FILE_NOT_FOUND",
+        event.timestamp_ns,
+        get_username_of_uid(event.uid),
+        event.pid, event.mask, event.repeat_count, iso8601_time);
+    fwrite(event_str.data(), 1, event_str.size(), stdout);
+}
+
+// Look the uid up with NSS the first time it is seen
+const string& get_username_of_uid(uint32_t uid)
+{
+    auto found = usernames.find(uid);
+    if (found != usernames.end())
+    {
+        return found->second;
+    }
+
+    string username;
+    if (uid == BinaryEventRecord::UNKNOWN_UID)
+    {
+        username = "CANNOT_FIND_USER_DEAD_PROCESS";
+    }
+    else
+    {
+        struct passwd password_entry;
+        struct passwd * result = NULL;
+        vector<char> string_buffer(16384);
+        if (getpwuid_r(uid, &password_entry, string_buffer.data(), 
+                       string_buffer.size(), &result) == 0 && result)
+        {
+            username = result->pw_name;
+        }
+        else
+        {
+            username = to_string(uid);
+        }
+    }
+    return usernames.emplace(uid, username).first->second;
+}
@@ -0,0 +1,123 @@
+#include "EventBuffer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace std;
+
+const chrono::milliseconds EventBuffer::idle_interval(5000);
+
+// -- PUBLIC -------------------------------------------------------------------
+
+EventBuffer::EventBuffer()
+{
+    buffer = NULL;
+    size = 0;
+    min_size = 0;
+    max_size = 0;
+    small_reads = 0;
+    resize_count = 0;
+}
+
+EventBuffer::~EventBuffer()
+{
+    free(buffer);
+}
+
+// Round both limits up to whole pages and start out at the smallest size
+bool EventBuffer::set_limits(size_t min_bytes, size_t max_bytes)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    min_size = (max(min_bytes, (size_t) 1) + page_size - 1) / page_size * 
+               page_size;
+    max_size = (max(max_bytes, min_bytes) + page_size - 1) / page_size * 
+               page_size;
+    if (!resize(min_size))
+    {
+        return false;
+    }
+    resize_count = 0;
+    return true;
+}
+
+struct fanotify_event_metadata * EventBuffer::get()
+{
+    return (struct fanotify_event_metadata *) buffer;
+}
+
+size_t EventBuffer::get_size() const
+{
+    return size;
+}
+
+// A read that left less room than a page (or an eighth of a small buffer)
+// counts as full
+void EventBuffer::adapt_to_read(ssize_t num_bytes_read)
+{
+    if (num_bytes_read <= 0)
+    {
+        return;
+    }
+    if (size > min_size)
+    {
+        last_read_time = chrono::steady_clock::now();
+    }
+    size_t room_left = size - num_bytes_read;
+    if (room_left < min(size / 8, (size_t) sysconf(_SC_PAGESIZE)) + 
+                    FAN_EVENT_METADATA_LEN && size < max_size)
+    {
+        resize(min(size * 2, max_size));
+        return;
+    }
+    if ((size_t) num_bytes_read < size / 4 && size > min_size)
+    {
+        if (++small_reads >= SHRINK_AFTER_READS)
+        {
+            resize(max(size / 2, min_size));
+        }
+        return;
+    }
+    small_reads = 0;
+}
+
+void EventBuffer::adapt_to_idle(chrono::steady_clock::time_point now)
+{
+    if (size > min_size && now - last_read_time >= idle_interval)
+    {
+        resize(min_size);
+    }
+}
+
+bool EventBuffer::is_adaptive() const
+{
+    return max_size > min_size;
+}
+
+uint64_t EventBuffer::get_resize_count() const
+{
+    return resize_count;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Nothing is kept across reads, so the old contents can just be dropped
+bool EventBuffer::resize(size_t new_size)
+{
+    void * new_buffer = NULL;
+    if (posix_memalign(&new_buffer, sysconf(_SC_PAGESIZE), new_size) != 0)
+    {
+        return false;
+    }
+    free(buffer);
+    buffer = new_buffer;
+    size = new_size;
+    small_reads = 0;
+    last_read_time = chrono::steady_clock::now();
+    resize_count++;
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef EVENTBUFFER_H
+#define EVENTBUFFER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sys/fanotify.h>
+#include <sys/types.h>
+
+using namespace std;
+
+// The page-aligned buffer fanotify events are read into. It is reused for
+//  every read and sized to the traffic: it doubles (up to a maximum) when a
+//  read comes back nearly full, since more events were probably waiting,
+//  and halves (down to a minimum) after a long run of reads that used only
+//  a small part of it. When traffic stops altogether there are no reads to
+//  go by, so the reader also checks it on a timer, and it drops back to
+//  the minimum once nothing has been read for idle_interval. Not
+//  thread-safe: meant to be used by the reader thread only.
+class EventBuffer
+{
+    public:
+        EventBuffer();
+        ~EventBuffer();
+
+        // Intro:   Sets the smallest and largest the buffer may be, and
+        //              allocates it at the smallest size. Sizes are
+        //              rounded up to whole pages.
+        // Inputs:  min_bytes : the starting (and smallest) size
+        //          max_bytes : the largest size (at least min_bytes; equal
+        //              to min_bytes for a fixed size)
+        // Outputs: None
+        // Return:  false if the buffer can't be allocated
+        bool set_limits(size_t min_bytes, size_t max_bytes);
+
+        // Intro:   Gets the buffer to read events into
+        // Inputs:  None
+        // Outputs: None
+        // Return:  The start of the buffer
+        struct fanotify_event_metadata * get();
+
+        // Current size of the buffer in bytes
+        size_t get_size() const;
+
+        // Intro:   Resizes the buffer for the next read based on how full
+        //              the last read left it. Invalidates the pointer from
+        //              get() if the buffer is resized.
+        // Inputs:  num_bytes_read : what the last read returned
+        // Outputs: None
+        // Return:  void
+        void adapt_to_read(ssize_t num_bytes_read);
+
+        // Intro:   Shrinks the buffer back to the smallest size if nothing
+        //              was read into it for idle_interval. Call it now and
+        //              then (at least every idle_interval) from the reader.
+        // Inputs:  now : the current time
+        // Outputs: None
+        // Return:  void
+        void adapt_to_idle(chrono::steady_clock::time_point now);
+
+        // Can the buffer grow (so it may need shrinking when idle)?
+        bool is_adaptive() const;
+
+        // Number of times the buffer grew or shrank
+        uint64_t get_resize_count() const;
+
+        // How long without reads before the buffer is shrunk right down
+        static const chrono::milliseconds idle_interval;
+
+    private:
+        // Reads in a row that used under a quarter of the buffer before it
+        // is shrunk
+        static const unsigned int SHRINK_AFTER_READS = 256;
+
+        void * buffer;
+        size_t size;
+        size_t min_size;
+        size_t max_size;
+        unsigned int small_reads;
+        chrono::steady_clock::time_point last_read_time;
+        uint64_t resize_count;
+
+        EventBuffer(const EventBuffer&);
+        EventBuffer& operator=(const EventBuffer&);
+
+        // Intro:   Replaces the buffer with one of the given size
+        // Inputs:  new_size : the new size in bytes (whole pages)
+        // Outputs: None
+        // Return:  false (keeping the old buffer) if it can't be allocated
+        bool resize(size_t new_size);
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "EventClock.hpp"
+
+#include <ctime>
+
+using namespace std;
+
+const int64_t EventClock::resync_interval_ns = 1000000000;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+EventClock::EventClock()
+{
+    next_resync_ns = resync() + resync_interval_ns;
+}
+
+// The offset is only read and replaced whole, so threads racing to take it
+// again just store nearly the same value twice
+uint64_t EventClock::now_ns() const
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t monotonic_ns = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    if (monotonic_ns >= next_resync_ns.load(memory_order_relaxed))
+    {
+        next_resync_ns.store(resync() + resync_interval_ns,
+                             memory_order_relaxed);
+    }
+    return (uint64_t) (monotonic_ns + 
+                       wall_clock_offset_ns.load(memory_order_relaxed));
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Read the monotonic clock on both sides of the wall clock and take the
+// middle, so the offset is off by at most half the time between the reads
+int64_t EventClock::resync() const
+{
+    struct timespec before, wall, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    int64_t before_ns = (int64_t) before.tv_sec * 1000000000 + before.tv_nsec;
+    int64_t after_ns = (int64_t) after.tv_sec * 1000000000 + after.tv_nsec;
+    int64_t wall_ns = (int64_t) wall.tv_sec * 1000000000 + wall.tv_nsec;
+    int64_t middle_ns = before_ns + (after_ns - before_ns) / 2;
+    wall_clock_offset_ns.store(wall_ns - middle_ns, memory_order_relaxed);
+    return middle_ns;
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,45 @@
+#ifndef EVENTCLOCK_H
+#define EVENTCLOCK_H
+
+#include <atomic>
+#include <cstdint>
+
+using namespace std;
+
+// Timestamps events as nanoseconds since the epoch, read off
+//  CLOCK_MONOTONIC and shifted onto the wall clock by an offset that is
+//  taken again once a second. Between two of those, stamps never go
+//  backwards and reading the clock costs a single vDSO call. If the wall
+//  clock is stepped (by NTP, or by hand), the stamps follow it within a
+//  second, so they can jump back once; the order of the events in the
+//  output isn't affected.
+class EventClock
+{
+    public:
+        // Takes the offset between CLOCK_REALTIME and CLOCK_MONOTONIC
+        EventClock();
+
+        // Intro:   Gets the current time, taking the offset again first if
+        //              the last one is more than resync_interval_ns old
+        // Inputs:  None
+        // Outputs: None
+        // Return:  Nanoseconds since the epoch
+        uint64_t now_ns() const;
+
+    private:
+        // How often the offset is taken again
+        static const int64_t resync_interval_ns;
+
+        // CLOCK_REALTIME - CLOCK_MONOTONIC when the offset was last taken
+        mutable atomic<int64_t> wall_clock_offset_ns;
+        // CLOCK_MONOTONIC time at which the offset is to be taken again
+        mutable atomic<int64_t> next_resync_ns;
+
+        // Intro:   Takes the offset between the clocks
+        // Inputs:  None
+        // Outputs: None
+        // Return:  The CLOCK_MONOTONIC time it was taken at
+        int64_t resync() const;
+};
+
+#endif
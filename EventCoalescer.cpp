@@ -0,0 +1,137 @@
+#include "EventCoalescer.hpp"
+
+#include <sys/stat.h>
+
+using namespace std;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+EventCoalescer::EventCoalescer()
+{
+    window = chrono::milliseconds(0);
+    merged_count = 0;
+}
+
+void EventCoalescer::set_window(chrono::milliseconds window)
+{
+    this->window = window;
+}
+
+bool EventCoalescer::merge(const AuditEvent& event)
+{
+    Key key;
+    if (!make_key(event, key))
+    {
+        return false;
+    }
+    lock_guard<mutex> lock(records_mutex);
+    return merge_locked(key, event.mask);
+}
+
+// Another writer may have started a record for the same key since merge()
+// was called, in which case this event joins it instead
+void EventCoalescer::add(AuditEvent&& event, bool write)
+{
+    Key key;
+    if (!make_key(event, key))
+    {
+        // Nothing to recognize its repeats by, so it is a record of its
+        // own that expires like any other
+        key = Key{event.pid, 0, 0, event.path.get_id()};
+    }
+    event.fd.reset();
+    lock_guard<mutex> lock(records_mutex);
+    if (merge_locked(key, event.mask))
+    {
+        return;
+    }
+    event.repeat_count = 1;
+    records.push_back(Record{key, move(event), write,
+                             chrono::steady_clock::now() + window});
+    records_by_key[key] = prev(records.end());
+}
+
+// Records expire in the order they were started. Over MAX_RECORDS, the
+// oldest records go early.
+void EventCoalescer::take_expired(vector<AuditEvent>& expired, bool all)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    lock_guard<mutex> lock(records_mutex);
+    while (!records.empty() &&
+           (all || records.front().expiry_time <= now || 
+            records.size() > MAX_RECORDS))
+    {
+        Record& record = records.front();
+        if (record.write)
+        {
+            expired.push_back(move(record.event));
+        }
+        records_by_key.erase(record.key);
+        records.pop_front();
+    }
+}
+
+uint64_t EventCoalescer::get_merged_count() const
+{
+    return merged_count;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+bool EventCoalescer::Key::operator==(const Key& other) const
+{
+    return pid == other.pid && device == other.device && 
+           inode == other.inode && path_id == other.path_id;
+}
+
+size_t EventCoalescer::KeyHash::operator()(const Key& key) const
+{
+    size_t seed = 0;
+    uint64_t parts[4] = {(uint64_t) key.path_id, (uint64_t) key.inode, 
+                         (uint64_t) key.device, (uint64_t) key.pid};
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        seed ^= std::hash<uint64_t>()(parts[i]) + 0x9e3779b97f4a7c15ULL + 
+                (seed << 6) + (seed >> 2);
+    }
+    return seed;
+}
+
+bool EventCoalescer::make_key(const AuditEvent& event, Key& key)
+{
+    key.pid = event.pid;
+    if (!event.fd.is_open())
+    {
+        key.device = 0;
+        key.inode = 0;
+        key.path_id = event.path.get_id();
+        return true;
+    }
+    struct stat event_stat;
+    if (fstat(event.fd.get(), &event_stat) == -1)
+    {
+        return false;
+    }
+    key.device = event_stat.st_dev;
+    key.inode = event_stat.st_ino;
+    key.path_id = 0;
+    return true;
+}
+
+bool EventCoalescer::merge_locked(const Key& key, uint64_t mask)
+{
+    auto found = records_by_key.find(key);
+    if (found == records_by_key.end())
+    {
+        return false;
+    }
+    AuditEvent& record_event = found->second->event;
+    record_event.mask |= mask;
+    record_event.repeat_count++;
+    merged_count++;
+    return true;
+}
@@ -0,0 +1,124 @@
+#ifndef EVENTCOALESCER_H
+#define EVENTCOALESCER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+#include "AuditEvent.hpp"
+
+using namespace std;
+
+// Merges the events one process causes on one file within a short window
+//  into a single record, with the masks OR'd together and a count of the
+//  events merged (e.g. a cat of a large file: an open, many accesses and a
+//  close). Files are told apart by device and inode for events that carry
+//  an fd, so a repeat costs an fstat() instead of a path lookup, a user
+//  lookup and a line of output; FID events are told apart by the id of
+//  their interned path.
+//  Safe to share between writer threads.
+class EventCoalescer
+{
+    public:
+        EventCoalescer();
+
+        // Intro:   Sets how long a record collects events
+        // Inputs:  window : time from a record's first event until it is
+        //              written
+        // Outputs: None
+        // Return:  void
+        void set_window(chrono::milliseconds window);
+
+        // Intro:   Merges an event into the record collecting its process
+        //              and file, if there is one
+        // Inputs:  event : the event, not yet resolved
+        // Outputs: None
+        // Return:  true if the event was merged (the caller is done with
+        //              it), false if it starts a new record
+        bool merge(const AuditEvent& event);
+
+        // Intro:   Starts a record with an event that merge() returned
+        //              false for. The event's fd is closed: the record
+        //              only keeps its resolved path.
+        // Inputs:  event : the event, with its path resolved
+        //          write : false for an event that won't be written (e.g.
+        //              filtered out), so that its repeats are dropped as
+        //              cheaply as they are merged
+        // Outputs: None
+        // Return:  void
+        void add(AuditEvent&& event, bool write);
+
+        // Intro:   Takes the records whose window has passed
+        // Inputs:  all : take every record, whatever its age
+        // Outputs: records : the records to write, appended in the order
+        //              they were started, with repeat_count set
+        // Return:  void
+        void take_expired(vector<AuditEvent>& records, bool all = false);
+
+        // Events merged into an existing record
+        uint64_t get_merged_count() const;
+
+    private:
+        struct Key
+        {
+            pid_t pid;
+            dev_t device;
+            ino_t inode;
+            // Only set for events without an fd, whose path stays interned
+            // (under this id) while its record holds it
+            uint32_t path_id;
+
+            bool operator==(const Key& other) const;
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Record
+        {
+            Key key;
+            AuditEvent event;
+            bool write;
+            chrono::steady_clock::time_point expiry_time;
+        };
+
+        // The most records collected at once; past this the oldest are
+        // written early
+        static const size_t MAX_RECORDS = 65536;
+
+        chrono::milliseconds window;
+        // Records in the order they were started, which is also the order
+        // they expire in
+        list<Record> records;
+        unordered_map<Key, list<Record>::iterator, KeyHash> records_by_key;
+        mutex records_mutex;
+        // Only changed under records_mutex, but read without it for metrics
+        atomic<uint64_t> merged_count;
+
+        EventCoalescer(const EventCoalescer&);
+        EventCoalescer& operator=(const EventCoalescer&);
+
+        // Intro:   Builds the key of an event
+        // Inputs:  event : the event
+        // Outputs: key : the process and file of the event
+        // Return:  false if the event's fd can't be stat'ed
+        static bool make_key(const AuditEvent& event, Key& key);
+
+        // Intro:   Merges an event into the record for a key, if there is
+        //              one. records_mutex must be held.
+        // Inputs:  key : the key of the event
+        //          mask : the event's mask
+        // Outputs: None
+        // Return:  Was there a record to merge into?
+        bool merge_locked(const Key& key, uint64_t mask);
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "EventFilter.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fnmatch.h>
+#include <fstream>
+#include <sstream>
+#include <sys/fanotify.h>
+
+using namespace std;
+
+const uint64_t EventFilter::FILTERED_EVENT_TYPES =
+    FAN_ACCESS | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE | FAN_OPEN |
+    FAN_OPEN_PERM | FAN_ACCESS_PERM;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+EventFilter::EventFilter()
+{
+}
+
+bool EventFilter::load(const string& filter_filename, string& error_message)
+{
+    ifstream filter_file(filter_filename);
+    if (!filter_file.is_open())
+    {
+        error_message = "cannot open filter file '" + filter_filename +
+                        "': " + strerror(errno);
+        return false;
+    }
+
+    string line;
+    for (unsigned int line_number = 1; getline(filter_file, line);
+         line_number++)
+    {
+        istringstream fields(line);
+        string action;
+        if (!(fields >> action) || action[0] == '#')
+        {
+            continue;
+        }
+        string where = filter_filename + ":" + to_string(line_number) + ": ";
+        Rule rule{false, 0, FILTERED_EVENT_TYPES, 0, "", "", "", false};
+        if (action == "exclude")
+        {
+            rule.exclude = true;
+        }
+        else if (action != "include")
+        {
+            error_message = where + "expected include or exclude, got '" +
+                            action + "'";
+            return false;
+        }
+
+        string condition;
+        uint64_t event_types;
+        while (fields >> condition)
+        {
+            size_t equals_pos = condition.find('=');
+            string name = condition.substr(0, equals_pos);
+            string value = equals_pos == string::npos ? "" :
+                           condition.substr(equals_pos + 1);
+            char * value_end = NULL;
+            unsigned long id = strtoul(value.c_str(), &value_end, 10);
+            bool is_id = !value.empty() && *value_end == '\0';
+            if (name == "uid" && is_id)
+            {
+                rule.conditions |= MATCH_UID;
+                rule.uid = id;
+            }
+            else if (name == "comm" && !value.empty())
+            {
+                rule.conditions |= MATCH_COMM;
+                rule.comm = value;
+            }
+            else if (name == "exe" && !value.empty())
+            {
+                rule.conditions |= MATCH_EXE;
+                rule.exe = value;
+            }
+            else if (name == "path" && !value.empty() && value[0] == '/')
+            {
+                rule.conditions |= MATCH_PATH;
+                rule.path_is_glob = value.find_first_of("*?[") !=
+                                    string::npos;
+                // Without the trailing slash, "beneath" is a plain prefix
+                while (!rule.path_is_glob && value.size() > 1 &&
+                       value.back() == '/')
+                {
+                    value.pop_back();
+                }
+                rule.path = value;
+            }
+            else if (name == "events" &&
+                     parse_event_types(value, event_types))
+            {
+                rule.event_types = event_types;
+            }
+            else
+            {
+                error_message = where + "invalid condition '" + condition + "'";
+                return false;
+            }
+        }
+        rules.push_back(rule);
+    }
+    return true;
+}
+
+// Each rule claims the undecided access types it covers when it matches,
+// so later rules only see what the earlier ones left
+uint64_t EventFilter::filter(uint64_t mask, FilterSubject& subject,
+                             UserCache& user_cache) const
+{
+    uint64_t undecided = mask & FILTERED_EVENT_TYPES;
+    uint64_t excluded = 0;
+    for (auto rule = rules.begin(); rule != rules.end() && undecided; rule++)
+    {
+        uint64_t covered = undecided & rule->event_types;
+        if (!covered)
+        {
+            continue;
+        }
+        if (!matches(*rule, subject, user_cache))
+        {
+            if (subject.needs_path)
+            {
+                return mask;
+            }
+            continue;
+        }
+        if (rule->exclude)
+        {
+            excluded |= covered;
+        }
+        undecided &= ~covered;
+    }
+    return mask & ~excluded;
+}
+
+// Walk the rules in order, keeping track of which access types an include
+// rule may have claimed already
+void EventFilter::get_static_exclusions(
+    vector<pair<string, uint64_t>>& exclusions) const
+{
+    uint64_t claimed = 0;
+    for (auto rule = rules.begin(); rule != rules.end(); rule++)
+    {
+        if (!rule->exclude)
+        {
+            claimed |= rule->event_types;
+            continue;
+        }
+        uint64_t event_types = rule->event_types & ~claimed;
+        if (rule->conditions == MATCH_PATH && !rule->path_is_glob &&
+            event_types)
+        {
+            exclusions.push_back(make_pair(rule->path, event_types));
+        }
+    }
+}
+
+size_t EventFilter::get_rule_count() const
+{
+    return rules.size();
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+bool EventFilter::parse_event_types(const string& names, uint64_t& event_types)
+{
+    static const pair<const char *, uint64_t> types[] = {
+        {"ACCESS", FAN_ACCESS},
+        {"MODIFY", FAN_MODIFY},
+        {"CLOSE_WRITE", FAN_CLOSE_WRITE},
+        {"CLOSE_NOWRITE", FAN_CLOSE_NOWRITE},
+        {"CLOSE", FAN_CLOSE},
+        {"OPEN", FAN_OPEN},
+        {"OPEN_PERM", FAN_OPEN_PERM},
+        {"ACCESS_PERM", FAN_ACCESS_PERM}
+    };
+    event_types = 0;
+    istringstream name_list(names);
+    string name;
+    while (getline(name_list, name, ','))
+    {
+        uint64_t type = 0;
+        for (auto known = begin(types); known != end(types); known++)
+        {
+            if (name == known->first)
+            {
+                type = known->second;
+            }
+        }
+        if (!type)
+        {
+            return false;
+        }
+        event_types |= type;
+    }
+    return event_types != 0;
+}
+
+// Check the conditions cheapest first, so that the process is only looked
+// up for rules that cover the event's types, and the path is only asked for
+// once the process matches
+bool EventFilter::matches(const Rule& rule, FilterSubject& subject,
+                          UserCache& user_cache) const
+{
+    if (rule.conditions & MATCH_UID)
+    {
+        if (!subject.has_uid)
+        {
+            subject.uid_known = user_cache.get_uid_of_pid(subject.pid,
+                                                          subject.uid);
+            subject.has_uid = true;
+        }
+        if (!subject.uid_known || subject.uid != rule.uid)
+        {
+            return false;
+        }
+    }
+    if ((rule.conditions & (MATCH_COMM | MATCH_EXE)) &&
+        (!subject.has_program ||
+         ((rule.conditions & MATCH_EXE) && !subject.has_exe)))
+    {
+        bool need_exe = rule.conditions & MATCH_EXE;
+        subject.program_known = user_cache.get_program_of_pid(
+            subject.pid, need_exe, subject.comm, subject.exe);
+        subject.has_program = true;
+        subject.has_exe |= need_exe;
+    }
+    if ((rule.conditions & MATCH_COMM) &&
+        (!subject.program_known || subject.comm != rule.comm))
+    {
+        return false;
+    }
+    if ((rule.conditions & MATCH_EXE) &&
+        (!subject.program_known || subject.exe != rule.exe))
+    {
+        return false;
+    }
+    if (rule.conditions & MATCH_PATH)
+    {
+        if (!subject.has_path)
+        {
+            subject.needs_path = true;
+            return false;
+        }
+        return matches_path(rule, subject.path);
+    }
+    return true;
+}
+
+// fnmatch() needs the path NUL-terminated, which an interned path isn't,
+// so patterns match against a copy in a buffer of the thread's
+bool EventFilter::matches_path(const Rule& rule, string_view path)
+{
+    if (rule.path_is_glob)
+    {
+        thread_local string terminated_path;
+        terminated_path.assign(path);
+        return fnmatch(rule.path.c_str(), terminated_path.c_str(), 0) == 0;
+    }
+    if (path.compare(0, rule.path.size(), rule.path) != 0)
+    {
+        return false;
+    }
+    return path.size() == rule.path.size() || rule.path == "/" ||
+           path[rule.path.size()] == '/';
+}
@@ -0,0 +1,166 @@
+#ifndef EVENTFILTER_H
+#define EVENTFILTER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+#include "UserCache.hpp"
+
+using namespace std;
+
+// The process and file behind an event, as far as the event filter needs to
+//  know them. The process's uid, command name and executable come from the
+//  user cache the first time a rule asks for them. The path costs a
+//  readlink, so it is left to the caller: until has_path is set, a rule
+//  that gets as far as its path condition sets needs_path and the filter
+//  gives up (see EventFilter::filter). Reusable, so a writer keeps one
+//  around instead of allocating the strings for every event.
+struct FilterSubject
+{
+    pid_t pid = 0;
+    bool has_uid = false;
+    bool uid_known = false;
+    uid_t uid = 0;
+    bool has_program = false;
+    bool has_exe = false;
+    bool program_known = false;
+    string comm;
+    string exe;
+    bool has_path = false;
+    string_view path;
+    bool needs_path = false;
+
+    // Intro:   Forgets the previous event's process and path
+    // Inputs:  new_pid : the pid of the next event
+    // Outputs: None
+    // Return:  void
+    void reset(pid_t new_pid)
+    {
+        pid = new_pid;
+        has_uid = false;
+        has_program = false;
+        has_exe = false;
+        has_path = false;
+        needs_path = false;
+    }
+};
+
+// Include/exclude rules deciding which events make it into the audit output,
+//  checked before an event is formatted (and, where a rule doesn't need
+//  the path, before the path is resolved). A loaded filter is never
+//  changed, so it can be shared between threads and replaced as a whole.
+//
+// Rule file format, one rule per line (blank lines and lines starting with
+//  '#' are skipped):
+//      include|exclude [uid=N] [comm=NAME] [exe=PATH] [path=PATH]
+//                      [events=TYPE,...]
+//  A rule matches events of the listed types (ACCESS, MODIFY, CLOSE_WRITE,
+//  CLOSE_NOWRITE, CLOSE, OPEN, OPEN_PERM, ACCESS_PERM; all of them without
+//  events=) from processes that match all of its conditions: uid is the
+//  real uid, comm the command name and exe the executable. path=PATH
+//  matches PATH and everything beneath it, unless PATH has any of *?[ in
+//  it, in which case it is an fnmatch(3) pattern over the whole path (so *
+//  matches across slashes too). For each access type of an event, the
+//  first matching rule in the file decides whether it is kept, and types
+//  no rule matches are kept. An event that has no access type left is
+//  dropped. The checks of a rule run cheapest first: event types, then
+//  the process (from the user cache), then the path.
+class EventFilter
+{
+    public:
+        // The access types rules can filter
+        static const uint64_t FILTERED_EVENT_TYPES;
+
+        EventFilter();
+
+        // Intro:   Compiles a rule file into this filter, which must be
+        //              freshly constructed
+        // Inputs:  filter_filename : the rule file
+        // Outputs: error_message : what is wrong with the file, on failure
+        // Return:  Was the whole file compiled?
+        bool load(const string& filter_filename, string& error_message);
+
+        // Intro:   Filters the access types of an event
+        // Inputs:  mask : the event's fanotify mask
+        //          subject : the process (and, once needs_path was set,
+        //              the path) behind the event
+        //          user_cache : where the process is looked up
+        // Outputs: subject : the process is filled in if a rule needed
+        //              it, and needs_path is set if a rule needed the
+        //              path before it was given
+        // Return:  The mask with the excluded access types cleared, or
+        //              the mask unchanged if subject.needs_path was set
+        //              (give it the path and filter again)
+        uint64_t filter(uint64_t mask, FilterSubject& subject,
+                        UserCache& user_cache) const;
+
+        // Intro:   Gets the exclusions that don't depend on the process,
+        //              only on one exact path, so that the kernel can be
+        //              told not to send those events in the first place.
+        //              The access types an earlier include rule could
+        //              claim are left out, since the kernel can't honour
+        //              rule order.
+        // Inputs:  None
+        // Outputs: exclusions : the paths and access types to ignore
+        // Return:  void
+        void get_static_exclusions(
+            vector<pair<string, uint64_t>>& exclusions) const;
+
+        // Number of rules compiled from the file
+        size_t get_rule_count() const;
+
+    private:
+        enum RuleCondition : uint8_t
+        {
+            MATCH_UID = 1,
+            MATCH_COMM = 2,
+            MATCH_EXE = 4,
+            MATCH_PATH = 8
+        };
+
+        struct Rule
+        {
+            bool exclude;
+            uint8_t conditions;
+            // Access types the rule covers
+            uint64_t event_types;
+            uid_t uid;
+            string comm;
+            string exe;
+            // A directory or file, or an fnmatch pattern if path_is_glob
+            string path;
+            bool path_is_glob;
+        };
+
+        vector<Rule> rules;
+
+        // Intro:   Parses the value of events=
+        // Inputs:  names : comma separated access type names
+        // Outputs: event_types : the access types
+        // Return:  Were all of the names known?
+        static bool parse_event_types(const string& names,
+                                      uint64_t& event_types);
+
+        // Intro:   Checks a rule's conditions against an event
+        // Inputs:  rule : the rule to check
+        //          subject : the process and path behind the event
+        //          user_cache : where the process is looked up
+        // Outputs: subject : the process is filled in if needed, and
+        //              needs_path is set if the path was needed first
+        // Return:  Does the event match every condition of the rule?
+        bool matches(const Rule& rule, FilterSubject& subject,
+                     UserCache& user_cache) const;
+
+        // Intro:   Checks a path against a rule's path condition
+        // Inputs:  rule : the rule with the path condition
+        //          path : the path to check
+        // Outputs: None
+        // Return:  Is it the rule's path, beneath it, or matched by it?
+        static bool matches_path(const Rule& rule, string_view path);
+};
+
+#endif
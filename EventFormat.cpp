@@ -0,0 +1,159 @@
+#include "EventFormat.hpp"
+
+#include <charconv>
+#include <sys/fanotify.h>
+
+using namespace std;
+
+// Label of each access type bit, in the order they are listed
+struct AccessTypeLabel
+{
+    unsigned long long bit;
+    string_view label;
+};
+
+static constexpr AccessTypeLabel ACCESS_TYPE_LABELS[] = {
+    {FAN_ACCESS, "FAN_ACCESS"},
+    {FAN_OPEN, "FAN_OPEN"},
+    {FAN_MODIFY, "FAN_MODIFY"},
+    {FAN_CLOSE_WRITE, "FAN_CLOSE_WRITE"},
+    {FAN_CLOSE_NOWRITE, "FAN_CLOSE_NOWRITE"},
+    {FAN_Q_OVERFLOW, "FAN_Q_OVERFLOW"},
+    {FAN_ACCESS_PERM, "FAN_ACCESS_PERM"},
+    {FAN_OPEN_PERM, "FAN_OPEN_PERM"}
+};
+
+// Append a number without going through a temporary string
+static void append_number(string& line, unsigned long long number)
+{
+    char digits[24];
+    char * digits_end = to_chars(digits, digits + sizeof(digits), number).ptr;
+    line.append(digits, digits_end - digits);
+}
+
+// Given an fanotify_mark access type mask, append the different access
+// types found
+// Argument is an unsigned long long because __aligned is not allowed
+void append_access_types(string& line, unsigned long long mask)
+{
+    line += '(';
+    bool first = true;
+    for (const AccessTypeLabel& access_type : ACCESS_TYPE_LABELS)
+    {
+        if (mask & access_type.bit)
+        {
+            if (!first)
+            {
+                line += ';';
+            }
+            line += access_type.label;
+            first = false;
+        }
+    }
+    line += ')';
+}
+
+// Format the given time in UTC the way asctime does, tagged with (UTC), or
+// as ISO 8601. Only the text up to the second is cached; several writers
+// format at once, so each thread keeps its own last second per format.
+void append_UTC_time_date(string& line, uint64_t time_ns, bool iso8601)
+{
+    struct CachedSecond
+    {
+        time_t second = (time_t) -1;
+        char text[48];
+        size_t length = 0;
+    };
+    thread_local CachedSecond cached_seconds[2];
+    CachedSecond& cached = cached_seconds[iso8601];
+    time_t second = time_ns / 1000000000;
+    if (second != cached.second)
+    {
+        tm UTC_time;
+        gmtime_r(&second, &UTC_time);
+        if (iso8601)
+        {
+            cached.length = strftime(cached.text, sizeof(cached.text),
+                                     "%Y-%m-%dT%H:%M:%S", &UTC_time);
+        }
+        else
+        {
+            char time_buf[32];
+            asctime_r(&UTC_time, time_buf);
+            // Drop asctime's trailing newline and add the (UTC) identifier
+            string_view time_date(time_buf);
+            time_date.remove_suffix(1);
+            time_date.copy(cached.text, time_date.size());
+            string_view("(UTC)").copy(cached.text + time_date.size(), 5);
+            cached.length = time_date.size() + 5;
+        }
+        cached.second = second;
+    }
+    line.append(cached.text, cached.length);
+    if (iso8601)
+    {
+        // Nanoseconds, zero-padded to nine digits
+        char fraction[11] = ".000000000";
+        uint32_t nanoseconds = time_ns % 1000000000;
+        for (int digit = 9; nanoseconds > 0; digit--)
+        {
+            fraction[digit] = '0' + nanoseconds % 10;
+            nanoseconds /= 10;
+        }
+        line.append(fraction, 10);
+        line += 'Z';
+    }
+}
+
+// Process the pieces of an event into a line of information including
+// filepath, time of access, username of accessing process, pid of accessing
+// process, and type of access
+void append_text_event(string& line, string_view filepath, uint64_t time_ns,
+                       string_view username, pid_t pid,
+                       unsigned long long mask, uint32_t repeat_count,
+                       bool iso8601)
+{
+    line += filepath;
+    line += ',';
+    append_UTC_time_date(line, time_ns, iso8601);
+    line += ',';
+    line += username;
+    line += ',';
+    append_number(line, pid);
+    line += ',';
+    append_access_types(line, mask);
+    line += ',';
+
+    // Coalesced lines also say how many events they stand for
+    if (repeat_count > 0)
+    {
+        append_number(line, repeat_count);
+        line += ',';
+    }
+    line += '\n';
+}
+
+string access_type_mask_to_string(unsigned long long mask)
+{
+    string access_string;
+    append_access_types(access_string, mask);
+    return access_string;
+}
+
+string UTC_time_date_to_string(time_t system_time)
+{
+    string UTC_time_str;
+    append_UTC_time_date(UTC_time_str, (uint64_t) system_time * 1000000000);
+    return UTC_time_str;
+}
+
+string format_text_event(string_view filepath, uint64_t time_ns,
+                         string_view username, pid_t pid,
+                         unsigned long long mask, uint32_t repeat_count,
+                         bool iso8601)
+{
+    string event_str;
+    append_text_event(event_str, filepath, time_ns, username, pid, mask,
+                      repeat_count, iso8601);
+    return event_str;
+}
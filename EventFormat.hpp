@@ -0,0 +1,94 @@
+#ifndef EVENTFORMAT_H
+#define EVENTFORMAT_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+using namespace std;
+
+// Text formatting of audit events, shared by dirmon's text output and
+//  dirmon-decode so that both produce exactly the same lines.
+// The append_* functions write straight into a caller's line buffer and
+//  never allocate once the buffer has grown to the size of a line, so a
+//  buffer reused from event to event formats events without touching the
+//  heap. The string-returning functions wrap them for everything else.
+
+// Intro:   Appends all the access types in the given fanotify_mark event
+//              access type mask
+// Inputs:  line : the buffer to append to
+//          mask : the struct fanotify_event_metadata.mask
+//              event access type mask
+// Outputs: line : with the access types appended, enclosed in
+//              parentheses and separated by semicolons
+// Return:  void
+void append_access_types(string& line, unsigned long long mask);
+
+// Intro:   Appends a time as the UTC time and date used in the audit
+//              output. The text of the last second formatted is kept per
+//              thread, so events within the same second only copy it.
+// Inputs:  line : the buffer to append to
+//          time_ns : the time to format, in nanoseconds since the epoch
+//          iso8601 : use ISO 8601 with nanoseconds (2026-10-18T01:50:28.
+//              123456789Z) instead of asctime's format to the second
+//              (Sun Oct 18 01:50:28 2026(UTC))
+// Outputs: line : with the UTC time and date appended
+// Return:  void
+void append_UTC_time_date(string& line, uint64_t time_ns, 
+                          bool iso8601 = false);
+
+// Intro:   Appends one line of audit output formed from the pieces of an
+//              event
+// Inputs:  line : the buffer to append to
+//          filepath : the path of the accessed file
+//          time_ns : the time of the access, in nanoseconds since the
+//              epoch
+//          username : the user owning the accessing process
+//          pid : the pid of the accessing process
+//          mask : the fanotify event access type mask
+//          repeat_count : the number of events coalesced into the line, or
+//              0 to leave out the count column
+//          iso8601 : see append_UTC_time_date
+// Outputs: line : with the line appended, including its newline
+// Return:  void
+void append_text_event(string& line, string_view filepath, uint64_t time_ns,
+                       string_view username, pid_t pid,
+                       unsigned long long mask, uint32_t repeat_count = 0,
+                       bool iso8601 = false);
+
+// Intro:   Forms a string listing all the access types in the
+//              given fanotify_mark event access type mask
+// Inputs:   mask : the struct fanotify_event_metadata.mask
+//              event access type mask
+// Outputs: None
+// Return:  A string of all the access types, enclosed in
+//              parentheses and separated by semicolons
+string access_type_mask_to_string(unsigned long long mask);
+
+// Intro:   Formats a time as the UTC time and date string used in the
+//              audit output
+// Inputs:  system_time : the time to format
+// Outputs: None
+// Return:  A string containing the UTC time and date
+string UTC_time_date_to_string(time_t system_time);
+
+// Intro:   Forms one line of audit output from the pieces of an event
+// Inputs:  filepath : the path of the accessed file
+//          time_ns : the time of the access, in nanoseconds since the
+//              epoch
+//          username : the user owning the accessing process
+//          pid : the pid of the accessing process
+//          mask : the fanotify event access type mask
+//          repeat_count : the number of events coalesced into the line, or
+//              0 to leave out the count column
+//          iso8601 : see append_UTC_time_date
+// Outputs: None
+// Return:  The line, including its terminating newline
+string format_text_event(string_view filepath, uint64_t time_ns,
+                         string_view username, pid_t pid,
+                         unsigned long long mask, uint32_t repeat_count = 0,
+                         bool iso8601 = false);
+
+#endif
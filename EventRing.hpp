@@ -0,0 +1,136 @@
+#ifndef EVENTRING_H
+#define EVENTRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// A bounded lock-free multi-producer/multi-consumer ring of fixed-size
+//  records. Each cell carries a sequence number that tells producers and
+//  consumers whether it is free or filled for their current lap around the
+//  ring, so neither side ever takes a lock or waits on the other.
+template <typename T>
+class EventRing
+{
+    public:
+        // Intro:   Creates a ring with room for at least capacity records
+        // Inputs:  capacity : the minimum number of records the ring can
+        //              hold (rounded up to a power of two)
+        // Outputs: None
+        // Return:  N/A
+        explicit EventRing(size_t capacity)
+        {
+            size_t rounded_capacity = 2;
+            while (rounded_capacity < capacity)
+            {
+                rounded_capacity <<= 1;
+            }
+            index_mask = rounded_capacity - 1;
+            cells.reset(new Cell[rounded_capacity]);
+            for (size_t i = 0; i < rounded_capacity; i++)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+            enqueue_pos.store(0, std::memory_order_relaxed);
+            dequeue_pos.store(0, std::memory_order_relaxed);
+        }
+
+        // Intro:   Moves a record into the ring if there is room for it.
+        //              The record is left untouched when the ring is full,
+        //              so the caller can retry with it.
+        // Inputs:  record : the record to add
+        // Outputs: None
+        // Return:  false if the ring was full and nothing was added
+        bool push(T&& record)
+        {
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[pos & index_mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t lap = (intptr_t)sequence - (intptr_t)pos;
+                if (lap == 0)
+                {
+                    if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                 std::memory_order_relaxed))
+                    {
+                        cell.data = std::move(record);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (lap < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Intro:   Takes the oldest record out of the ring if there is one
+        // Inputs:  None
+        // Outputs: record : the record that was removed
+        // Return:  false if the ring was empty and record was not touched
+        bool pop(T& record)
+        {
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                Cell& cell = cells[pos & index_mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t lap = (intptr_t)sequence - (intptr_t)(pos + 1);
+                if (lap == 0)
+                {
+                    if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                                 std::memory_order_relaxed))
+                    {
+                        record = std::move(cell.data);
+                        cell.sequence.store(pos + index_mask + 1,
+                                            std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (lap < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Intro:   Checks whether any records are waiting in the ring. Only
+        //              a hint while producers and consumers are running.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  Is the ring empty?
+        bool empty() const
+        {
+            return enqueue_pos.load(std::memory_order_acquire) ==
+                   dequeue_pos.load(std::memory_order_acquire);
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        // The cells of the ring, a power of two of them
+        std::unique_ptr<Cell[]> cells;
+        // Number of cells minus one, for wrapping positions onto cells
+        size_t index_mask;
+        // Next position to fill and next position to drain, kept on separate
+        //  cache lines so the reader and the writers don't fight over them
+        alignas(64) std::atomic<size_t> enqueue_pos;
+        alignas(64) std::atomic<size_t> dequeue_pos;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "FileHandleCache.hpp"
+#include "PathTable.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+using namespace std;
+
+const chrono::milliseconds FileHandleCache::revalidate_interval(1000);
+
+// -- PUBLIC -------------------------------------------------------------------
+
+FileHandleCache::FileHandleCache()
+{
+    capacity = 65536;
+    hits = 0;
+    misses = 0;
+}
+
+FileHandleCache::~FileHandleCache()
+{
+    for (auto mount_directory = mount_directories.begin(); 
+         mount_directory != mount_directories.end(); 
+         mount_directory++)
+    {
+        close(mount_directory->second.fd);
+    }
+}
+
+// Keep the directory open, along with its filesystem and its path as the
+// kernel reads it back
+bool FileHandleCache::add_directory(const string& directory)
+{
+    if (mount_directories.count(directory))
+    {
+        return true;
+    }
+    // open_by_handle_at() rejects O_PATH descriptors as its mount_fd
+    MountDirectory mount_directory;
+    mount_directory.fd = open(directory.c_str(), 
+                              O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (mount_directory.fd == -1)
+    {
+        return false;
+    }
+    struct statfs filesystem_info;
+    if (fstatfs(mount_directory.fd, &filesystem_info) == -1 ||
+        !read_fd_path(mount_directory.fd, mount_directory.path))
+    {
+        int saved_errno = errno;
+        close(mount_directory.fd);
+        errno = saved_errno;
+        return false;
+    }
+    __kernel_fsid_t fsid;
+    memcpy(&fsid, &filesystem_info.f_fsid, sizeof(fsid));
+    mount_directory.fsid = fsid_key(fsid);
+    mount_directories[directory] = mount_directory;
+    return true;
+}
+
+void FileHandleCache::remove_directory(const string& directory)
+{
+    auto mount_directory = mount_directories.find(directory);
+    if (mount_directory == mount_directories.end())
+    {
+        return;
+    }
+    close(mount_directory->second.fd);
+    mount_directories.erase(mount_directory);
+    entries.clear();
+    lru_keys.clear();
+}
+
+// Look the handle up in the cache, resolving it on a miss, then add the
+// entry name that comes after a directory handle
+bool FileHandleCache::resolve(const struct fanotify_event_info_fid * fid,
+                              string& path)
+{
+    struct file_handle * handle = (struct file_handle *) fid->handle;
+    const char * name = NULL;
+    if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+    {
+        name = (const char *) (handle->f_handle + handle->handle_bytes);
+    }
+
+    lookup_key.assign((const char *) &fid->fsid, sizeof(fid->fsid));
+    lookup_key.append((const char *) &handle->handle_type, 
+                      sizeof(handle->handle_type));
+    lookup_key.append((const char *) handle->f_handle, handle->handle_bytes);
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    auto found = entries.find(lookup_key);
+    if (found != entries.end() && 
+        now - found->second.resolved_time < revalidate_interval)
+    {
+        hits++;
+        lru_keys.splice(lru_keys.begin(), lru_keys, 
+                        found->second.lru_position);
+    }
+    else
+    {
+        misses++;
+        string resolved_path;
+        if (!open_handle_path(fid->fsid, handle, resolved_path))
+        {
+            return false;
+        }
+        if (found == entries.end())
+        {
+            while (entries.size() >= capacity)
+            {
+                entries.erase(lru_keys.back());
+                lru_keys.pop_back();
+            }
+            lru_keys.push_front(lookup_key);
+            found = entries.emplace(lookup_key, HandleEntry()).first;
+            found->second.lru_position = lru_keys.begin();
+        }
+        else
+        {
+            lru_keys.splice(lru_keys.begin(), lru_keys, 
+                            found->second.lru_position);
+        }
+        found->second.path = resolved_path;
+        found->second.resolved_time = now;
+    }
+
+    path = found->second.path;
+    // Events on a directory itself come with no name or with "."
+    if (name && name[0] != '\0' && strcmp(name, ".") != 0)
+    {
+        path += '/';
+        path += name;
+    }
+    return true;
+}
+
+uint64_t FileHandleCache::get_hits() const
+{
+    return hits;
+}
+
+uint64_t FileHandleCache::get_misses() const
+{
+    return misses;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+uint64_t FileHandleCache::fsid_key(const __kernel_fsid_t& fsid)
+{
+    return ((uint64_t) (uint32_t) fsid.val[0] << 32) | (uint32_t) fsid.val[1];
+}
+
+bool FileHandleCache::is_in_subtree(const string& path, 
+                                    const string& directory)
+{
+    if (path.compare(0, directory.size(), directory) != 0)
+    {
+        return false;
+    }
+    return path.size() == directory.size() || directory == "/" ||
+           path[directory.size()] == '/';
+}
+
+// Open the handle relative to each directory on its filesystem and read the
+// path back from the /proc/self/fd subsystem. A handle opened through a
+// bind mount it isn't under still opens, but reads back as a path that is
+// disconnected from (or wrong for) the mount, so keep looking.
+bool FileHandleCache::open_handle_path(const __kernel_fsid_t& fsid,
+                                       struct file_handle * handle, 
+                                       string& path)
+{
+    uint64_t handle_fsid = fsid_key(fsid);
+    bool opened = false;
+    int saved_errno = ENODEV;
+    string candidate_path;
+    for (auto mount_directory = mount_directories.begin();
+         mount_directory != mount_directories.end();
+         mount_directory++)
+    {
+        if (mount_directory->second.fsid != handle_fsid)
+        {
+            continue;
+        }
+        int handle_fd = open_by_handle_at(mount_directory->second.fd, handle,
+                                          O_PATH | O_CLOEXEC);
+        if (handle_fd == -1)
+        {
+            saved_errno = errno;
+            continue;
+        }
+        bool path_read = read_fd_path(handle_fd, candidate_path);
+        if (!path_read)
+        {
+            saved_errno = errno;
+        }
+        close(handle_fd);
+        if (!path_read)
+        {
+            continue;
+        }
+        if (is_in_subtree(candidate_path, mount_directory->second.path))
+        {
+            path.swap(candidate_path);
+            return true;
+        }
+        if (!opened)
+        {
+            path = candidate_path;
+            opened = true;
+        }
+    }
+    errno = saved_errno;
+    return opened;
+}
@@ -0,0 +1,124 @@
+#ifndef FILEHANDLECACHE_H
+#define FILEHANDLECACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <list>
+#include <map>
+#include <string>
+#include <sys/fanotify.h>
+#include <unordered_map>
+
+using namespace std;
+
+// Resolves the file handles reported by a fanotify group initialized with
+//  FAN_REPORT_FID/FAN_REPORT_DFID_NAME back into paths. Resolving a handle
+//  costs an open_by_handle_at() and a readlink(), so resolved paths are
+//  cached by fsid + handle; with directory handles one entry serves every
+//  file in that directory. Handles survive renames, so cached paths are
+//  re-resolved after a while to keep renamed directories from showing up
+//  under their old name for long. A handle is opened through one of the
+//  monitored directories on its filesystem, the one whose subtree the path
+//  turns out to be in, since with a bind mount per directory a file under
+//  another directory isn't reachable from that directory's mount. Not
+//  thread-safe: meant to be used by the reader thread only.
+class FileHandleCache
+{
+    public:
+        FileHandleCache();
+        ~FileHandleCache();
+
+        // Intro:   Keeps a monitored directory open, since
+        //              open_by_handle_at() needs a descriptor on the mount
+        //              of the files it opens
+        // Inputs:  directory : a monitored directory
+        // Outputs: None
+        // Return:  false (with errno set) if the directory can't be opened
+        bool add_directory(const string& directory);
+
+        // Intro:   Closes a directory that is no longer monitored (before
+        //              it is unmounted), and forgets the paths resolved so
+        //              far, since some of them went through it
+        // Inputs:  directory : the directory given to add_directory
+        // Outputs: None
+        // Return:  void
+        void remove_directory(const string& directory);
+
+        // Intro:   Finds the path of the file an FID event is about
+        // Inputs:  fid : the fid info record following the event metadata
+        // Outputs: path : the full path of the file (or directory) the event
+        //              happened on
+        // Return:  false (with errno set) if the handle can't be resolved
+        //              (e.g. the file is already gone, is on an unknown
+        //              filesystem or has a path too long for the kernel
+        //              to spell out)
+        bool resolve(const struct fanotify_event_info_fid * fid, string& path);
+
+        // Handles answered from the cache, and handles that were resolved
+        uint64_t get_hits() const;
+        uint64_t get_misses() const;
+
+    private:
+        struct HandleEntry
+        {
+            string path;
+            chrono::steady_clock::time_point resolved_time;
+            list<string>::iterator lru_position;
+        };
+
+        // How long a resolved path is trusted before resolving it again
+        static const chrono::milliseconds revalidate_interval;
+
+        size_t capacity;
+        // Resolved paths keyed by fsid + handle type + handle bytes
+        unordered_map<string, HandleEntry> entries;
+        // Cached keys, most recently used first
+        list<string> lru_keys;
+        struct MountDirectory
+        {
+            int fd;
+            // fsid_key of the directory's filesystem
+            uint64_t fsid;
+            // The directory as the kernel spells it, for the subtree check
+            string path;
+        };
+
+        // Open monitored directories, keyed by the name they were added by
+        map<string, MountDirectory> mount_directories;
+        // Reused between lookups so building a key doesn't allocate
+        string lookup_key;
+
+        uint64_t hits;
+        uint64_t misses;
+
+        FileHandleCache(const FileHandleCache&);
+        FileHandleCache& operator=(const FileHandleCache&);
+
+        // Intro:   Turns an fsid into a mount_fds key
+        // Inputs:  fsid : the filesystem id reported by fanotify or statfs
+        // Outputs: None
+        // Return:  The fsid packed into 64 bits
+        static uint64_t fsid_key(const __kernel_fsid_t& fsid);
+
+        // Intro:   Checks whether a path is a directory or beneath it
+        // Inputs:  path : the path
+        //          directory : the directory
+        // Outputs: None
+        // Return:  Is path in directory's subtree?
+        static bool is_in_subtree(const string& path, const string& directory);
+
+        // Intro:   Opens a handle through each monitored directory on its
+        //              filesystem until the path read back is in that
+        //              directory's subtree. Does not touch the cache.
+        // Inputs:  fsid : the filesystem the handle belongs to
+        //          handle : the handle to open
+        // Outputs: path : the path of the handle (through the first
+        //              directory that could open it, if it's in none of
+        //              their subtrees, as with filesystem marks)
+        // Return:  false (with errno set) if the handle can't be opened
+        bool open_handle_path(const __kernel_fsid_t& fsid,
+                              struct file_handle * handle, string& path);
+};
+
+#endif
@@ -13,16 +13,20 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "AuditorOptions.hpp"
 #include "DirectoryListAuditor.hpp"
 
 using namespace std;
 
-// TODO It would be best to make this user-configurable with an argument
-const size_t max_mem_bytes = 4096;
-
 // Builds the bitmask for the event types the user would like to audit
 uint64_t build_mask_from_args(int argc, char * argv[]);
 
+// Builds the auditor tunables from the --name=value options
+AuditorOptions build_options_from_args(int argc, char * argv[]);
+
+// Is the argument a --name=value tuning option rather than an event type?
+bool is_tuning_option(const string& arg);
+
 int main(int argc, char * argv[])
 {
     // TODO Code Review Discussion Point:
@@ -45,6 +49,77 @@ int main(int argc, char * argv[])
         cout << "       --OPEN_PERM" << endl;
         cout << "       --ACCESS_PERM" << endl;
         cout << "       --ALL" << endl;
+        cout << "   and any of the following tuning options" << endl;
+        cout << "       --event-buffer-bytes=N  size of the buffer events are" << endl;
+        cout << "                           read into (default 4096)" << endl;
+        cout << "       --max-event-buffer-bytes=N  largest the buffer grows" << endl;
+        cout << "                           to under bursts (default 1MiB)" << endl;
+        cout << "       --writer-threads=N  threads formatting and writing" << endl;
+        cout << "                           events (default 1)" << endl;
+        cout << "       --ring-size=N       events buffered between reading" << endl;
+        cout << "                           and writing (default 65536)" << endl;
+        cout << "       --drop-when-full=1  drop events instead of waiting" << endl;
+        cout << "                           when the buffer is full" << endl;
+        cout << "       --reader-shards=N   split the directories over N" << endl;
+        cout << "                           fanotify groups, each with its" << endl;
+        cout << "                           own reader and writers (default 1)" << endl;
+        cout << "       --pin-readers=0     don't pin the shards' readers" << endl;
+        cout << "                           to CPUs" << endl;
+        cout << "       --shard-output=merged|split  write all shards to the" << endl;
+        cout << "                           audit output, or each to" << endl;
+        cout << "                           AUDIT_OUTPUT_FILENAME.N" << endl;
+        cout << "       --batch-bytes=N     buffer up to N bytes of audit" << endl;
+        cout << "                           output per write (default 0," << endl;
+        cout << "                           write every event on its own)" << endl;
+        cout << "       --commit-latency-ms=N  longest a buffered event waits" << endl;
+        cout << "                           to be written (default 10)" << endl;
+        cout << "       --fdatasync=1       sync the audit output file after" << endl;
+        cout << "                           every write" << endl;
+        cout << "       --unlimited-queue=1 never let the kernel's event" << endl;
+        cout << "                           queue overflow (can use a lot of" << endl;
+        cout << "                           memory while dirmon falls behind)" << endl;
+        cout << "       --io-uring-buffers=N  queue writes on an io_uring" << endl;
+        cout << "                           with N buffers (default 0, off)" << endl;
+        cout << "       --coalesce-ms=N     merge a process's events on a file" << endl;
+        cout << "                           within N ms into one line, with" << endl;
+        cout << "                           the number of events merged" << endl;
+        cout << "       --user-cache-size=N number of pids to remember the" << endl;
+        cout << "                           owning user of (default 4096)" << endl;
+        cout << "       --path-cache-size=N number of paths to keep interned" << endl;
+        cout << "                           between events (default 65536)" << endl;
+        cout << "       --report-fid=1      get non-permission events as file" << endl;
+        cout << "                           handles instead of open files" << endl;
+        cout << "       --format=binary     write the audit output in the" << endl;
+        cout << "                           compact binary format (read it" << endl;
+        cout << "                           with dirmon-decode)" << endl;
+        cout << "       --time-format=iso8601  write event times as ISO 8601" << endl;
+        cout << "                           with nanoseconds" << endl;
+        cout << "       --rotate-bytes=N    start a new audit output segment" << endl;
+        cout << "                           after N bytes" << endl;
+        cout << "       --rotate-seconds=N  start a new audit output segment" << endl;
+        cout << "                           after N seconds" << endl;
+        cout << "       --compress-segments=1  gzip closed segments in the" << endl;
+        cout << "                           background" << endl;
+        cout << "       --mark-filesystem=1 mark the filesystems holding the" << endl;
+        cout << "                           directories instead of bind" << endl;
+        cout << "                           mounting each directory" << endl;
+        cout << "       --policy=FILE       allow or deny permission events" << endl;
+        cout << "                           by the rules in FILE (reloaded" << endl;
+        cout << "                           when it changes)" << endl;
+        cout << "       --filter=FILE       include or exclude events by the" << endl;
+        cout << "                           rules in FILE (reloaded when it" << endl;
+        cout << "                           changes)" << endl;
+        cout << "       --permission-deadline-ms=N  answer permission events" << endl;
+        cout << "                           dirmon hasn't answered after N" << endl;
+        cout << "                           ms on a watchdog thread" << endl;
+        cout << "       --deadline-response=allow|deny  the watchdog's" << endl;
+        cout << "                           answer (default allow)" << endl;
+        cout << "       --metrics-file=FILE write Prometheus metrics to FILE" << endl;
+        cout << "                           every 10 seconds" << endl;
+        cout << "       --metrics-interval-ms=N  write the metrics file every" << endl;
+        cout << "                           N ms instead" << endl;
+        cout << "       --metrics-socket=PATH  serve Prometheus metrics on a" << endl;
+        cout << "                           Unix socket at PATH" << endl;
         return 0;
     }
 
@@ -58,6 +133,7 @@ int main(int argc, char * argv[])
     
     // Build the bitmask for the event types the user would like to audit
     uint64_t event_types_mask = build_mask_from_args(argc,argv);
+    AuditorOptions options = build_options_from_args(argc, argv);
     
     // Get the directory list and output filenames from the last two arguments
     string dir_list_filename(argv[argc-2]);
@@ -95,33 +171,20 @@ int main(int argc, char * argv[])
     // Prepare the auditor to be ready for recording the mask's event types
     // for the given directory list of directories to the output file given    
     auditor->initialize(event_types_mask, dir_list_filename,
-                        audit_output_filename);
-
-    // TODO Code Review Discussion Point:
-    //      An alternative way of doing auditing could be a
-    //      wait_for_event() or read_event() method that would only
-    //      wait for a single event. This would give the user more control
-    //      over their process, and decide whether they want to loop ininitely
-    //      through event collection or just collect events at their own
-    //      discretion. Furthermore, it would allow them to do other
-    //      activities alongside the auditing (
-    //      e.g.
-    //      unsigned events_read = 0;
-    //      for (;;) {
-    //          auditor->read_event();
-    //          cout << "Read an event! Check " << audit_output_filename << endl;
-    //          if (events_read > 500) {
-    //              backup_to_server(audit_output_filename);
-    //              events_read = 0;
-    //          }  
-    //      }
+                        audit_output_filename, options);
 
     // Continuously audit to the configured audit output file 
     // for configured activities within the configured
-    // directories (the program will never return from this call, and
-    // depends on a signal handler to terminate and clean up everything)
-    auditor->audit_activity(max_mem_bytes);
-    
+    // directories, until SIGINT or SIGTERM asks us to stop. To do other
+    // work alongside the auditing, drive it one step at a time instead
+    // e.g.
+    //      auditor->start_auditing(options.event_buffer_bytes);
+    //      while (auditor->read_event(1000)) {
+    //          backup_to_server(audit_output_filename);
+    //      }
+    //      auditor->stop_auditing();
+    return auditor->audit_activity(options.event_buffer_bytes);
+
 }
 
 // TODO Possible Improvement:
@@ -132,54 +195,220 @@ uint64_t build_mask_from_args(int argc, char * argv[])
 {    
     // Include ON_DIR and ON_CHILD by default
     uint64_t event_types_mask = FAN_ONDIR | FAN_EVENT_ON_CHILD; 
-    // Options were not included, so everything will be monitored    
-    if (argc == 3)
+    bool event_types_given = false;
+    // Options are parsed if included; tuning options are left for
+    // build_options_from_args
+    for (int i = 1; i < argc-2; i++)
+    {
+        string current_arg(argv[i]);
+        if (is_tuning_option(current_arg)) {
+            continue;
+        }
+        event_types_given = true;
+        if (current_arg == "--ACCESS") {
+            event_types_mask |= FAN_ACCESS;
+        }
+        else if (current_arg == "--MODIFY") {
+            event_types_mask |= FAN_MODIFY;
+        }
+        else if (current_arg == "--CLOSE_WRITE") {
+            event_types_mask |= FAN_CLOSE_WRITE;
+        }
+        else if (current_arg == "--CLOSE_NOWRITE") {
+            event_types_mask |= FAN_CLOSE_NOWRITE;
+        }
+        else if (current_arg == "--OPEN") {
+            event_types_mask |= FAN_OPEN;
+        }
+        else if (current_arg == "--OPEN_PERM") {
+            event_types_mask |= FAN_OPEN_PERM;
+        }
+        else if (current_arg == "--ACCESS_PERM") {
+            event_types_mask |= FAN_ACCESS_PERM;
+        }
+        else if (current_arg == "--ALL") {
+            event_types_mask |= FAN_ACCESS | FAN_MODIFY |
+                   FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE |
+                   FAN_OPEN |
+                   FAN_OPEN_PERM | FAN_ACCESS_PERM;
+            // FAN_Q_OVERFLOW can't be marked; the kernel always reports
+            // overflows and dirmon always audits them
+        }
+        else {
+            cerr << "dirmon: Invalid option '" << argv[i] << "'" << endl;
+            cerr << "dirmon: use diraudit --help for list of options" 
+                 << endl;
+            exit(1);
+        }
+    }
+    // Event type options were not included, so everything will be monitored    
+    if (!event_types_given)
     {
         event_types_mask |= FAN_ACCESS | FAN_MODIFY |
                            FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE |
                            FAN_OPEN |
                            FAN_OPEN_PERM | FAN_ACCESS_PERM;
     }
-    // Options were included, so they need to be parsed    
-    else if (argc > 3)
+    return event_types_mask;
+}
+
+// Tuning options all look like --name=value, event types never have a value
+bool is_tuning_option(const string& arg)
+{
+    return arg.compare(0, 2, "--") == 0 && arg.find('=') != string::npos;
+}
+
+// Build the auditor tunables from the --name=value options, leaving
+// defaults in place for anything not given
+AuditorOptions build_options_from_args(int argc, char * argv[])
+{
+    AuditorOptions options;
+    for (int i = 1; i < argc-2; i++)
     {
-        for (int i = 1; i < argc-2; i++)
+        string current_arg(argv[i]);
+        if (!is_tuning_option(current_arg))
         {
-            string current_arg(argv[i]);
-            if (current_arg == "--ACCESS") {
-                event_types_mask |= FAN_ACCESS;
-            }
-            else if (current_arg == "--MODIFY") {
-                event_types_mask |= FAN_MODIFY;
-            }
-            else if (current_arg == "--CLOSE_WRITE") {
-                event_types_mask |= FAN_CLOSE_WRITE;
-            }
-            else if (current_arg == "--CLOSE_NOWRITE") {
-                event_types_mask |= FAN_CLOSE_NOWRITE;
-            }
-            else if (current_arg == "--OPEN") {
-                event_types_mask |= FAN_OPEN;
-            }
-            else if (current_arg == "--OPEN_PERM") {
-                event_types_mask |= FAN_OPEN_PERM;
+            continue;
+        }
+        size_t equals_pos = current_arg.find('=');
+        string name = current_arg.substr(0, equals_pos);
+        string value = current_arg.substr(equals_pos + 1);
+
+        // Options with word values
+        if (name == "--format") {
+            if (value != "text" && value != "binary") {
+                cerr << "dirmon: Invalid value in option '" << argv[i] 
+                     << "'" << endl;
+                exit(1);
             }
-            else if (current_arg == "--ACCESS_PERM") {
-                event_types_mask |= FAN_ACCESS_PERM;
+            options.binary_format = value == "binary";
+            continue;
+        }
+        if (name == "--time-format") {
+            if (value != "asctime" && value != "iso8601") {
+                cerr << "dirmon: Invalid value in option '" << argv[i] 
+                     << "'" << endl;
+                exit(1);
             }
-            else if (current_arg == "--ALL") {
-                event_types_mask |= FAN_ACCESS | FAN_MODIFY |
-                       FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE |
-                       FAN_OPEN | // TODO Possible Improvement: FAN_Q_OVERFLOW |
-                       FAN_OPEN_PERM | FAN_ACCESS_PERM;
+            options.iso8601_time = value == "iso8601";
+            continue;
+        }
+        if (name == "--policy") {
+            options.policy_filename = value;
+            continue;
+        }
+        if (name == "--filter") {
+            options.filter_filename = value;
+            continue;
+        }
+        if (name == "--metrics-file") {
+            options.metrics_filename = value;
+            continue;
+        }
+        if (name == "--metrics-socket") {
+            options.metrics_socket = value;
+            continue;
+        }
+        if (name == "--shard-output") {
+            if (value != "merged" && value != "split") {
+                cerr << "dirmon: Invalid value in option '" << argv[i] 
+                     << "'" << endl;
+                exit(1);
             }
-            else {
-                cerr << "dirmon: Invalid option '" << argv[i] << "'" << endl;
-                cerr << "dirmon: use diraudit --help for list of options" 
-                     << endl;
+            options.split_shard_output = value == "split";
+            continue;
+        }
+        if (name == "--deadline-response") {
+            if (value != "allow" && value != "deny") {
+                cerr << "dirmon: Invalid value in option '" << argv[i] 
+                     << "'" << endl;
                 exit(1);
             }
+            options.deny_on_deadline = value == "deny";
+            continue;
+        }
+
+        // Options with number values
+        char * value_end = NULL;
+        unsigned long long number = strtoull(value.c_str(), &value_end, 10);
+        if (value.empty() || *value_end != '\0')
+        {
+            cerr << "dirmon: Invalid value in option '" << argv[i] << "'" << endl;
+            exit(1);
+        }
+
+        if (name == "--event-buffer-bytes" && number > 0) {
+            options.event_buffer_bytes = number;
+        }
+        else if (name == "--max-event-buffer-bytes" && number > 0) {
+            options.max_event_buffer_bytes = number;
+        }
+        else if (name == "--writer-threads" && number > 0) {
+            options.writer_threads = number;
+        }
+        else if (name == "--ring-size" && number > 0) {
+            options.ring_capacity = number;
+        }
+        else if (name == "--drop-when-full") {
+            options.drop_when_full = number != 0;
+        }
+        else if (name == "--reader-shards" && number > 0) {
+            options.reader_shards = number;
+        }
+        else if (name == "--pin-readers") {
+            options.pin_readers = number != 0;
+        }
+        else if (name == "--batch-bytes") {
+            options.batch_bytes = number;
+        }
+        else if (name == "--commit-latency-ms") {
+            options.commit_latency = chrono::milliseconds(number);
+        }
+        else if (name == "--fdatasync") {
+            options.sync_on_commit = number != 0;
+        }
+        else if (name == "--unlimited-queue") {
+            options.unlimited_queue = number != 0;
+        }
+        else if (name == "--io-uring-buffers") {
+            options.io_uring_buffers = number;
+        }
+        else if (name == "--coalesce-ms") {
+            options.coalesce_window = chrono::milliseconds(number);
+        }
+        else if (name == "--user-cache-size" && number > 0) {
+            options.user_cache_size = number;
+        }
+        else if (name == "--path-cache-size") {
+            options.path_cache_size = number;
+        }
+        else if (name == "--report-fid") {
+            options.report_fid = number != 0;
+        }
+        else if (name == "--rotate-bytes") {
+            options.rotate_bytes = number;
+        }
+        else if (name == "--rotate-seconds") {
+            options.rotate_interval = chrono::seconds(number);
+        }
+        else if (name == "--compress-segments") {
+            options.compress_segments = number != 0;
+        }
+        else if (name == "--mark-filesystem") {
+            options.mark_filesystem = number != 0;
+        }
+        else if (name == "--permission-deadline-ms") {
+            options.permission_deadline = chrono::milliseconds(number);
+        }
+        else if (name == "--metrics-interval-ms" && number > 0) {
+            options.metrics_interval = chrono::milliseconds(number);
+        }
+        else {
+            cerr << "dirmon: Invalid option '" << argv[i] << "'" << endl;
+            cerr << "dirmon: use diraudit --help for list of options" 
+                 << endl;
+            exit(1);
         }
     }
-    return event_types_mask;
-}
\ No newline at end of file
+    return options;
+}
@@ -0,0 +1,118 @@
+#include "LatencyHistogram.hpp"
+
+using namespace std;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        buckets[bucket] = 0;
+    }
+}
+
+// The bucket is the number of significant bits in the microsecond count
+void LatencyHistogram::record(chrono::nanoseconds latency)
+{
+    uint64_t latency_us = latency.count() > 0 ? latency.count() / 1000 : 0;
+    unsigned int bucket = latency_us ? 64 - __builtin_clzll(latency_us) : 0;
+    if (bucket >= NUM_BUCKETS)
+    {
+        bucket = NUM_BUCKETS - 1;
+    }
+    buckets[bucket].store(buckets[bucket].load(memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        buckets[bucket].store(get_bucket_count(bucket) + 
+                              other.get_bucket_count(bucket),
+                              memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::get_bucket_count(unsigned int bucket) const
+{
+    return buckets[bucket].load(memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::get_bucket_limit_us(unsigned int bucket)
+{
+    return bucket < NUM_BUCKETS - 1 ? (uint64_t) 1 << bucket : 0;
+}
+
+uint64_t LatencyHistogram::get_count() const
+{
+    uint64_t count = 0;
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        count += get_bucket_count(bucket);
+    }
+    return count;
+}
+
+// Walk the buckets until the requested share of the latencies is covered
+uint64_t LatencyHistogram::get_percentile_us(double fraction) const
+{
+    uint64_t count = get_count();
+    if (count == 0)
+    {
+        return 0;
+    }
+    uint64_t covered = 0;
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS - 1; bucket++)
+    {
+        covered += get_bucket_count(bucket);
+        if (covered >= fraction * count)
+        {
+            return get_bucket_limit_us(bucket);
+        }
+    }
+    // Slower than the last bounded bucket, which says nothing of how slow
+    return UINT64_MAX;
+}
+
+string LatencyHistogram::get_percentile_string(double fraction) const
+{
+    uint64_t percentile_us = get_percentile_us(fraction);
+    if (percentile_us == UINT64_MAX)
+    {
+        return ">=" + std::to_string(get_bucket_limit_us(NUM_BUCKETS - 2)) +
+               "us";
+    }
+    return "<" + std::to_string(percentile_us) + "us";
+}
+
+string LatencyHistogram::to_string() const
+{
+    string histogram;
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        uint64_t bucket_count = get_bucket_count(bucket);
+        if (bucket_count == 0)
+        {
+            continue;
+        }
+        if (!histogram.empty())
+        {
+            histogram += ' ';
+        }
+        if (bucket < NUM_BUCKETS - 1)
+        {
+            histogram += "<" + std::to_string(get_bucket_limit_us(bucket));
+        }
+        else
+        {
+            histogram += ">=" + 
+                std::to_string(get_bucket_limit_us(NUM_BUCKETS - 2));
+        }
+        histogram += "us:" + std::to_string(bucket_count);
+    }
+    return histogram.empty() ? "empty" : histogram;
+}
+
+// -----------------------------------------------------------------------------
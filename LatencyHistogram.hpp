@@ -0,0 +1,85 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Counts latencies into fixed power-of-two buckets of microseconds (under
+//  1us, under 2us, under 4us, ... and one bucket for everything slower), so
+//  recording is a couple of instructions and an increment no matter how
+//  many latencies are recorded. Only one thread may record into a
+//  histogram (AuditMetrics gives every thread its own), which keeps the
+//  increment free of locked instructions; any thread may read it, and
+//  histograms add up bucket by bucket.
+class LatencyHistogram
+{
+    public:
+        // Buckets 0 to NUM_BUCKETS-2 hold latencies under 2^i microseconds,
+        //  the last bucket holds everything else (over ~1s)
+        static const unsigned int NUM_BUCKETS = 22;
+
+        LatencyHistogram();
+
+        // Intro:   Counts one latency. Only from the thread that owns the
+        //              histogram.
+        // Inputs:  latency : the latency to count
+        // Outputs: None
+        // Return:  void
+        void record(chrono::nanoseconds latency);
+
+        // Intro:   Adds the counts of another histogram to this one, which
+        //              only the calling thread may be recording into
+        // Inputs:  other : the histogram to add
+        // Outputs: None
+        // Return:  void
+        void add(const LatencyHistogram& other);
+
+        // Intro:   Gets the number of latencies counted in a bucket
+        // Inputs:  bucket : the bucket index
+        // Outputs: None
+        // Return:  The count
+        uint64_t get_bucket_count(unsigned int bucket) const;
+
+        // Intro:   Gets the upper bound of a bucket
+        // Inputs:  bucket : the bucket index
+        // Outputs: None
+        // Return:  The bucket's limit in microseconds, or 0 for the last,
+        //              unbounded bucket
+        static uint64_t get_bucket_limit_us(unsigned int bucket);
+
+        // Total number of latencies counted
+        uint64_t get_count() const;
+
+        // Intro:   Estimates a percentile from the buckets
+        // Inputs:  fraction : e.g. 0.99 for the 99th percentile
+        // Outputs: None
+        // Return:  The upper bound (in microseconds) of the bucket the
+        //              percentile falls in, 0 if nothing was counted, or
+        //              UINT64_MAX if it falls in the last, unbounded bucket
+        uint64_t get_percentile_us(double fraction) const;
+
+        // Intro:   Formats a percentile for a log line
+        // Inputs:  fraction : e.g. 0.99 for the 99th percentile
+        // Outputs: None
+        // Return:  e.g. "<64us", or ">=1048576us" if it falls in the last,
+        //              unbounded bucket
+        string get_percentile_string(double fraction) const;
+
+        // Intro:   Formats the non-empty buckets for a log line
+        // Inputs:  None
+        // Outputs: None
+        // Return:  e.g. "<1us:10 <2us:3 >=1048576us:1"
+        string to_string() const;
+
+    private:
+        atomic<uint64_t> buckets[NUM_BUCKETS];
+
+        LatencyHistogram(const LatencyHistogram&);
+        LatencyHistogram& operator=(const LatencyHistogram&);
+};
+
+#endif
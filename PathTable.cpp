@@ -0,0 +1,395 @@
+#include "PathTable.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+// readlink() cuts a path that doesn't fit short without saying so, so a
+// path filling the whole buffer may be longer; retry with twice the room
+bool read_fd_path(int fd, string& path)
+{
+    char fd_path[32];
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+    path.resize(max<size_t>(path.capacity(), 256));
+    for (;;)
+    {
+        ssize_t num_chars_retrieved = readlink(fd_path, &path[0], 
+                                               path.size());
+        if (num_chars_retrieved == -1)
+        {
+            path.clear();
+            return false;
+        }
+        if ((size_t) num_chars_retrieved < path.size())
+        {
+            path.resize(num_chars_retrieved);
+            return true;
+        }
+        path.resize(path.size() * 2);
+    }
+}
+
+atomic<uint32_t> PathTable::next_serial(1);
+thread_local PathTable::FrontCacheSlot 
+    PathTable::front_cache[PathTable::FRONT_CACHE_SETS][2];
+thread_local PathTable::UncountedHits PathTable::uncounted_hits;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+PathTable::PathTable(unsigned int num_stripes)
+{
+    this->num_stripes = 1;
+    stripe_bits = 0;
+    while (this->num_stripes < min(num_stripes, (unsigned int) MAX_STRIPES))
+    {
+        this->num_stripes <<= 1;
+        stripe_bits++;
+    }
+    serial = next_serial++;
+    stripes.reset(new Stripe[this->num_stripes]);
+    set_capacity(65536);
+}
+
+// The oversized paths are the only storage the arenas don't own
+PathTable::~PathTable()
+{
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        Stripe& stripe = stripes[index];
+        for (auto entry = stripe.ids.begin(); entry != stripe.ids.end(); 
+             entry++)
+        {
+            if (get_size_class(entry->second->length) == NUM_SIZE_CLASSES)
+            {
+                delete[] entry->second->storage;
+            }
+        }
+    }
+}
+
+// Round each stripe's share up, so a capacity of at least 1 keeps at least
+// one path in every stripe
+void PathTable::set_capacity(size_t capacity)
+{
+    size_t stripe_capacity = (capacity + num_stripes - 1) / num_stripes;
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        Stripe& stripe = stripes[index];
+        lock_guard<mutex> lock(stripe.stripe_mutex);
+        stripe.capacity = stripe_capacity;
+        while (stripe.ids.size() > stripe.capacity && evict_one(stripe))
+        {
+        }
+    }
+}
+
+// A path this thread interned lately is taken from its front cache without
+// a lock or even hashing the whole path. Anything else is looked up in its
+// stripe, copied into a block of the stripe if it's new, and put in the
+// front cache for next time.
+PathRef PathTable::intern(string_view path)
+{
+    uint64_t sample = sample_path(path);
+    uint32_t sample_tag = sample >> 32;
+    FrontCacheSlot * set = front_cache[sample & (FRONT_CACHE_SETS - 1)];
+    PathRef reference;
+    for (int way = 0; way < 2; way++)
+    {
+        if (set[way].table_serial == serial && 
+            set[way].sample_tag == sample_tag &&
+            intern_cached(set[way], path, reference))
+        {
+            if (way == 1)
+            {
+                swap(set[0], set[1]);
+            }
+            count_cached_hit(stripes[reference.get_id() & (num_stripes - 1)]);
+            return reference;
+        }
+    }
+
+    uint32_t stripe_index = hash<string_view>()(path) & (num_stripes - 1);
+    Stripe& stripe = stripes[stripe_index];
+    lock_guard<mutex> lock(stripe.stripe_mutex);
+    Entry * entry;
+    auto found = stripe.ids.find(path);
+    if (found != stripe.ids.end())
+    {
+        stripe.hits.fetch_add(1, memory_order_relaxed);
+        entry = found->second;
+        // Nothing can evict it while we hold the lock
+        entry->state.fetch_add(1, memory_order_acquire);
+        entry->recently_used.store(true, memory_order_relaxed);
+    }
+    else
+    {
+        count(stripe.misses);
+        uint32_t index = allocate_entry(stripe);
+        entry = &stripe.entry(index);
+        entry->storage = allocate_block(stripe, path.size());
+        entry->length = path.size();
+        entry->id = index << stripe_bits | stripe_index;
+        memcpy(entry->storage, path.data(), path.size());
+        entry->recently_used.store(true, memory_order_relaxed);
+        // No front cache has this generation yet: it was bumped when the
+        // entry was last evicted
+        entry->state.fetch_add(1, memory_order_release);
+        stripe.ids.emplace(string_view(entry->storage, entry->length), 
+                           entry);
+        while (stripe.ids.size() > stripe.capacity && evict_one(stripe))
+        {
+        }
+    }
+    uint32_t generation = entry->state.load(memory_order_relaxed) >> 32;
+    set[1] = set[0];
+    set[0] = FrontCacheSlot{serial, sample_tag, generation, entry};
+    return PathRef(&entry->state, entry->id, generation,
+                   string_view(entry->storage, entry->length));
+}
+
+uint64_t PathTable::get_hits() const
+{
+    uint64_t hits = 0;
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        hits += stripes[index].hits.load(memory_order_relaxed);
+    }
+    return hits;
+}
+
+uint64_t PathTable::get_misses() const
+{
+    uint64_t misses = 0;
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        misses += stripes[index].misses.load(memory_order_relaxed);
+    }
+    return misses;
+}
+
+uint64_t PathTable::get_evictions() const
+{
+    uint64_t evictions = 0;
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        evictions += stripes[index].evictions.load(memory_order_relaxed);
+    }
+    return evictions;
+}
+
+size_t PathTable::get_path_count()
+{
+    size_t path_count = 0;
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        lock_guard<mutex> lock(stripes[index].stripe_mutex);
+        path_count += stripes[index].ids.size();
+    }
+    return path_count;
+}
+
+size_t PathTable::get_arena_bytes()
+{
+    size_t arena_bytes = 0;
+    for (unsigned int index = 0; index < num_stripes; index++)
+    {
+        Stripe& stripe = stripes[index];
+        lock_guard<mutex> lock(stripe.stripe_mutex);
+        arena_bytes += stripe.chunks.size() * CHUNK_SIZE + 
+                       stripe.oversized_bytes;
+    }
+    return arena_bytes;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Mix the length with the last two 8-byte words of the path and one from
+// its middle, where paths under the same directories tell apart. Good
+// enough to pick a front cache set, which the path is compared with
+// anyway, at a fraction of the cost of hashing every byte.
+uint64_t PathTable::sample_path(string_view path)
+{
+    uint64_t words[3] = {0, 0, 0};
+    size_t length = path.size();
+    if (length >= 16)
+    {
+        memcpy(&words[0], path.data() + length - 8, 8);
+        memcpy(&words[1], path.data() + length - 16, 8);
+        memcpy(&words[2], path.data() + (length - 8) / 2, 8);
+    }
+    else
+    {
+        memcpy(words, path.data(), length);
+    }
+    uint64_t sample = length * 0x9e3779b97f4a7c15ull;
+    for (uint64_t word : words)
+    {
+        sample = (sample ^ word) * 0xff51afd7ed558ccdull;
+        sample ^= sample >> 29;
+    }
+    return sample;
+}
+
+// Hits from the front cache add up in a thread-local count, which goes to
+// the table every HIT_COUNT_BATCH hits rather than on every one. The count
+// left over from another table (only seen by tests and benches, which
+// create more than one) is dropped.
+void PathTable::count_cached_hit(Stripe& stripe)
+{
+    if (uncounted_hits.table_serial != serial)
+    {
+        uncounted_hits.table_serial = serial;
+        uncounted_hits.count = 0;
+    }
+    if (++uncounted_hits.count == HIT_COUNT_BATCH)
+    {
+        stripe.hits.fetch_add(HIT_COUNT_BATCH, memory_order_relaxed);
+        uncounted_hits.count = 0;
+    }
+}
+
+// The reference only sticks if the entry is still in the generation the
+// slot saw, so it can't have been evicted (and its storage reused) since.
+// Taking it with fetch_add rather than compare-and-swap means a stale slot
+// holds a reference for a moment, which at worst makes an eviction pass
+// the entry over. The sample matched, but so may another path's, hence
+// the comparison.
+bool PathTable::intern_cached(const FrontCacheSlot& slot, string_view path,
+                              PathRef& reference)
+{
+    Entry& entry = *slot.entry;
+    uint64_t state = entry.state.fetch_add(1, memory_order_acquire);
+    if (state >> 32 != slot.generation ||
+        entry.length != path.size() ||
+        memcmp(entry.storage, path.data(), path.size()) != 0)
+    {
+        entry.state.fetch_sub(1, memory_order_release);
+        return false;
+    }
+    // Only written when it changes, to keep the cache line shared
+    if (!entry.recently_used.load(memory_order_relaxed))
+    {
+        entry.recently_used.store(true, memory_order_relaxed);
+    }
+    reference = PathRef(&entry.state, entry.id, slot.generation,
+                        string_view(entry.storage, entry.length));
+    return true;
+}
+
+unsigned int PathTable::get_size_class(size_t length)
+{
+    unsigned int size_class = 0;
+    while (size_class < NUM_SIZE_CLASSES && (16u << size_class) < length)
+    {
+        size_class++;
+    }
+    return size_class;
+}
+
+char * PathTable::allocate_block(Stripe& stripe, size_t length)
+{
+    unsigned int size_class = get_size_class(length);
+    if (size_class == NUM_SIZE_CLASSES)
+    {
+        stripe.oversized_bytes += length;
+        return new char[length];
+    }
+    if (!stripe.free_blocks[size_class].empty())
+    {
+        char * block = stripe.free_blocks[size_class].back();
+        stripe.free_blocks[size_class].pop_back();
+        return block;
+    }
+    size_t block_size = 16u << size_class;
+    if (stripe.chunk_used + block_size > CHUNK_SIZE)
+    {
+        // The rest of the old chunk is too small for this class; hand it
+        // out to the smaller classes rather than waste it
+        for (unsigned int smaller = size_class; smaller-- > 0;)
+        {
+            while (stripe.chunk_used + (16u << smaller) <= CHUNK_SIZE)
+            {
+                stripe.free_blocks[smaller].push_back(
+                    stripe.chunks.back().get() + stripe.chunk_used);
+                stripe.chunk_used += 16u << smaller;
+            }
+        }
+        stripe.chunks.emplace_back(new char[CHUNK_SIZE]);
+        stripe.chunk_used = 0;
+    }
+    char * block = stripe.chunks.back().get() + stripe.chunk_used;
+    stripe.chunk_used += block_size;
+    return block;
+}
+
+uint32_t PathTable::allocate_entry(Stripe& stripe)
+{
+    if (!stripe.free_ids.empty())
+    {
+        uint32_t index = stripe.free_ids.back();
+        stripe.free_ids.pop_back();
+        return index;
+    }
+    if (stripe.entry_count % ENTRY_BLOCK_SIZE == 0)
+    {
+        stripe.entry_blocks.emplace_back(new Entry[ENTRY_BLOCK_SIZE]);
+    }
+    return stripe.entry_count++;
+}
+
+// A path used since the last pass gets its flag cleared and is passed over
+// this time; referenced and free entries are always passed over. Two whole
+// passes find every unreferenced path, if there is one. Bumping the
+// generation only works while the entry has no references, which settles
+// a race with a front cache taking one.
+bool PathTable::evict_one(Stripe& stripe)
+{
+    for (uint64_t checked = 0; checked < 2 * (uint64_t) stripe.entry_count;
+         checked++, stripe.clock_hand++)
+    {
+        if (stripe.clock_hand >= stripe.entry_count)
+        {
+            stripe.clock_hand = 0;
+        }
+        Entry& entry = stripe.entry(stripe.clock_hand);
+        uint64_t state = entry.state.load(memory_order_relaxed);
+        if (!entry.storage || (uint32_t) state > 0)
+        {
+            continue;
+        }
+        if (entry.recently_used.load(memory_order_relaxed))
+        {
+            entry.recently_used.store(false, memory_order_relaxed);
+            continue;
+        }
+        if (!entry.state.compare_exchange_strong(state, 
+                                                 state + (1ull << 32),
+                                                 memory_order_acquire))
+        {
+            continue;
+        }
+        stripe.ids.erase(string_view(entry.storage, entry.length));
+        unsigned int size_class = get_size_class(entry.length);
+        if (size_class == NUM_SIZE_CLASSES)
+        {
+            stripe.oversized_bytes -= entry.length;
+            delete[] entry.storage;
+        }
+        else
+        {
+            stripe.free_blocks[size_class].push_back(entry.storage);
+        }
+        entry.storage = NULL;
+        stripe.free_ids.push_back(stripe.clock_hand++);
+        count(stripe.evictions);
+        return true;
+    }
+    return false;
+}
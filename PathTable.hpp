@@ -0,0 +1,345 @@
+#ifndef PATHTABLE_H
+#define PATHTABLE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class PathTable;
+
+// Intro:   Reads the path of an open file (or O_PATH) descriptor back from
+//              the /proc/self/fd subsystem, growing the buffer for as long
+//              a path as the kernel will spell out there (it refuses
+//              paths of PATH_MAX bytes or more with ENAMETOOLONG)
+// Inputs:  fd : the file descriptor
+//          path : a buffer, which keeps its capacity between calls
+// Outputs: path : the path
+// Return:  false (with errno set) if the path can't be read
+bool read_fd_path(int fd, string& path);
+
+// One reference to a path interned in a PathTable: the path's id and
+//  generation, and a view of the table's copy of it that stays valid for
+//  as long as the reference lives. Releases the reference exactly once,
+//  whichever way the event holding it leaves the pipeline, with a single
+//  atomic decrement. Move-only, like EventFd.
+class PathRef
+{
+    public:
+        PathRef() : references(NULL), id(0), generation(0) {}
+        PathRef(PathRef&& other) : references(other.references), 
+                                   id(other.id), generation(other.generation),
+                                   path(other.path)
+        {
+            other.references = NULL;
+            other.path = string_view();
+        }
+        PathRef& operator=(PathRef&& other)
+        {
+            if (this != &other)
+            {
+                reset();
+                references = other.references;
+                id = other.id;
+                generation = other.generation;
+                path = other.path;
+                other.references = NULL;
+                other.path = string_view();
+            }
+            return *this;
+        }
+        ~PathRef()
+        {
+            reset();
+        }
+
+        // Is there a path?
+        bool is_set() const
+        {
+            return references != NULL;
+        }
+
+        // The path, or an empty view if there is none
+        string_view get() const
+        {
+            return path;
+        }
+
+        // The path's id in its table; equal paths referenced at the same
+        //  time have equal ids
+        uint32_t get_id() const
+        {
+            return id;
+        }
+
+        // How many times the id was given up by an evicted path before
+        //  this one got it. The id and generation together name one path
+        //  for as long as the table lives.
+        uint32_t get_generation() const
+        {
+            return generation;
+        }
+
+        // Releases the reference, if there is one
+        void reset()
+        {
+            if (references)
+            {
+                references->fetch_sub(1, memory_order_release);
+                references = NULL;
+                path = string_view();
+            }
+        }
+
+    private:
+        friend class PathTable;
+
+        // The state of the path's entry in the table (see PathTable::Entry)
+        atomic<uint64_t> * references;
+        uint32_t id;
+        uint32_t generation;
+        string_view path;
+
+        PathRef(atomic<uint64_t> * references, uint32_t id, 
+                uint32_t generation, string_view path)
+            : references(references), id(id), generation(generation), 
+              path(path) {}
+
+        PathRef(const PathRef&);
+        PathRef& operator=(const PathRef&);
+};
+
+// Stores every path the pipeline carries once, named by a 32-bit id, so
+//  that events hold a PathRef instead of a string of their own. The table
+//  is split by path hash into stripes, each with its own lock, arena and
+//  free lists; a path's id carries its stripe in the low bits. Paths are
+//  copied into blocks of a few size classes carved out of large arena
+//  chunks, and a released block is reused for the next path of its class.
+// A path seen over and over (e.g. a build opening the same headers) is
+//  found without taking any lock: each thread remembers the entries it
+//  interned last in a small direct-mapped front cache by path hash, and
+//  takes a reference on one with a compare-and-swap on the entry's
+//  reference count and generation, then checks the path. Only a path
+//  missing from the front cache goes to its stripe's index under the
+//  stripe's lock. Releasing a reference is an atomic decrement.
+// A path stays in the table while anything references it; besides those
+//  the table keeps up to its capacity of paths for reuse. Eviction
+//  approximates least recently used with a clock per stripe: a hand sweeps
+//  the entries, giving every path used since its last pass a second
+//  chance, so that using a path only sets a flag instead of relinking a
+//  list on every event. Evicting an entry bumps its generation, which no
+//  front cache can take a reference under anymore. Safe to share between
+//  threads.
+class PathTable
+{
+    public:
+        // Intro:   Creates an empty table
+        // Inputs:  num_stripes : how many ways to split the table (rounded
+        //              up to a power of two, at most MAX_STRIPES)
+        // Outputs: None
+        // Return:  N/A
+        explicit PathTable(unsigned int num_stripes = DEFAULT_STRIPES);
+        ~PathTable();
+
+        // Intro:   Sets the most paths kept, referenced ones aside, shared
+        //              evenly between the stripes
+        // Inputs:  capacity : the number of paths to keep
+        // Outputs: None
+        // Return:  void
+        void set_capacity(size_t capacity);
+
+        // Intro:   Finds a path in the table, adding it if it's not there
+        // Inputs:  path : the path, of any length
+        // Outputs: None
+        // Return:  A reference to the table's copy of the path
+        PathRef intern(string_view path);
+
+        // Paths found in the table, paths added to it, and unreferenced
+        // paths dropped to stay within the capacity
+        uint64_t get_hits() const;
+        uint64_t get_misses() const;
+        uint64_t get_evictions() const;
+
+        // Paths in the table, and the arena bytes holding them
+        size_t get_path_count();
+        size_t get_arena_bytes();
+
+        static const unsigned int DEFAULT_STRIPES = 16;
+        static const unsigned int MAX_STRIPES = 256;
+
+    private:
+        // Block sizes are 16 << size class bytes; longer paths get an
+        // allocation of their own
+        static const unsigned int NUM_SIZE_CLASSES = 9;
+        static const size_t CHUNK_SIZE = 1 << 16;
+        // Entries are allocated this many at a time and never move, so
+        // that front caches can point at them
+        static const size_t ENTRY_BLOCK_SIZE = 256;
+        // Sets of each thread's front cache, which remembers two entries
+        // in each
+        static const size_t FRONT_CACHE_SETS = 2048;
+        // Front cache hits a thread counts before adding them to hits
+        static const uint32_t HIT_COUNT_BATCH = 64;
+
+        struct Entry
+        {
+            // generation << 32 | references. The generation is bumped
+            // when the entry is evicted, which only happens with no
+            // references, so a reference taken with a compare-and-swap
+            // on a generation someone looked up earlier is a reference to
+            // the same path.
+            atomic<uint64_t> state{0};
+            // Interned since the clock hand last passed
+            atomic<bool> recently_used{false};
+            // NULL while the entry is on free_ids. Only changed with the
+            // stripe's mutex held and no references.
+            char * storage = NULL;
+            uint32_t length = 0;
+            uint32_t id = 0;
+        };
+
+        // One independently locked part of the table. Aligned so that two
+        // stripes' locks and counters never share a cache line.
+        struct alignas(64) Stripe
+        {
+            mutex stripe_mutex;
+            size_t capacity = 0;
+            // Entries by index within the stripe, in blocks of
+            // ENTRY_BLOCK_SIZE; an index on free_ids has no path
+            vector<unique_ptr<Entry[]>> entry_blocks;
+            uint32_t entry_count = 0;
+            vector<uint32_t> free_ids;
+            // Entries by path, the keys viewing the entries' storage
+            unordered_map<string_view, Entry *> ids;
+            // The next entry the clock hand looks at
+            uint32_t clock_hand = 0;
+            // Arena chunks, how much of the last one is handed out,
+            // released blocks by size class, and the paths too long for
+            // any class
+            vector<unique_ptr<char[]>> chunks;
+            size_t chunk_used = CHUNK_SIZE;
+            vector<char *> free_blocks[NUM_SIZE_CLASSES];
+            size_t oversized_bytes = 0;
+
+            // hits is counted without stripe_mutex (front cache hits a
+            // batch at a time, so it can trail by HIT_COUNT_BATCH per
+            // thread); misses and evictions are only written with it
+            // held, and read without it
+            atomic<uint64_t> hits{0};
+            atomic<uint64_t> misses{0};
+            atomic<uint64_t> evictions{0};
+
+            Entry& entry(uint32_t index)
+            {
+                return entry_blocks[index / ENTRY_BLOCK_SIZE]
+                                   [index % ENTRY_BLOCK_SIZE];
+            }
+        };
+
+        // An entry a thread interned. Its set in the front cache is
+        // picked by the low bits of the path's sample_path, and the high
+        // bits tell the paths of one set apart.
+        struct FrontCacheSlot
+        {
+            // Which table the entry belongs to, 0 for an empty slot
+            uint32_t table_serial;
+            uint32_t sample_tag;
+            uint32_t generation;
+            Entry * entry;
+        };
+
+        // Front cache hits a thread hasn't added to its table's hits yet
+        struct UncountedHits
+        {
+            uint32_t table_serial;
+            uint32_t count;
+        };
+
+        unique_ptr<Stripe[]> stripes;
+        unsigned int num_stripes;
+        // log2(num_stripes): ids are index << stripe_bits | stripe
+        unsigned int stripe_bits;
+        // Tells this table's front cache slots apart from those of a table
+        // that used to live at the same address
+        uint32_t serial;
+
+        static atomic<uint32_t> next_serial;
+        // Each set's most recently used entry comes first
+        static thread_local FrontCacheSlot front_cache[FRONT_CACHE_SETS][2];
+        static thread_local UncountedHits uncounted_hits;
+
+        PathTable(const PathTable&);
+        PathTable& operator=(const PathTable&);
+
+        // Intro:   Hashes a few words of a path, for picking its front
+        //              cache slot
+        // Inputs:  path : the path
+        // Outputs: None
+        // Return:  The sample hash
+        static uint64_t sample_path(string_view path);
+
+        // Intro:   Counts a hit found in the front cache
+        // Inputs:  stripe : the stripe of the path
+        // Outputs: None
+        // Return:  void
+        void count_cached_hit(Stripe& stripe);
+
+        // Intro:   Takes a reference on the entry a front cache slot
+        //              remembers, if it still holds the same path
+        // Inputs:  slot : the front cache slot
+        //          path : the path being interned
+        // Outputs: reference : the reference, on success
+        // Return:  Was the path found?
+        bool intern_cached(const FrontCacheSlot& slot, string_view path,
+                           PathRef& reference);
+
+        // Intro:   Gets the size class of a path length
+        // Inputs:  length : the path's length
+        // Outputs: None
+        // Return:  The size class, or NUM_SIZE_CLASSES for an oversized
+        //              path
+        static unsigned int get_size_class(size_t length);
+
+        // Intro:   Gets a block for a path, from the released blocks of its
+        //              class or else from the stripe's arena. The stripe's
+        //              mutex must be held.
+        // Inputs:  stripe : the stripe the path goes in
+        //          length : the path's length
+        // Outputs: None
+        // Return:  The block
+        static char * allocate_block(Stripe& stripe, size_t length);
+
+        // Intro:   Gets an entry without a path, from free_ids or else a
+        //              new one. The stripe's mutex must be held.
+        // Inputs:  stripe : the stripe the entry goes in
+        // Outputs: None
+        // Return:  The entry's index within the stripe
+        static uint32_t allocate_entry(Stripe& stripe);
+
+        // Intro:   Moves the stripe's clock hand on to the next
+        //              unreferenced path not used since the hand's last
+        //              pass and forgets it, giving its block and index
+        //              back. The stripe's mutex must be held.
+        // Inputs:  stripe : the stripe to evict from
+        // Outputs: None
+        // Return:  false if every path is referenced
+        static bool evict_one(Stripe& stripe);
+
+        // Intro:   Adds one to a counter. The stripe's mutex must be held.
+        // Inputs:  counter : the counter
+        // Outputs: None
+        // Return:  void
+        static void count(atomic<uint64_t>& counter)
+        {
+            counter.store(counter.load(memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+        }
+};
+
+#endif
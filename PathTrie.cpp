@@ -0,0 +1,62 @@
+#include "PathTrie.hpp"
+
+#include <string_view>
+
+using namespace std;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+PathTrie::PathTrie()
+{
+    nodes.push_back(Node{{}, false});
+}
+
+// Walk down the directory's components, adding the nodes that are missing
+size_t PathTrie::insert(const string& directory)
+{
+    size_t node = 0;
+    size_t component_start = 0;
+    while (component_start < directory.size())
+    {
+        size_t component_end = directory.find('/', component_start);
+        if (component_end == string::npos)
+        {
+            component_end = directory.size();
+        }
+        if (component_end > component_start)
+        {
+            string component = directory.substr(component_start, 
+                                                 component_end - component_start);
+            auto child = nodes[node].children.find(component);
+            if (child == nodes[node].children.end())
+            {
+                nodes.push_back(Node{{}, false});
+                child = nodes[node].children.emplace(component, 
+                                                     nodes.size() - 1).first;
+            }
+            node = child->second;
+        }
+        component_start = component_end + 1;
+    }
+    nodes[node].is_directory = true;
+    return node;
+}
+
+// Walk down the path's components until a directory of the set is reached
+// or the path leaves the trie
+bool PathTrie::contains_prefix_of(string_view path) const
+{
+    bool contained = false;
+    walk(path, [&](size_t node) {
+        contained = nodes[node].is_directory;
+        return !contained;
+    });
+    return contained;
+}
+
+size_t PathTrie::get_node_count() const
+{
+    return nodes.size();
+}
+
+// -----------------------------------------------------------------------------
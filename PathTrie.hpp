@@ -0,0 +1,94 @@
+#ifndef PATHTRIE_H
+#define PATHTRIE_H
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// A set of directories stored by path component, for deciding whether a
+//  path lies inside any of them in O(path depth) string compares no matter
+//  how many directories there are. Used when the monitored directories are
+//  covered by filesystem-wide marks and events have to be narrowed down to
+//  the directories actually asked for, and underneath the permission
+//  policy, which keeps its rules by node. Never changed after it is built,
+//  so it can be shared between threads.
+class PathTrie
+{
+    public:
+        PathTrie();
+
+        // Intro:   Adds a directory to the set
+        // Inputs:  directory : an absolute path, without symlinks or "."
+        //              and ".." components (e.g. from realpath())
+        // Outputs: None
+        // Return:  The index of the directory's node, which stays the same
+        //              as more directories are added
+        size_t insert(const string& directory);
+
+        // Intro:   Checks whether a path is one of the directories or lies
+        //              anywhere beneath one of them
+        // Inputs:  path : an absolute path, as read back from an fd or a
+        //              file handle
+        // Outputs: None
+        // Return:  Is the path inside a directory of the set?
+        bool contains_prefix_of(string_view path) const;
+
+        // Intro:   Walks down the trie along a path without allocating,
+        //              visiting the root node and then the node of each of
+        //              the path's components until the path ends or leaves
+        //              the trie
+        // Inputs:  path : an absolute path
+        //          visit : called as visit(node index) for each node, in
+        //              order from the root; returning false stops the walk
+        // Outputs: None
+        // Return:  void
+        template <typename Visitor>
+        void walk(string_view path, Visitor visit) const
+        {
+            size_t node = 0;
+            for (;;)
+            {
+                if (!visit(node))
+                {
+                    return;
+                }
+                while (!path.empty() && path.front() == '/')
+                {
+                    path.remove_prefix(1);
+                }
+                if (path.empty())
+                {
+                    return;
+                }
+                string_view component = path.substr(0, path.find('/'));
+                auto child = nodes[node].children.find(component);
+                if (child == nodes[node].children.end())
+                {
+                    return;
+                }
+                node = child->second;
+                path.remove_prefix(component.size());
+            }
+        }
+
+        // Number of nodes, one more than the highest node index
+        size_t get_node_count() const;
+
+    private:
+        struct Node
+        {
+            // Child node index by path component. less<> lets lookups use
+            // a piece of the path without copying it into a string.
+            map<string, size_t, less<>> children;
+            // A directory of the set ends at this node
+            bool is_directory;
+        };
+
+        // Node 0 is the root directory
+        vector<Node> nodes;
+};
+
+#endif
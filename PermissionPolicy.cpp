@@ -0,0 +1,289 @@
+#include "PermissionPolicy.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <sys/fanotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Finds the line of /proc/<pid>/status that starts with key ("Uid:" or
+// "Gid:") and reads its second number, the effective id. The line holds the
+// real, effective, saved and filesystem ids in that order.
+static bool read_effective_id(const char * status, const char * key,
+                              unsigned long& id)
+{
+    const char * line = strstr(status, key);
+    if (line == NULL)
+    {
+        return false;
+    }
+    char * field_end = NULL;
+    strtoul(line + strlen(key), &field_end, 10);
+    const char * effective = field_end;
+    id = strtoul(effective, &field_end, 10);
+    return field_end != effective;
+}
+
+// Resolves an absolute directory to the canonical path event paths would
+// have under it. Whatever part of it doesn't exist yet can't hold a
+// symlink, so that part is only tidied up ('.', '..', repeated slashes).
+static bool canonical_directory(const string& directory, string& canonical)
+{
+    char * full_path = realpath(directory.c_str(), NULL);
+    if (full_path != NULL)
+    {
+        canonical = full_path;
+        free(full_path);
+        return true;
+    }
+    size_t end = directory.find_last_not_of('/');
+    if (errno != ENOENT || end == string::npos)
+    {
+        return false;
+    }
+    size_t slash = directory.rfind('/', end);
+    string component = directory.substr(slash + 1, end - slash);
+    if (!canonical_directory(slash == 0 ? "/" : directory.substr(0, slash),
+                             canonical))
+    {
+        return false;
+    }
+    if (component == "..")
+    {
+        canonical.erase(max<size_t>(canonical.rfind('/'), 1));
+    }
+    else if (component != ".")
+    {
+        if (canonical != "/")
+        {
+            canonical += '/';
+        }
+        canonical += component;
+    }
+    return true;
+}
+
+// -- PUBLIC -------------------------------------------------------------------
+
+PermissionPolicy::PermissionPolicy()
+{
+    has_deny = false;
+    rule_ranges.push_back(RuleRange{0, 0});
+}
+
+// Parse every rule, then lay the rules out so each node's rules sit next to
+// each other in file order
+bool PermissionPolicy::load(const string& policy_filename,
+                            string& error_message)
+{
+    ifstream policy_file(policy_filename);
+    if (!policy_file.is_open())
+    {
+        error_message = "cannot open policy file '" + policy_filename +
+                        "': " + strerror(errno);
+        return false;
+    }
+
+    vector<vector<Rule>> node_rules;
+    string line;
+    for (unsigned int line_number = 1; getline(policy_file, line);
+         line_number++)
+    {
+        istringstream fields(line);
+        string action;
+        if (!(fields >> action) || action[0] == '#')
+        {
+            continue;
+        }
+        string where = policy_filename + ":" + to_string(line_number) + ": ";
+        Rule rule{FAN_ALLOW, 0, 0, 0, 0};
+        if (action == "deny")
+        {
+            rule.response = FAN_DENY;
+            has_deny = true;
+        }
+        else if (action != "allow")
+        {
+            error_message = where + "expected allow or deny, got '" +
+                            action + "'";
+            return false;
+        }
+        string directory;
+        if (!(fields >> directory) || directory[0] != '/')
+        {
+            error_message = where + "expected an absolute directory";
+            return false;
+        }
+        // Event paths are read back from the kernel, so a rule has to name
+        // its directory the same canonical way to ever match
+        string canonical;
+        if (!canonical_directory(directory, canonical))
+        {
+            error_message = where + "cannot resolve directory '" + 
+                            directory + "': " + strerror(errno);
+            return false;
+        }
+        directory = canonical;
+
+        string condition;
+        while (fields >> condition)
+        {
+            size_t equals_pos = condition.find('=');
+            string name = condition.substr(0, equals_pos);
+            string value = equals_pos == string::npos ? "" :
+                           condition.substr(equals_pos + 1);
+            char * value_end = NULL;
+            unsigned long id = strtoul(value.c_str(), &value_end, 10);
+            bool is_id = !value.empty() && *value_end == '\0';
+            if (name == "uid" && is_id)
+            {
+                rule.conditions |= MATCH_UID;
+                rule.uid = id;
+            }
+            else if (name == "gid" && is_id)
+            {
+                rule.conditions |= MATCH_GID;
+                rule.gid = id;
+            }
+            else if (name == "exe" && !value.empty())
+            {
+                rule.conditions |= MATCH_EXE;
+                rule.exe_index = executables.size();
+                executables.push_back(value);
+            }
+            else
+            {
+                error_message = where + "invalid condition '" + condition + "'";
+                return false;
+            }
+        }
+
+        size_t node = directories.insert(directory);
+        node_rules.resize(directories.get_node_count());
+        node_rules[node].push_back(rule);
+    }
+
+    node_rules.resize(directories.get_node_count());
+    rule_ranges.resize(node_rules.size());
+    for (size_t node = 0; node < node_rules.size(); node++)
+    {
+        rule_ranges[node].first_rule = rules.size();
+        rule_ranges[node].rule_count = node_rules[node].size();
+        rules.insert(rules.end(), node_rules[node].begin(),
+                     node_rules[node].end());
+    }
+    return true;
+}
+
+// Walk down the path's components, letting the rules of each deeper
+// directory override what the shallower ones decided
+uint32_t PermissionPolicy::decide(string_view path,
+                                  PolicySubject& subject) const
+{
+    uint32_t response = FAN_ALLOW;
+    directories.walk(path, [&](size_t node) {
+        const RuleRange& range = rule_ranges[node];
+        for (uint32_t rule = range.first_rule;
+             rule < range.first_rule + range.rule_count;
+             rule++)
+        {
+            if (matches(rules[rule], subject))
+            {
+                response = rules[rule].response;
+                break;
+            }
+        }
+        return true;
+    });
+    return response;
+}
+
+size_t PermissionPolicy::get_rule_count() const
+{
+    return rules.size();
+}
+
+bool PermissionPolicy::has_deny_rules() const
+{
+    return has_deny;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Look up what the rule asks about the process the first time it's needed.
+// The ids come from /proc/<pid>/status, not from the owner of /proc/<pid>:
+// a process that isn't dumpable has /proc/<pid> owned by root, whatever ids
+// it runs with. Uid: and Gid: are near the top of the file, so one read into
+// a buffer on the stack is enough.
+bool PermissionPolicy::matches(const Rule& rule, PolicySubject& subject) const
+{
+    if ((rule.conditions & (MATCH_UID | MATCH_GID)) && !subject.has_ids)
+    {
+        char proc_path[32];
+        snprintf(proc_path, sizeof(proc_path), "/proc/%d/status", subject.pid);
+        int status_fd = open(proc_path, O_RDONLY | O_CLOEXEC);
+        if (status_fd == -1)
+        {
+            return false;
+        }
+        char status[1024];
+        ssize_t status_length = read(status_fd, status, sizeof(status) - 1);
+        close(status_fd);
+        if (status_length <= 0)
+        {
+            return false;
+        }
+        status[status_length] = '\0';
+        unsigned long uid;
+        unsigned long gid;
+        if (!read_effective_id(status, "\nUid:", uid) ||
+            !read_effective_id(status, "\nGid:", gid))
+        {
+            return false;
+        }
+        subject.uid = uid;
+        subject.gid = gid;
+        subject.has_ids = true;
+    }
+    if ((rule.conditions & MATCH_UID) && subject.uid != rule.uid)
+    {
+        return false;
+    }
+    if ((rule.conditions & MATCH_GID) && subject.gid != rule.gid)
+    {
+        return false;
+    }
+    if (rule.conditions & MATCH_EXE)
+    {
+        if (!subject.has_exe)
+        {
+            char proc_path[32];
+            snprintf(proc_path, sizeof(proc_path), "/proc/%d/exe", subject.pid);
+            ssize_t exe_length = readlink(proc_path, subject.exe,
+                                          sizeof(subject.exe));
+            if (exe_length == -1)
+            {
+                return false;
+            }
+            subject.exe_length = exe_length;
+            subject.has_exe = true;
+        }
+        const string& executable = executables[rule.exe_index];
+        if (executable.size() != subject.exe_length ||
+            memcmp(executable.data(), subject.exe, subject.exe_length) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
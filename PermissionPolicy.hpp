@@ -0,0 +1,115 @@
+#ifndef PERMISSIONPOLICY_H
+#define PERMISSIONPOLICY_H
+
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+#include "PathTrie.hpp"
+
+using namespace std;
+
+// The process behind a permission event, as far as a policy needs to know
+//  it. The uid/gid and the executable are only looked up (from /proc) the
+//  first time a rule asks for them, and without allocating.
+struct PolicySubject
+{
+    pid_t pid;
+    bool has_ids = false;
+    uid_t uid = 0;
+    gid_t gid = 0;
+    bool has_exe = false;
+    size_t exe_length = 0;
+    char exe[PATH_MAX];
+
+    explicit PolicySubject(pid_t pid) : pid(pid) {}
+};
+
+// Allow/deny rules for permission events, compiled from a rule file into a
+//  trie over path components. A decision walks the trie once along the
+//  path of the event, so it costs O(path depth) map lookups however many
+//  rules there are, and it never allocates. A loaded policy is never
+//  changed, so it can be shared between threads and replaced as a whole.
+//
+// Rule file format, one rule per line (blank lines and lines starting with
+//  '#' are skipped):
+//      allow|deny DIRECTORY [uid=N] [gid=N] [exe=PATH]
+//  A rule covers DIRECTORY and everything beneath it, for processes that
+//  match all of its conditions (uid/gid are the effective ids, as listed in
+//  /proc/<pid>/status). DIRECTORY is resolved to its canonical path
+//  (symlinks, '.' and '..' followed) when the file is loaded, since that is
+//  the form event paths come in; a file naming a directory that can't be
+//  resolved is rejected. The rules of the deepest directory that has a
+//  matching rule win, and within one directory the first matching rule in
+//  the file wins. Anything no rule matches is allowed.
+class PermissionPolicy
+{
+    public:
+        PermissionPolicy();
+
+        // Intro:   Compiles a rule file into this policy, which must be
+        //              freshly constructed
+        // Inputs:  policy_filename : the rule file
+        // Outputs: error_message : what is wrong with the file, on failure
+        // Return:  Was the whole file compiled?
+        bool load(const string& policy_filename, string& error_message);
+
+        // Intro:   Decides a permission event
+        // Inputs:  path : absolute path of the file being accessed
+        //          subject : the accessing process
+        // Outputs: subject : ids/executable are filled in if a rule
+        //              needed them
+        // Return:  FAN_ALLOW or FAN_DENY
+        uint32_t decide(string_view path, PolicySubject& subject) const;
+
+        // Number of rules compiled from the file
+        size_t get_rule_count() const;
+        // Does any rule deny? A policy without one can allow whatever it
+        // can't decide.
+        bool has_deny_rules() const;
+
+    private:
+        enum RuleCondition : uint8_t
+        {
+            MATCH_UID = 1,
+            MATCH_GID = 2,
+            MATCH_EXE = 4
+        };
+
+        struct Rule
+        {
+            uint32_t response;
+            uint8_t conditions;
+            uid_t uid;
+            gid_t gid;
+            // Index into executables when conditions has MATCH_EXE
+            uint32_t exe_index;
+        };
+
+        // The rules of one directory are rules[first_rule, first_rule +
+        // rule_count), in file order
+        struct RuleRange
+        {
+            uint32_t first_rule;
+            uint32_t rule_count;
+        };
+
+        // The directories that have rules, and their rules by trie node
+        PathTrie directories;
+        vector<RuleRange> rule_ranges;
+        vector<Rule> rules;
+        vector<string> executables;
+        bool has_deny;
+
+        // Intro:   Checks a rule's conditions against a process
+        // Inputs:  rule : the rule to check
+        //          subject : the accessing process
+        // Outputs: subject : ids/executable are filled in if needed
+        // Return:  Does the process match every condition of the rule?
+        bool matches(const Rule& rule, PolicySubject& subject) const;
+};
+
+#endif
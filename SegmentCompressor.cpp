@@ -0,0 +1,266 @@
+#include "SegmentCompressor.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+using namespace std;
+
+// ioprio_set(2) has no glibc wrapper or header
+static const int IOPRIO_WHO_PROCESS = 1;
+static const int IOPRIO_CLASS_IDLE = 3;
+static const int IOPRIO_CLASS_SHIFT = 13;
+
+// Does the name end like a closed segment's, with a date-time like
+// 20261018T015232Z and maybe a .N suffix after it?
+static bool is_segment_suffix(const string& suffix)
+{
+    // d for a digit
+    static const char DATE_TIME_PATTERN[] = "ddddddddTddddddZ";
+    size_t date_time_length = sizeof(DATE_TIME_PATTERN) - 1;
+    if (suffix.size() < date_time_length)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < date_time_length; i++)
+    {
+        char expected = DATE_TIME_PATTERN[i];
+        if (expected == 'd' ? !isdigit((unsigned char) suffix[i]) 
+                            : suffix[i] != expected)
+        {
+            return false;
+        }
+    }
+    if (suffix.size() == date_time_length)
+    {
+        return true;
+    }
+    return suffix.size() > date_time_length + 1 &&
+           suffix[date_time_length] == '.' &&
+           all_of(suffix.begin() + date_time_length + 1, suffix.end(),
+                  [](char c) { return isdigit((unsigned char) c); });
+}
+
+// -- PUBLIC -------------------------------------------------------------------
+
+SegmentCompressor::SegmentCompressor()
+{
+    running = false;
+}
+
+SegmentCompressor::~SegmentCompressor()
+{
+    stop();
+}
+
+void SegmentCompressor::compress(const string& segment_path)
+{
+    lock_guard<mutex> lock(queue_mutex);
+    if (!compression_thread.joinable())
+    {
+        running = true;
+        compression_thread = thread(&SegmentCompressor::run, this);
+    }
+    queue.push_back(segment_path);
+    queue_not_empty.notify_one();
+}
+
+// Look through the output file's directory for its segments, oldest first
+// (the date-times sort that way)
+void SegmentCompressor::compress_leftover_segments(
+    const string& output_filename)
+{
+    size_t slash_pos = output_filename.rfind('/');
+    string directory = slash_pos == string::npos ? "." :
+                       output_filename.substr(0, slash_pos + 1);
+    string prefix = (slash_pos == string::npos ? output_filename :
+                     output_filename.substr(slash_pos + 1)) + ".";
+    DIR * output_dir = opendir(directory.c_str());
+    if (!output_dir)
+    {
+        cerr << "dirmon: cannot look for uncompressed segments in '" 
+             << directory << "', errno:" << strerror(errno) << endl;
+        return;
+    }
+    vector<string> segments;
+    const string partial_suffix = ".gz.partial";
+    while (struct dirent * entry = readdir(output_dir))
+    {
+        string name = entry->d_name;
+        if (name.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        string suffix = name.substr(prefix.size());
+        string segment_path = slash_pos == string::npos ? name : 
+                              directory + name;
+        if (is_segment_suffix(suffix))
+        {
+            segments.push_back(segment_path);
+        }
+        else if (suffix.size() > partial_suffix.size() &&
+                 suffix.compare(suffix.size() - partial_suffix.size(),
+                                partial_suffix.size(), partial_suffix) == 0 &&
+                 is_segment_suffix(suffix.substr(0, suffix.size() - 
+                                                    partial_suffix.size())))
+        {
+            unlink(segment_path.c_str());
+        }
+    }
+    closedir(output_dir);
+    sort(segments.begin(), segments.end());
+    for (auto segment = segments.begin(); segment != segments.end(); segment++)
+    {
+        compress(*segment);
+    }
+}
+
+void SegmentCompressor::stop()
+{
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        running = false;
+    }
+    queue_not_empty.notify_one();
+    if (compression_thread.joinable())
+    {
+        compression_thread.join();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Drop to the lowest priorities, then compress segments as they come in
+void SegmentCompressor::run()
+{
+    // On Linux these apply to the calling thread only
+    pid_t thread_id = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, thread_id, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, thread_id,
+            IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    for (;;)
+    {
+        string segment_path;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_not_empty.wait(lock, [this] {
+                return !queue.empty() || !running;
+            });
+            if (!running)
+            {
+                return;
+            }
+            segment_path = queue.front();
+            queue.pop_front();
+        }
+        compress_segment(segment_path);
+    }
+}
+
+// Sync the directory holding path, so the renames in it are on disk
+static bool sync_directory(const string& path)
+{
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : 
+                       slash == 0 ? "/" : path.substr(0, slash);
+    int directory_fd = open(directory.c_str(), 
+                            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (directory_fd == -1)
+    {
+        return false;
+    }
+    bool synced = fsync(directory_fd) == 0;
+    close(directory_fd);
+    return synced;
+}
+
+// Compress into a .partial file first so that a .gz is always complete
+void SegmentCompressor::compress_segment(const string& segment_path)
+{
+    string compressed_path = segment_path + ".gz";
+    string partial_path = compressed_path + ".partial";
+    FILE * segment = fopen(segment_path.c_str(), "rbe");
+    if (!segment)
+    {
+        cerr << "dirmon: cannot open segment '" << segment_path 
+             << "' for compression, errno:" << strerror(errno) << endl;
+        return;
+    }
+    // gzclose closes the descriptor it is given, so it gets a duplicate
+    // and partial_fd stays open for the sync
+    int partial_fd = open(partial_path.c_str(), 
+                          O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int gz_fd = partial_fd == -1 ? -1 : fcntl(partial_fd, F_DUPFD_CLOEXEC, 0);
+    gzFile compressed = gz_fd == -1 ? NULL : gzdopen(gz_fd, "wb6");
+    if (!compressed)
+    {
+        cerr << "dirmon: cannot create '" << partial_path << "'" << endl;
+        if (gz_fd != -1)
+        {
+            close(gz_fd);
+        }
+        if (partial_fd != -1)
+        {
+            close(partial_fd);
+            unlink(partial_path.c_str());
+        }
+        fclose(segment);
+        return;
+    }
+
+    vector<char> chunk(1 << 20);
+    bool complete = true;
+    size_t num_bytes_read;
+    while ((num_bytes_read = fread(chunk.data(), 1, chunk.size(), segment)) > 0)
+    {
+        if (!running || 
+            gzwrite(compressed, chunk.data(), num_bytes_read) != 
+            (int) num_bytes_read)
+        {
+            complete = false;
+            break;
+        }
+    }
+    complete = complete && !ferror(segment);
+    fclose(segment);
+    complete = gzclose(compressed) == Z_OK && complete;
+    // The compressed data has to be on disk before the rename can be,
+    // or a crash could leave an empty .gz and no segment
+    if (complete && fdatasync(partial_fd) == -1)
+    {
+        cerr << "dirmon: cannot sync '" << partial_path << "', errno:"
+             << strerror(errno) << endl;
+        complete = false;
+    }
+    close(partial_fd);
+
+    if (!complete || rename(partial_path.c_str(), compressed_path.c_str()) != 0)
+    {
+        unlink(partial_path.c_str());
+        return;
+    }
+    // Likewise the rename before the segment is gone
+    if (!sync_directory(segment_path))
+    {
+        cerr << "dirmon: cannot sync the directory of '" << compressed_path
+             << "', errno:" << strerror(errno) << "; keeping '" 
+             << segment_path << "'" << endl;
+        return;
+    }
+    unlink(segment_path.c_str());
+}
@@ -0,0 +1,74 @@
+#ifndef SEGMENTCOMPRESSOR_H
+#define SEGMENTCOMPRESSOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+// Gzips closed audit segments on a background thread running at the
+//  lowest CPU and I/O priority, so compression never competes with the
+//  auditing itself. A segment is replaced by <segment>.gz once it has been
+//  compressed completely.
+class SegmentCompressor
+{
+    public:
+        SegmentCompressor();
+        ~SegmentCompressor();
+
+        // Intro:   Queues a closed segment for compression, starting the
+        //              compression thread the first time
+        // Inputs:  segment_path : the segment to compress
+        // Outputs: None
+        // Return:  void
+        void compress(const string& segment_path);
+
+        // Intro:   Queues the segments of an audit output file that an
+        //              earlier run closed but didn't get to compress, and
+        //              removes the partial .gz files it left behind
+        // Inputs:  output_filename : the audit output file, whose closed
+        //              segments are named <output_filename>.<UTC date-time>
+        //              (with a .N suffix for more than one in a second)
+        // Outputs: None
+        // Return:  void
+        void compress_leftover_segments(const string& output_filename);
+
+        // Intro:   Stops the compression thread. A segment that is being
+        //              compressed is left as it was (uncompressed), as are
+        //              segments still waiting in the queue, for
+        //              compress_leftover_segments to pick up next time.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void stop();
+
+    private:
+        thread compression_thread;
+        // Segments waiting to be compressed
+        deque<string> queue;
+        mutex queue_mutex;
+        condition_variable queue_not_empty;
+        atomic<bool> running;
+
+        SegmentCompressor(const SegmentCompressor&);
+        SegmentCompressor& operator=(const SegmentCompressor&);
+
+        // Intro:   Body of the compression thread
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void run();
+
+        // Intro:   Gzips one segment to <segment>.gz and removes the segment
+        //              once the .gz and its name are synced to disk
+        // Inputs:  segment_path : the segment to compress
+        // Outputs: None
+        // Return:  void, reports failures on cerr
+        void compress_segment(const string& segment_path);
+};
+
+#endif
@@ -0,0 +1,329 @@
+#include "UringOutput.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+// -- PUBLIC -------------------------------------------------------------------
+
+UringOutput::UringOutput()
+{
+    ring_fd = -1;
+    sq_ring = MAP_FAILED;
+    sq_ring_bytes = 0;
+    cq_ring = MAP_FAILED;
+    cq_ring_bytes = 0;
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+    sqes_bytes = 0;
+    buffer_memory = NULL;
+    buffer_bytes = 0;
+    fixed_buffers = false;
+    in_flight = 0;
+    bytes_written = 0;
+}
+
+UringOutput::~UringOutput()
+{
+    close();
+}
+
+// Map the rings as man io_uring_setup describes, then carve the buffers out
+// of one allocation and try to register them
+bool UringOutput::open(unsigned int num_buffers, size_t buffer_bytes)
+{
+    // Room for a write and its linked sync per buffer
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, num_buffers * 2, &params);
+    if (ring_fd == -1)
+    {
+        return false;
+    }
+
+    sq_ring_bytes = params.sq_off.array +
+                    params.sq_entries * sizeof(unsigned int);
+    cq_ring_bytes = params.cq_off.cqes +
+                    params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        sq_ring_bytes = cq_ring_bytes = max(sq_ring_bytes, cq_ring_bytes);
+    }
+    sq_ring = mmap(NULL, sq_ring_bytes, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        cq_ring = sq_ring;
+    }
+    else
+    {
+        cq_ring = mmap(NULL, cq_ring_bytes, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    }
+    sqes_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(NULL, sqes_bytes,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ring_fd,
+                                        IORING_OFF_SQES);
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    char * sq_base = (char *) sq_ring;
+    sq_head = (unsigned int *) (sq_base + params.sq_off.head);
+    sq_tail = (unsigned int *) (sq_base + params.sq_off.tail);
+    sq_mask = (unsigned int *) (sq_base + params.sq_off.ring_mask);
+    sq_array = (unsigned int *) (sq_base + params.sq_off.array);
+    char * cq_base = (char *) cq_ring;
+    cq_head = (unsigned int *) (cq_base + params.cq_off.head);
+    cq_tail = (unsigned int *) (cq_base + params.cq_off.tail);
+    cq_mask = (unsigned int *) (cq_base + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *) (cq_base + params.cq_off.cqes);
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    this->buffer_bytes = (buffer_bytes + page_size - 1) / page_size *
+                         page_size;
+    void * memory;
+    if (posix_memalign(&memory, page_size,
+                       this->buffer_bytes * num_buffers) != 0)
+    {
+        close();
+        errno = ENOMEM;
+        return false;
+    }
+    buffer_memory = (char *) memory;
+    buffers.resize(num_buffers);
+    queued_lengths.assign(num_buffers, 0);
+    free_buffers.clear();
+    for (unsigned int i = 0; i < num_buffers; i++)
+    {
+        buffers[i].iov_base = buffer_memory + i * this->buffer_bytes;
+        buffers[i].iov_len = this->buffer_bytes;
+        free_buffers.push_back(num_buffers - 1 - i);
+    }
+    // Registering pins the buffers, which counts against RLIMIT_MEMLOCK;
+    // without it every write maps its buffer again
+    fixed_buffers = syscall(__NR_io_uring_register, ring_fd,
+                            IORING_REGISTER_BUFFERS, buffers.data(),
+                            num_buffers) == 0;
+    return true;
+}
+
+// The write is drained behind everything queued before it, so batches land
+// in the order they were submitted even though several are in flight
+bool UringOutput::submit_append(int fd, const char * data, size_t length,
+                                bool sync)
+{
+    if (ring_fd == -1 || length > buffer_bytes)
+    {
+        return false;
+    }
+    while (free_buffers.empty())
+    {
+        if (!enter(0, 1))
+        {
+            return false;
+        }
+        reap_completions();
+    }
+    unsigned int buffer = free_buffers.back();
+    free_buffers.pop_back();
+    memcpy(buffers[buffer].iov_base, data, length);
+    queued_lengths[buffer] = length;
+
+    struct io_uring_sqe * write_sqe = get_sqe();
+    write_sqe->fd = fd;
+    // The file is opened with O_APPEND, which puts every write at the end
+    write_sqe->off = 0;
+    write_sqe->flags = IOSQE_IO_DRAIN;
+    write_sqe->user_data = buffer;
+    if (fixed_buffers)
+    {
+        write_sqe->opcode = IORING_OP_WRITE_FIXED;
+        write_sqe->addr = (uint64_t) buffers[buffer].iov_base;
+        write_sqe->len = length;
+        write_sqe->buf_index = buffer;
+    }
+    else
+    {
+        // The iovec is cut down to the batch until the write completes
+        buffers[buffer].iov_len = length;
+        write_sqe->opcode = IORING_OP_WRITEV;
+        write_sqe->addr = (uint64_t) &buffers[buffer];
+        write_sqe->len = 1;
+    }
+    unsigned int to_submit = 1;
+    if (sync)
+    {
+        write_sqe->flags |= IOSQE_IO_LINK;
+        struct io_uring_sqe * sync_sqe = get_sqe();
+        sync_sqe->opcode = IORING_OP_FSYNC;
+        sync_sqe->fd = fd;
+        sync_sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sync_sqe->user_data = SYNC_USER_DATA;
+        to_submit++;
+    }
+    in_flight += to_submit;
+    if (!enter(to_submit, 0))
+    {
+        // Nothing reached the kernel, so take the entries back
+        __atomic_store_n(sq_tail, *sq_tail - to_submit, __ATOMIC_RELEASE);
+        in_flight -= to_submit;
+        buffers[buffer].iov_len = buffer_bytes;
+        free_buffers.push_back(buffer);
+        return false;
+    }
+    // Free whatever finished in the meantime without waiting
+    reap_completions();
+    return true;
+}
+
+void UringOutput::wait_all()
+{
+    while (in_flight > 0)
+    {
+        if (!enter(0, 1))
+        {
+            cerr << "dirmon: cannot wait for audit output writes, errno:"
+                 << strerror(errno) << endl;
+            return;
+        }
+        reap_completions();
+    }
+}
+
+void UringOutput::close()
+{
+    if (ring_fd == -1)
+    {
+        return;
+    }
+    wait_all();
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqes_bytes);
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+    {
+        munmap(cq_ring, cq_ring_bytes);
+    }
+    if (sq_ring != MAP_FAILED)
+    {
+        munmap(sq_ring, sq_ring_bytes);
+    }
+    sqes = (struct io_uring_sqe *) MAP_FAILED;
+    cq_ring = sq_ring = MAP_FAILED;
+    // Closing the ring also unregisters the buffers
+    ::close(ring_fd);
+    ring_fd = -1;
+    free(buffer_memory);
+    buffer_memory = NULL;
+    buffers.clear();
+    free_buffers.clear();
+    fixed_buffers = false;
+}
+
+bool UringOutput::is_open() const
+{
+    return ring_fd != -1;
+}
+
+uint64_t UringOutput::get_bytes_written() const
+{
+    return bytes_written;
+}
+
+bool UringOutput::has_fixed_buffers() const
+{
+    return fixed_buffers;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// There are always two entries per free buffer, so the queue never fills
+struct io_uring_sqe * UringOutput::get_sqe()
+{
+    unsigned int tail = *sq_tail;
+    unsigned int index = tail & *sq_mask;
+    struct io_uring_sqe * sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+bool UringOutput::enter(unsigned int to_submit, unsigned int min_complete)
+{
+    for (;;)
+    {
+        long result = syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                              min_complete,
+                              min_complete ? IORING_ENTER_GETEVENTS : 0,
+                              NULL, 0);
+        if (result >= 0)
+        {
+            return true;
+        }
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+void UringOutput::reap_completions()
+{
+    unsigned int head = *cq_head;
+    unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+        in_flight--;
+        if (cqe->user_data == SYNC_USER_DATA)
+        {
+            // A sync cancelled because its write failed was reported there
+            if (cqe->res < 0 && cqe->res != -ECANCELED)
+            {
+                cerr << "dirmon: cannot sync audit output file, errno:"
+                     << strerror(-cqe->res) << endl;
+            }
+            continue;
+        }
+        unsigned int buffer = cqe->user_data;
+        size_t length = queued_lengths[buffer];
+        if (cqe->res < 0)
+        {
+            cerr << "dirmon: cannot write to audit output file, errno:"
+                 << strerror(-cqe->res) << "; " << length
+                 << " bytes lost" << endl;
+        }
+        else
+        {
+            bytes_written += cqe->res;
+            if ((size_t) cqe->res < length)
+            {
+                cerr << "dirmon: short write to audit output file; "
+                     << length - cqe->res << " bytes lost" << endl;
+            }
+        }
+        buffers[buffer].iov_len = buffer_bytes;
+        free_buffers.push_back(buffer);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,133 @@
+#ifndef URINGOUTPUT_H
+#define URINGOUTPUT_H
+
+#include <atomic>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <vector>
+
+using namespace std;
+
+// Appends batches to the audit output through io_uring, so a commit only
+//  copies its batch into one of a ring of buffers and queues the write
+//  instead of waiting for the disk. The buffers are registered with the
+//  kernel when the memlock limit allows it (fixed-buffer writes), plain
+//  iovecs are used otherwise. Every write is drained behind the ones queued
+//  before it, so batches reach the file in order, and can have an
+//  fdatasync linked behind it. Uses the raw system calls, so it needs no
+//  library; open fails on kernels without io_uring (or with it disabled),
+//  which leaves the caller to write(2) on its own.
+// Not thread-safe: AuditWriter only calls it with its commit_mutex held.
+class UringOutput
+{
+    public:
+        UringOutput();
+        ~UringOutput();
+
+        // Intro:   Sets up the ring and its buffers
+        // Inputs:  num_buffers : most writes in flight at once
+        //          buffer_bytes : size of each buffer, i.e. the largest
+        //              batch that can be queued
+        // Outputs: None
+        // Return:  false (with errno set) if io_uring can't be used
+        bool open(unsigned int num_buffers, size_t buffer_bytes);
+
+        // Intro:   Queues an append of a batch to a file opened with
+        //              O_APPEND, waiting for a buffer to come free first if
+        //              every one is in flight
+        // Inputs:  fd : the file to append to
+        //          data : the batch, copied before this returns
+        //          length : the number of bytes in data
+        //          sync : link an fdatasync of fd behind the write
+        // Outputs: None
+        // Return:  false if nothing was queued (the batch is larger than a
+        //              buffer or the ring failed), so the caller has to
+        //              write it itself after calling wait_all
+        bool submit_append(int fd, const char * data, size_t length,
+                           bool sync);
+
+        // Intro:   Waits until every queued write (and sync) has completed,
+        //              e.g. before the file is closed or renamed
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, reports failed writes on cerr
+        void wait_all();
+
+        // Intro:   Waits for the queued writes and tears down the ring
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void close();
+
+        // Is the ring set up?
+        bool is_open() const;
+        // Bytes the completed writes put in the file
+        uint64_t get_bytes_written() const;
+        // Are the buffers registered with the kernel?
+        bool has_fixed_buffers() const;
+
+    private:
+        // user_data of a linked fdatasync, told apart from buffer indexes
+        static const uint64_t SYNC_USER_DATA = UINT64_MAX;
+
+        int ring_fd;
+        // The submission and completion rings shared with the kernel, and
+        // the submission queue entries
+        void * sq_ring;
+        size_t sq_ring_bytes;
+        void * cq_ring;
+        size_t cq_ring_bytes;
+        struct io_uring_sqe * sqes;
+        size_t sqes_bytes;
+        // Pointers into the rings (see man io_uring_setup)
+        unsigned int * sq_head;
+        unsigned int * sq_tail;
+        unsigned int * sq_mask;
+        unsigned int * sq_array;
+        unsigned int * cq_head;
+        unsigned int * cq_tail;
+        unsigned int * cq_mask;
+        struct io_uring_cqe * cqes;
+
+        // The buffers, one page-aligned allocation, and their iovecs (the
+        // ones registered with the kernel when fixed_buffers is set)
+        char * buffer_memory;
+        size_t buffer_bytes;
+        vector<struct iovec> buffers;
+        bool fixed_buffers;
+        // Buffers not in flight, and the length queued from the others
+        vector<unsigned int> free_buffers;
+        vector<size_t> queued_lengths;
+        // Submissions whose completion hasn't been reaped yet
+        unsigned int in_flight;
+
+        atomic<uint64_t> bytes_written;
+
+        UringOutput(const UringOutput&);
+        UringOutput& operator=(const UringOutput&);
+
+        // Intro:   Takes the next free submission queue entry, cleared
+        // Inputs:  None
+        // Outputs: None
+        // Return:  The entry, to be filled in and then submitted
+        struct io_uring_sqe * get_sqe();
+
+        // Intro:   Hands queued entries to the kernel, optionally waiting for
+        //              completions
+        // Inputs:  to_submit : entries queued since the last call
+        //          min_complete : completions to wait for
+        // Outputs: None
+        // Return:  false if io_uring_enter failed
+        bool enter(unsigned int to_submit, unsigned int min_complete);
+
+        // Intro:   Processes every completion the kernel has posted, freeing
+        //              the buffers of finished writes
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void, reports failed and short writes on cerr
+        void reap_completions();
+};
+
+#endif
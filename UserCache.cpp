@@ -0,0 +1,354 @@
+#include "UserCache.hpp"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <proc/readproc.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+const chrono::milliseconds UserCache::passwd_check_interval(1000);
+
+// -- PUBLIC -------------------------------------------------------------------
+
+UserCache::UserCache()
+{
+    capacity = 4096;
+    passwd_mtime = {0, 0};
+    passwd_inode = 0;
+    pid_hits = 0;
+    pid_misses = 0;
+    pid_recycles = 0;
+    uid_hits = 0;
+    uid_misses = 0;
+}
+
+void UserCache::set_capacity(size_t capacity)
+{
+    lock_guard<mutex> lock(cache_mutex);
+    this->capacity = capacity > 0 ? capacity : 1;
+}
+
+string UserCache::get_user_of_pid(pid_t pid)
+{
+    unique_lock<mutex> lock(cache_mutex);
+    PidEntry * entry = find_process(pid, lock);
+    if (!entry)
+    {
+        return "CANNOT_FIND_USER_DEAD_PROCESS";
+    }
+    return entry->username;
+}
+
+void UserCache::get_user_of_pid(pid_t pid, string& username)
+{
+    unique_lock<mutex> lock(cache_mutex);
+    PidEntry * entry = find_process(pid, lock);
+    if (!entry)
+    {
+        username.assign("CANNOT_FIND_USER_DEAD_PROCESS");
+        return;
+    }
+    username.assign(entry->username);
+}
+
+bool UserCache::get_uid_of_pid(pid_t pid, uid_t& uid)
+{
+    unique_lock<mutex> lock(cache_mutex);
+    PidEntry * entry = find_process(pid, lock);
+    if (!entry)
+    {
+        return false;
+    }
+    uid = entry->uid;
+    return true;
+}
+
+// A process can't change its executable without exec'ing, which a cached
+// entry doesn't notice, so the executable is as old as the entry at most.
+// It is read without the lock and only kept if the entry is still that of
+// the same process by then.
+bool UserCache::get_program_of_pid(pid_t pid, bool need_exe, string& comm,
+                                   string& exe)
+{
+    unique_lock<mutex> lock(cache_mutex);
+    PidEntry * entry = find_process(pid, lock);
+    if (!entry)
+    {
+        return false;
+    }
+    comm.assign(entry->comm);
+    if (!need_exe || entry->has_exe)
+    {
+        exe.assign(need_exe ? entry->exe : "");
+        return true;
+    }
+    unsigned long long start_time = entry->start_time;
+    lock.unlock();
+
+    char exe_path[32];
+    snprintf(exe_path, sizeof(exe_path), "/proc/%d/exe", (int) pid);
+    char executable[PATH_MAX];
+    ssize_t exe_length = readlink(exe_path, executable, sizeof(executable));
+    exe.assign(executable, exe_length > 0 ? exe_length : 0);
+
+    lock.lock();
+    auto found = pid_entries.find(pid);
+    if (found != pid_entries.end() && found->second.start_time == start_time)
+    {
+        found->second.exe = exe;
+        found->second.has_exe = true;
+    }
+    return true;
+}
+
+uint64_t UserCache::get_pid_hits() const
+{
+    return pid_hits;
+}
+
+uint64_t UserCache::get_pid_misses() const
+{
+    return pid_misses;
+}
+
+uint64_t UserCache::get_pid_recycles() const
+{
+    return pid_recycles;
+}
+
+uint64_t UserCache::get_uid_hits() const
+{
+    return uid_hits;
+}
+
+uint64_t UserCache::get_uid_misses() const
+{
+    return uid_misses;
+}
+
+// -----------------------------------------------------------------------------
+
+
+
+// -- PRIVATE ------------------------------------------------------------------
+
+// Answer from the pid cache when the cached process is still the one
+// behind the pid, and read the process otherwise. The start time is checked
+// on every hit, since fork-heavy workloads recycle pids within moments.
+// Other threads may change the cache while /proc is read, so the entry is
+// looked up again after.
+UserCache::PidEntry * UserCache::find_process(pid_t pid,
+                                              unique_lock<mutex>& lock)
+{
+    auto found = pid_entries.find(pid);
+    if (found != pid_entries.end())
+    {
+        // A process that has exited can't have had its pid reused unless
+        // a new process now shows up under it
+        bool still_same_process = true;
+        unsigned long long cached_start_time = found->second.start_time;
+        lock.unlock();
+        unsigned long long start_time;
+        if (read_start_time(pid, start_time) && 
+            start_time != cached_start_time)
+        {
+            still_same_process = false;
+            pid_recycles++;
+        }
+        lock.lock();
+        found = pid_entries.find(pid);
+        if (found == pid_entries.end() ||
+            found->second.start_time != cached_start_time)
+        {
+            still_same_process = false;
+        }
+        if (still_same_process)
+        {
+            pid_hits++;
+            lru_pids.splice(lru_pids.begin(), lru_pids, 
+                            found->second.lru_position);
+            return &found->second;
+        }
+    }
+
+    pid_misses++;
+    uid_t uid;
+    string comm;
+    unsigned long long start_time;
+    lock.unlock();
+    bool process_read = read_process(pid, uid, comm, start_time);
+    lock.lock();
+    if (!process_read)
+    {
+        return NULL;
+    }
+    string username = get_username_of_uid(uid, lock);
+    return &insert_pid(pid, uid, comm, username, start_time);
+}
+
+// Read the real uid, command name and start time of the process with
+// readproc()
+bool UserCache::read_process(pid_t pid, uid_t& uid, string& comm,
+                             unsigned long long& start_time)
+{
+    // We want the info from /proc/#pid/status and /proc/#pid/stat, but
+    // only for a specific PID. Usernames are resolved through our own
+    // uid cache rather than PROC_FILLUSR.
+    int proc_flags = PROC_FILLSTATUS | PROC_FILLSTAT | PROC_PID;
+    // Create 0-terminated pid list            
+    pid_t pid_list[2];
+    pid_list[0] = pid;
+    pid_list[1] = 0;
+    PROCTAB * proc_tab = openproc(proc_flags, pid_list);
+    if (!proc_tab)
+    {
+        return false;
+    }
+    
+    proc_t * found = readproc(proc_tab, NULL);
+    bool process_read = found != NULL;
+    if (process_read)
+    {
+        uid = found->ruid;
+        comm = found->cmd;
+        start_time = found->start_time;
+        freeproc(found);
+    }
+    closeproc(proc_tab);
+    return process_read;
+}
+
+// Read field 22 (starttime) of /proc/<pid>/stat
+bool UserCache::read_start_time(pid_t pid, unsigned long long& start_time)
+{
+    char stat_path[32];
+    snprintf(stat_path, sizeof(stat_path), "/proc/%d/stat", (int) pid);
+    int stat_fd = open(stat_path, O_RDONLY | O_CLOEXEC);
+    if (stat_fd == -1)
+    {
+        return false;
+    }
+    // One read on the stack, as this runs on every cache hit
+    char stat_line[1024];
+    ssize_t num_chars_read = read(stat_fd, stat_line, sizeof(stat_line) - 1);
+    close(stat_fd);
+    if (num_chars_read <= 0)
+    {
+        return false;
+    }
+    stat_line[num_chars_read] = '\0';
+
+    // The command name can contain spaces and parentheses, so start
+    // counting fields after the last ')', which ends field 2
+    char * field = strrchr(stat_line, ')');
+    if (!field)
+    {
+        return false;
+    }
+    for (int field_number = 2; field_number < 22; field_number++)
+    {
+        field = strchr(field + 1, ' ');
+        if (!field)
+        {
+            return false;
+        }
+    }
+    start_time = strtoull(field + 1, NULL, 10);
+    return true;
+}
+
+// Resolve a uid to a username, remembering the answer
+string UserCache::get_username_of_uid(uid_t uid, unique_lock<mutex>& lock)
+{
+    forget_usernames_if_passwd_changed();
+    auto found = usernames.find(uid);
+    if (found != usernames.end())
+    {
+        uid_hits++;
+        return found->second;
+    }
+
+    uid_misses++;
+    lock.unlock();
+    struct passwd password_entry;
+    struct passwd * result = NULL;
+    vector<char> string_buffer(16384);
+    string username;
+    if (getpwuid_r(uid, &password_entry, string_buffer.data(), 
+                   string_buffer.size(), &result) == 0 && result)
+    {
+        username = result->pw_name;
+    }
+    else
+    {
+        username = to_string(uid);
+    }
+    lock.lock();
+    usernames[uid] = username;
+    return username;
+}
+
+// Empty the uid cache when /etc/passwd has been replaced or modified
+void UserCache::forget_usernames_if_passwd_changed()
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (now - passwd_checked_time < passwd_check_interval)
+    {
+        return;
+    }
+    passwd_checked_time = now;
+
+    struct stat passwd_stat;
+    if (stat("/etc/passwd", &passwd_stat) == -1)
+    {
+        return;
+    }
+    if (passwd_stat.st_ino != passwd_inode ||
+        passwd_stat.st_mtim.tv_sec != passwd_mtime.tv_sec ||
+        passwd_stat.st_mtim.tv_nsec != passwd_mtime.tv_nsec)
+    {
+        usernames.clear();
+        passwd_inode = passwd_stat.st_ino;
+        passwd_mtime = passwd_stat.st_mtim;
+    }
+}
+
+// Cache a pid, evicting the least recently used one when full
+UserCache::PidEntry& UserCache::insert_pid(pid_t pid, uid_t uid,
+                                           const string& comm,
+                                           const string& username,
+                                           unsigned long long start_time)
+{
+    auto found = pid_entries.find(pid);
+    if (found == pid_entries.end())
+    {
+        while (pid_entries.size() >= capacity)
+        {
+            pid_entries.erase(lru_pids.back());
+            lru_pids.pop_back();
+        }
+        lru_pids.push_front(pid);
+        found = pid_entries.emplace(pid, PidEntry()).first;
+        found->second.lru_position = lru_pids.begin();
+    }
+    else
+    {
+        lru_pids.splice(lru_pids.begin(), lru_pids, 
+                        found->second.lru_position);
+    }
+
+    PidEntry& entry = found->second;
+    entry.uid = uid;
+    entry.comm = comm;
+    entry.has_exe = false;
+    entry.exe.clear();
+    entry.start_time = start_time;
+    entry.username = username;
+    return entry;
+}
@@ -0,0 +1,184 @@
+#ifndef USERCACHE_H
+#define USERCACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+using namespace std;
+
+// Caches which user owns a pid (and which program it runs) so that repeated
+//  events from the same process (e.g. a compiler opening thousands of
+//  headers) don't each pay for a /proc/<pid>/status parse and an NSS
+//  lookup. Entries are keyed on pid and remember the process start time,
+//  which every hit checks against /proc/<pid>/stat, so a recycled pid is
+//  detected and looked up again. Usernames are cached per uid and thrown
+//  away whenever /etc/passwd changes. Safe to share between writer threads:
+//  the cache lock is never held while /proc is read or NSS is asked (which
+//  may go over the network), so a slow lookup only holds up the thread
+//  making it.
+class UserCache
+{
+    public:
+        UserCache();
+
+        // Intro:   Sets the most pids that are remembered at once. The least
+        //              recently used pid is forgotten to make room.
+        // Inputs:  capacity : the number of pids to remember (at least 1)
+        // Outputs: None
+        // Return:  void
+        void set_capacity(size_t capacity);
+
+        // Intro:   Gets the username who owned the process of the given pid
+        // Inputs:  pid : the pid to fetch the username for
+        // Outputs: None
+        // Return:  Real username of user who owned pid, or 
+        //              CANNOT_FIND_USER_DEAD_PROCESS if the process exited
+        //              before it was ever looked up
+        string get_user_of_pid(pid_t pid);
+
+        // Intro:   Like get_user_of_pid(pid), but copies the username into
+        //              a buffer the caller reuses, so a cached pid is looked
+        //              up without allocating
+        // Inputs:  pid : the pid to fetch the username for
+        // Outputs: username : the username (see get_user_of_pid(pid))
+        // Return:  void
+        void get_user_of_pid(pid_t pid, string& username);
+
+        // Intro:   Gets the real uid of the process of the given pid
+        // Inputs:  pid : the pid to fetch the uid for
+        // Outputs: uid : the real uid of the process
+        // Return:  false if the process exited before it was ever looked up
+        bool get_uid_of_pid(pid_t pid, uid_t& uid);
+
+        // Intro:   Gets the command name and, if asked for, the executable
+        //              of the process of the given pid. The executable is
+        //              read the first time it is asked for and cached along
+        //              with the rest.
+        // Inputs:  pid : the pid to fetch the program for
+        //          need_exe : should exe be filled in?
+        // Outputs: comm : the command name (/proc/<pid>/comm)
+        //          exe : the executable's path (/proc/<pid>/exe), or empty
+        //              if it can't be read
+        // Return:  false if the process exited before it was ever looked up
+        bool get_program_of_pid(pid_t pid, bool need_exe, string& comm,
+                                string& exe);
+
+        // Lookups answered from the pid cache, and lookups that had to
+        // read the process (including recycled pids)
+        uint64_t get_pid_hits() const;
+        uint64_t get_pid_misses() const;
+        // Cached pids found to belong to a new process
+        uint64_t get_pid_recycles() const;
+        // Username lookups answered from the uid cache, and ones that
+        // went to NSS
+        uint64_t get_uid_hits() const;
+        uint64_t get_uid_misses() const;
+
+    private:
+        struct PidEntry
+        {
+            uid_t uid;
+            string username;
+            // Command name, and executable once has_exe is set
+            string comm;
+            bool has_exe;
+            string exe;
+            // Start time of the process (clock ticks since boot), which
+            // tells a recycled pid apart from the process we cached
+            unsigned long long start_time;
+            // Position of this pid in lru_pids
+            list<pid_t>::iterator lru_position;
+        };
+
+        // How often /etc/passwd is checked for changes
+        static const chrono::milliseconds passwd_check_interval;
+
+        size_t capacity;
+        unordered_map<pid_t, PidEntry> pid_entries;
+        // Cached pids, most recently used first
+        list<pid_t> lru_pids;
+        unordered_map<uid_t, string> usernames;
+        // Identity of /etc/passwd when usernames was last valid
+        struct timespec passwd_mtime;
+        ino_t passwd_inode;
+        chrono::steady_clock::time_point passwd_checked_time;
+        // Guards everything above. Let go of while reading /proc or asking
+        // NSS, so everything found before has to be looked up again after.
+        mutex cache_mutex;
+
+        atomic<uint64_t> pid_hits;
+        atomic<uint64_t> pid_misses;
+        atomic<uint64_t> pid_recycles;
+        atomic<uint64_t> uid_hits;
+        atomic<uint64_t> uid_misses;
+
+        UserCache(const UserCache&);
+        UserCache& operator=(const UserCache&);
+
+        // Intro:   Finds the cache entry for the process currently (or last)
+        //              running under pid, loading it on a miss and
+        //              replacing it if the pid was recycled
+        // Inputs:  pid : the process to find
+        //          lock : holds cache_mutex; unlocked while the process is
+        //              read, and locked again before returning
+        // Outputs: None
+        // Return:  The cache entry (valid until lock is unlocked), or NULL
+        //              if the process is gone and was never cached
+        PidEntry * find_process(pid_t pid, unique_lock<mutex>& lock);
+
+        // Intro:   Reads the real uid, command name and start time of a
+        //              process with readproc()
+        // Inputs:  pid : the process to read
+        // Outputs: uid : the real uid of the process
+        //          comm : the command name of the process
+        //          start_time : the start time of the process
+        // Return:  false if the process doesn't exist anymore
+        bool read_process(pid_t pid, uid_t& uid, string& comm,
+                          unsigned long long& start_time);
+
+        // Intro:   Reads only the start time of a process, from
+        //              /proc/<pid>/stat
+        // Inputs:  pid : the process to read
+        // Outputs: start_time : the start time of the process
+        // Return:  false if the process doesn't exist anymore
+        bool read_start_time(pid_t pid, unsigned long long& start_time);
+
+        // Intro:   Resolves a uid to a username through the uid cache,
+        //              falling back to NSS
+        // Inputs:  uid : the uid to resolve
+        //          lock : holds cache_mutex; unlocked while NSS is asked,
+        //              and locked again before returning
+        // Outputs: None
+        // Return:  The username, or the uid as a string if it has no name
+        string get_username_of_uid(uid_t uid, unique_lock<mutex>& lock);
+
+        // Intro:   Empties the uid cache if /etc/passwd changed since it was
+        //              filled. Checks at most once per passwd_check_interval.
+        //              cache_mutex must be held.
+        // Inputs:  None
+        // Outputs: None
+        // Return:  void
+        void forget_usernames_if_passwd_changed();
+
+        // Intro:   Adds or replaces the cache entry for a pid, evicting the
+        //              least recently used pid if the cache is full.
+        //              cache_mutex must be held.
+        // Inputs:  pid : the pid to cache
+        //          uid : the real uid of the process
+        //          comm : the command name of the process
+        //          username : the name of uid
+        //          start_time : the start time of the process
+        // Outputs: None
+        // Return:  The cache entry
+        PidEntry& insert_pid(pid_t pid, uid_t uid, const string& comm,
+                             const string& username,
+                             unsigned long long start_time);
+};
+
+#endif
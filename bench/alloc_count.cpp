@@ -0,0 +1,29 @@
+#include "alloc_count.hpp"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+atomic<uint64_t> allocation_count(0);
+
+void * operator new(size_t size)
+{
+    allocation_count++;
+    void * memory = malloc(size ? size : 1);
+    if (!memory)
+    {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void * memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void * memory, size_t) noexcept
+{
+    free(memory);
+}
@@ -0,0 +1,14 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+#include <atomic>
+#include <cstdint>
+
+// Counts the heap allocations a bench makes: bench/alloc_count.cpp replaces
+//  the global operator new/delete for every bench linked with it, so that
+//  the bench can check that a path it times doesn't allocate.
+
+// Heap allocations made by this process so far
+extern std::atomic<uint64_t> allocation_count;
+
+#endif
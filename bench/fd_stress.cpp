@@ -0,0 +1,174 @@
+// Stress benchmark for dirmon's event fd lifecycle. Opens and closes files
+//  in a monitored directory from several threads, millions of times, while
+//  sampling how many fds the running dirmon process holds and how many
+//  opens per second get through. A healthy dirmon keeps a flat fd count
+//  during the storm, returns to its starting count afterwards, and keeps a
+//  steady throughput.
+//
+// Usage: fd_stress DIRMON_PID MONITORED_DIRECTORY [TOTAL_OPENS] [THREADS]
+//                  [FILES]
+//  Must run as root (to read /proc/DIRMON_PID/fd). Exits with 1 if dirmon
+//  ends up holding more fds than it started with.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Number of entries in /proc/<pid>/fd, or -1 if the process is gone
+long count_open_fds(pid_t pid)
+{
+    string fd_dir_path = "/proc/" + to_string(pid) + "/fd";
+    DIR * fd_dir = opendir(fd_dir_path.c_str());
+    if (!fd_dir)
+    {
+        return -1;
+    }
+    long num_fds = 0;
+    while (struct dirent * entry = readdir(fd_dir))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            num_fds++;
+        }
+    }
+    closedir(fd_dir);
+    return num_fds;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: fd_stress DIRMON_PID MONITORED_DIRECTORY "
+             << "[TOTAL_OPENS] [THREADS] [FILES]" << endl;
+        return 2;
+    }
+    pid_t dirmon_pid = atoi(argv[1]);
+    string file_dir = string(argv[2]) + "/fd_stress_files";
+    unsigned long long total_opens = argc > 3 ? strtoull(argv[3], NULL, 10) 
+                                              : 2000000;
+    unsigned int num_threads = argc > 4 ? atoi(argv[4]) : 4;
+    unsigned int num_files = argc > 5 ? atoi(argv[5]) : 1000;
+
+    // Create the files up front so the storm is only opens and closes
+    mkdir(file_dir.c_str(), 0755);
+    vector<string> file_paths;
+    for (unsigned int i = 0; i < num_files; i++)
+    {
+        file_paths.push_back(file_dir + "/file_" + to_string(i));
+        int fd = open(file_paths.back().c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd == -1)
+        {
+            cerr << "fd_stress: cannot create '" << file_paths.back() 
+                 << "'" << endl;
+            return 2;
+        }
+        close(fd);
+    }
+
+    // Let dirmon work off the creation events before taking the baseline
+    sleep(2);
+    long initial_fds = count_open_fds(dirmon_pid);
+    if (initial_fds == -1)
+    {
+        cerr << "fd_stress: no process with pid " << dirmon_pid << endl;
+        return 2;
+    }
+
+    atomic<unsigned long long> opens_done(0);
+    atomic<unsigned long long> open_failures(0);
+    vector<thread> workers;
+    for (unsigned int t = 0; t < num_threads; t++)
+    {
+        workers.emplace_back([&, t] {
+            size_t file_index = t;
+            while (opens_done.fetch_add(1) < total_opens)
+            {
+                int fd = open(file_paths[file_index % num_files].c_str(), 
+                              O_RDONLY);
+                if (fd == -1)
+                {
+                    open_failures++;
+                }
+                else
+                {
+                    close(fd);
+                }
+                file_index += num_threads;
+            }
+        });
+    }
+
+    // Sample once a second while the workers run
+    cout << "second  opens/s  dirmon_fds" << endl;
+    vector<double> rates;
+    long max_fds = initial_fds;
+    unsigned long long last_opens = 0;
+    for (unsigned int second = 1; 
+         min(opens_done.load(), total_opens) < total_opens; 
+         second++)
+    {
+        this_thread::sleep_for(chrono::seconds(1));
+        unsigned long long opens_now = min(opens_done.load(), total_opens);
+        long fds_now = count_open_fds(dirmon_pid);
+        rates.push_back(opens_now - last_opens);
+        last_opens = opens_now;
+        max_fds = max(max_fds, fds_now);
+        cout << second << "  " << (unsigned long long) rates.back() 
+             << "  " << fds_now << endl;
+    }
+    for (auto worker = workers.begin(); worker != workers.end(); worker++)
+    {
+        worker->join();
+    }
+
+    // Give dirmon a moment to drain, then check nothing was left open
+    sleep(2);
+    long final_fds = count_open_fds(dirmon_pid);
+    for (auto path = file_paths.begin(); path != file_paths.end(); path++)
+    {
+        unlink(path->c_str());
+    }
+    rmdir(file_dir.c_str());
+
+    double mean_rate = 0;
+    for (auto rate = rates.begin(); rate != rates.end(); rate++)
+    {
+        mean_rate += *rate;
+    }
+    mean_rate /= max<size_t>(rates.size(), 1);
+    double variance = 0;
+    for (auto rate = rates.begin(); rate != rates.end(); rate++)
+    {
+        variance += (*rate - mean_rate) * (*rate - mean_rate);
+    }
+    variance /= max<size_t>(rates.size(), 1);
+
+    cout << "opens: " << total_opens << " (" << open_failures 
+         << " failed)" << endl;
+    cout << "throughput: mean " << (unsigned long long) mean_rate 
+         << " opens/s, coefficient of variation " 
+         << (mean_rate > 0 ? sqrt(variance) / mean_rate : 0) << endl;
+    cout << "dirmon fds: initial " << initial_fds << ", peak " << max_fds 
+         << ", final " << final_fds << endl;
+    if (final_fds > initial_fds)
+    {
+        cout << "FAIL: dirmon holds " << final_fds - initial_fds 
+             << " more fds than before the storm" << endl;
+        return 1;
+    }
+    cout << "PASS: dirmon fd count returned to its baseline" << endl;
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Microbenchmark for text event formatting. Formats the same stream of
+//  events the way write_event used to (a string per field, to_string for
+//  the numbers, += per access type, asctime per event) and the way it does
+//  now (append_text_event into a reused line buffer), counting heap
+//  allocations and timing both. The new path should allocate nothing once
+//  the buffer has grown to the size of a line. Afterwards (untimed) every
+//  event is formatted both ways again and the lines compared byte for
+//  byte, so the rewrite is shown to keep the text format as it was.
+//
+// Usage: format_alloc [EVENTS]
+//  Defaults to 1000000 events. Exits with 1 if the new path allocated or
+//  any line differs.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/fanotify.h>
+#include <vector>
+
+#include "../EventFormat.hpp"
+#include "alloc_count.hpp"
+
+using namespace std;
+
+// The formatting as it was before append_text_event, for comparison
+string old_access_type_mask_to_string(unsigned long long mask)
+{
+    string access_string = "(";
+    const pair<unsigned long long, const char *> access_types[] = {
+        {FAN_ACCESS, "FAN_ACCESS;"}, {FAN_OPEN, "FAN_OPEN;"},
+        {FAN_MODIFY, "FAN_MODIFY;"}, {FAN_CLOSE_WRITE, "FAN_CLOSE_WRITE;"},
+        {FAN_CLOSE_NOWRITE, "FAN_CLOSE_NOWRITE;"},
+        {FAN_Q_OVERFLOW, "FAN_Q_OVERFLOW;"},
+        {FAN_ACCESS_PERM, "FAN_ACCESS_PERM;"},
+        {FAN_OPEN_PERM, "FAN_OPEN_PERM;"}};
+    for (auto& access_type : access_types)
+    {
+        if (mask & access_type.first)
+        {
+            access_string += access_type.second;
+        }
+    }
+    if (access_string[access_string.length()-1] == ';')
+    {
+        access_string[access_string.length()-1] = ')';
+    }
+    else
+    {
+        access_string += ")";
+    }
+    return access_string;
+}
+
+string old_format_text_event(const string& filepath, time_t system_time,
+                             const string& username, pid_t pid,
+                             unsigned long long mask)
+{
+    tm UTC_time;
+    gmtime_r(&system_time, &UTC_time);
+    char time_buf[32];
+    string UTC_time_str(asctime_r(&UTC_time, time_buf));
+    UTC_time_str.erase(UTC_time_str.end()-1);
+    UTC_time_str += "(UTC)";
+
+    string event_str = "";
+    event_str += filepath + ",";
+    event_str += UTC_time_str + ",";
+    event_str += username + ",";
+    event_str += to_string(pid) + ",";
+    event_str += old_access_type_mask_to_string(mask) + ",";
+    event_str += '\n';
+    return event_str;
+}
+
+int main(int argc, char * argv[])
+{
+    unsigned long num_events = argc > 1 ? strtoul(argv[1], NULL, 10)
+                                        : 1000000;
+
+    // Typical build-tree paths and a username too long for the small
+    // string optimization
+    vector<string> paths;
+    for (unsigned int i = 0; i < 64; i++)
+    {
+        paths.push_back("/srv/projects/dirmon/build/objects/module" +
+                        to_string(i) + "/DirectoryListAuditor.o");
+    }
+    string username = "build-automation";
+    const unsigned long long masks[] = {
+        FAN_OPEN_PERM, FAN_OPEN | FAN_CLOSE_NOWRITE,
+        FAN_OPEN | FAN_MODIFY | FAN_CLOSE_WRITE, FAN_ACCESS};
+    time_t start_time = time(0);
+
+    // Events arrive a few thousand per second, so the time changes now
+    // and then
+    size_t old_bytes = 0;
+    uint64_t allocations_before = allocation_count.load();
+    auto old_start = chrono::steady_clock::now();
+    for (unsigned long i = 0; i < num_events; i++)
+    {
+        string line = old_format_text_event(paths[i % paths.size()],
+                                            start_time + i / 4096, username,
+                                            1000 + i % 300, masks[i % 4]);
+        old_bytes += line.size();
+    }
+    auto old_end = chrono::steady_clock::now();
+    uint64_t old_allocations = allocation_count.load() - allocations_before;
+
+    string line;
+    line.reserve(512);
+    size_t new_bytes = 0;
+    allocations_before = allocation_count.load();
+    auto new_start = chrono::steady_clock::now();
+    for (unsigned long i = 0; i < num_events; i++)
+    {
+        line.clear();
+        append_text_event(line, paths[i % paths.size()],
+                          (start_time + i / 4096) * 1000000000ULL, username,
+                          1000 + i % 300, masks[i % 4]);
+        new_bytes += line.size();
+    }
+    auto new_end = chrono::steady_clock::now();
+    uint64_t new_allocations = allocation_count.load() - allocations_before;
+
+    double old_ns = chrono::duration<double, nano>(old_end - old_start).count();
+    double new_ns = chrono::duration<double, nano>(new_end - new_start).count();
+    cout << "events:                 " << num_events << endl;
+    cout << "old: allocations/event: " << (double) old_allocations / num_events
+         << ", " << old_ns / num_events << " ns/event" << endl;
+    cout << "new: allocations/event: " << (double) new_allocations / num_events
+         << ", " << new_ns / num_events << " ns/event" << endl;
+
+    // Same events again, one line at a time
+    for (unsigned long i = 0; i < num_events; i++)
+    {
+        string old_line = old_format_text_event(paths[i % paths.size()],
+                                                start_time + i / 4096,
+                                                username, 1000 + i % 300,
+                                                masks[i % 4]);
+        line.clear();
+        append_text_event(line, paths[i % paths.size()],
+                          (start_time + i / 4096) * 1000000000ULL, username,
+                          1000 + i % 300, masks[i % 4]);
+        if (line != old_line)
+        {
+            cout << "FAIL: the two formats differ at event " << i << endl
+                 << "old: " << old_line << "new: " << line;
+            return 1;
+        }
+    }
+    if (old_bytes != new_bytes)
+    {
+        cout << "FAIL: the two formats differ in length" << endl;
+        return 1;
+    }
+    if (new_allocations != 0)
+    {
+        cout << "FAIL: formatting allocated" << endl;
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
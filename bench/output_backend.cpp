@@ -0,0 +1,105 @@
+// Benchmark for the audit output backends: AuditWriter committing with
+//  write(2) from the appending thread against queueing the commits on an
+//  io_uring. Appends audit-sized lines as fast as possible from one thread
+//  (standing in for a writer thread) and reports events per second and the
+//  latency of each append, which includes the commits it triggers. That
+//  latency is what holds up the event loop when the disk is slow.
+//
+// Usage: output_backend DIRECTORY [EVENTS] [BATCH_BYTES] [SYNC]
+//  Writes (and removes) a scratch file in DIRECTORY. Defaults to 1000000
+//  events in 65536-byte batches without syncing; SYNC=1 syncs every batch,
+//  which is where queueing the commits matters most.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "../AuditWriter.hpp"
+
+using namespace std;
+
+struct RunResult
+{
+    double seconds;
+    vector<uint32_t> latencies_ns;
+};
+
+RunResult run(const string& filename, unsigned int io_uring_buffers,
+              unsigned long num_events, size_t batch_bytes, bool sync)
+{
+    RunResult result;
+    unlink(filename.c_str());
+    AuditWriter audit_writer;
+    if (!audit_writer.open(filename, batch_bytes, chrono::milliseconds(10),
+                           sync))
+    {
+        cerr << "output_backend: cannot open '" << filename << "'" << endl;
+        exit(1);
+    }
+    if (io_uring_buffers > 0 && !audit_writer.use_io_uring(io_uring_buffers))
+    {
+        cerr << "output_backend: io_uring is not available" << endl;
+        exit(1);
+    }
+
+    string line = "/srv/projects/dirmon/src/DirectoryListAuditor.cpp,"
+                  "Sun Oct 18 01:48:41 2026(UTC),builder,20494,"
+                  "(FAN_OPEN;FAN_CLOSE_NOWRITE),\n";
+    result.latencies_ns.reserve(num_events);
+    auto start = chrono::steady_clock::now();
+    for (unsigned long i = 0; i < num_events; i++)
+    {
+        auto append_start = chrono::steady_clock::now();
+        audit_writer.append(line.data(), line.size());
+        auto append_end = chrono::steady_clock::now();
+        result.latencies_ns.push_back(
+            chrono::duration_cast<chrono::nanoseconds>(
+                append_end - append_start).count());
+    }
+    audit_writer.close();
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                              start).count();
+    unlink(filename.c_str());
+    return result;
+}
+
+void print_result(const string& name, RunResult& result,
+                  unsigned long num_events)
+{
+    vector<uint32_t>& latencies_ns = result.latencies_ns;
+    sort(latencies_ns.begin(), latencies_ns.end());
+    auto percentile = [&latencies_ns](double fraction) {
+        return latencies_ns[min(latencies_ns.size() - 1,
+                                (size_t) (fraction * latencies_ns.size()))];
+    };
+    cout << name << ": " << (uint64_t) (num_events / result.seconds)
+         << " events/s, append latency p50 " << percentile(0.50)
+         << " ns, p99 " << percentile(0.99) << " ns, p99.9 "
+         << percentile(0.999) << " ns, max " << latencies_ns.back()
+         << " ns" << endl;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: output_backend DIRECTORY [EVENTS] [BATCH_BYTES] "
+             << "[SYNC]" << endl;
+        return 1;
+    }
+    string filename = string(argv[1]) + "/output_backend.audit";
+    unsigned long num_events = argc > 2 ? strtoul(argv[2], NULL, 10)
+                                        : 1000000;
+    size_t batch_bytes = argc > 3 ? strtoul(argv[3], NULL, 10) : 65536;
+    bool sync = argc > 4 && strtoul(argv[4], NULL, 10) != 0;
+
+    RunResult written = run(filename, 0, num_events, batch_bytes, sync);
+    RunResult queued = run(filename, 8, num_events, batch_bytes, sync);
+    print_result("write   ", written, num_events);
+    print_result("io_uring", queued, num_events);
+    return 0;
+}
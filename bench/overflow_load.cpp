@@ -0,0 +1,159 @@
+// Load generator for finding how much headroom a dirmon configuration has
+//  before the kernel's fanotify queue overflows. Opens and closes files in
+//  a monitored directory at a fixed rate for a few seconds, then looks for
+//  the FANOTIFY_QUEUE_OVERFLOW markers dirmon writes to its (text) audit
+//  output when the kernel drops events. The rate doubles each step until
+//  either an overflow shows up or the openers can't keep up with the rate
+//  any more (permission events hold every open until dirmon answers, so
+//  they throttle the load instead of overflowing). Audit only non-
+//  permission events (e.g. dirmon --OPEN --CLOSE_NOWRITE ...) to measure
+//  the queue. Stop dirmon with SIGSTOP during a step to force an overflow.
+//  The kernel merges an unread event into an earlier one for the same file
+//  and process, so the load cycles through more files than the queue holds
+//  (16384 events by default).
+//
+// Usage: overflow_load MONITORED_DIRECTORY AUDIT_FILE [START_RATE]
+//                      [STEP_SECONDS] [THREADS] [FILES]
+//  Defaults to 10000 opens/s, 3 second steps, 4 threads and 32768 files.
+//  Reports the highest rate that got through without an overflow.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Open (and close) files at this thread's share of the rate until the
+//  deadline, sleeping whenever it is ahead. Each thread starts at its own
+//  place in the files.
+void open_files(const string& directory, unsigned int num_files,
+                unsigned int first_file, double opens_per_second,
+                chrono::steady_clock::time_point end,
+                atomic<uint64_t>& opens_done)
+{
+    auto start = chrono::steady_clock::now();
+    uint64_t opens = 0;
+    for (auto now = start; now < end; now = chrono::steady_clock::now())
+    {
+        double elapsed = chrono::duration<double>(now - start).count();
+        uint64_t opens_due = elapsed * opens_per_second;
+        if (opens >= opens_due)
+        {
+            this_thread::sleep_for(chrono::microseconds(200));
+            continue;
+        }
+        for (; opens < opens_due; opens++)
+        {
+            string path = directory + "/overflow_load_" +
+                          to_string((first_file + opens) % num_files);
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd != -1)
+            {
+                close(fd);
+            }
+        }
+    }
+    opens_done += opens;
+}
+
+// Count the overflow markers in the audit file past the given offset,
+//  moving the offset to the end of what was read
+uint64_t count_overflow_markers(const string& audit_filename,
+                                streamoff& offset)
+{
+    ifstream audit_file(audit_filename);
+    audit_file.seekg(offset);
+    uint64_t markers = 0;
+    string line;
+    while (getline(audit_file, line))
+    {
+        markers += line.compare(0, 23, "FANOTIFY_QUEUE_OVERFLOW") == 0;
+        offset += line.size() + 1;
+    }
+    return markers;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: overflow_load MONITORED_DIRECTORY AUDIT_FILE "
+             << "[START_RATE] [STEP_SECONDS] [THREADS] [FILES]" << endl;
+        return 1;
+    }
+    string directory(argv[1]);
+    string audit_filename(argv[2]);
+    double rate = argc > 3 ? strtod(argv[3], NULL) : 10000;
+    unsigned int step_seconds = argc > 4 ? strtoul(argv[4], NULL, 10) : 3;
+    unsigned int num_threads = argc > 5 ? strtoul(argv[5], NULL, 10) : 4;
+    unsigned int num_files = argc > 6 ? strtoul(argv[6], NULL, 10) : 32768;
+
+    for (unsigned int i = 0; i < num_files; i++)
+    {
+        string path = directory + "/overflow_load_" + to_string(i);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd == -1)
+        {
+            cerr << "overflow_load: cannot create '" << path << "'" << endl;
+            return 1;
+        }
+        close(fd);
+    }
+
+    ifstream audit_file(audit_filename, ios::ate);
+    streamoff offset = audit_file.is_open() ? (streamoff) audit_file.tellg()
+                                            : 0;
+    double headroom = 0;
+    for (;;)
+    {
+        atomic<uint64_t> opens_done(0);
+        auto end = chrono::steady_clock::now() +
+                   chrono::seconds(step_seconds);
+        vector<thread> openers;
+        for (unsigned int i = 0; i < num_threads; i++)
+        {
+            openers.emplace_back(open_files, directory, num_files,
+                                 i * num_files / num_threads,
+                                 rate / num_threads, end, ref(opens_done));
+        }
+        for (auto opener = openers.begin(); opener != openers.end();
+             opener++)
+        {
+            opener->join();
+        }
+        // Let dirmon catch up and commit before looking at its output
+        this_thread::sleep_for(chrono::seconds(1));
+        uint64_t markers = count_overflow_markers(audit_filename, offset);
+        double achieved = (double) opens_done / step_seconds;
+        cout << "rate " << (uint64_t) rate << " opens/s: achieved "
+             << (uint64_t) achieved << " opens/s, " << markers
+             << " queue overflows" << endl;
+        if (markers > 0)
+        {
+            cout << "headroom: " << (uint64_t) headroom
+                 << " opens/s without an overflow" << endl;
+            break;
+        }
+        headroom = achieved;
+        if (achieved < rate * 0.9)
+        {
+            cout << "headroom: no overflow up to " << (uint64_t) achieved
+                 << " opens/s, where the openers saturated" << endl;
+            break;
+        }
+        rate *= 2;
+    }
+
+    for (unsigned int i = 0; i < num_files; i++)
+    {
+        unlink((directory + "/overflow_load_" + to_string(i)).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+// Microbenchmark for carrying event paths through the pipeline. Runs the
+//  same stream of paths, with a window of events in flight as in the event
+//  ring, the way events used to carry them (a std::string copied out of
+//  the readlink buffer per event) and the way they do now (a PathRef
+//  interned in a PathTable), counting heap allocations and timing both.
+//  Either way each event's path is then looked up in a per-session path
+//  dictionary, as the binary encoder does: by the copied string before,
+//  by the PathRef's id and generation now. Once every path of the working
+//  set is interned, the new path should not allocate at all. With more
+//  than one thread (as with several reader shards and writers sharing the
+//  table) each thread runs its own stream, and the table is timed both
+//  with a single lock and with its stripes, to show how much the stripes
+//  take off the lock.
+// The stream repeats paths the way a build does, a few headers over and
+//  over and most files now and then (a Zipf distribution over the paths),
+//  or, with "uniform", every path equally often, which defeats any cache
+//  smaller than the working set.
+//
+// Usage: path_intern [EVENTS] [DISTINCT_PATHS] [IN_FLIGHT] [THREADS]
+//                    [zipf|uniform]
+//  Defaults to 1000000 events over 4096 paths with 1024 events in flight,
+//  on 1 thread, Zipf distributed. EVENTS is the total over all threads.
+//  Exits with 1 if the new path allocated after warming up.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../PathTable.hpp"
+#include "alloc_count.hpp"
+
+using namespace std;
+
+// Run one stream per thread, all starting together once every thread is
+//  set up (so that starting threads isn't timed or counted). Returns the
+//  nanoseconds until the last stream finished, and counts the allocations
+//  made in between.
+double run_streams(unsigned long num_threads,
+                   const function<void(unsigned long)>& stream,
+                   uint64_t& allocations)
+{
+    atomic<unsigned long> ready(0);
+    atomic<unsigned long> finished(0);
+    atomic<bool> go(false);
+    vector<thread> threads;
+    for (unsigned long index = 0; index < num_threads; index++)
+    {
+        threads.emplace_back([&, index]()
+        {
+            ready++;
+            while (!go)
+            {
+                this_thread::yield();
+            }
+            stream(index);
+            finished++;
+        });
+    }
+    while (ready < num_threads)
+    {
+        this_thread::yield();
+    }
+    uint64_t allocations_before = allocation_count.load();
+    auto start = chrono::steady_clock::now();
+    go = true;
+    while (finished < num_threads)
+    {
+        this_thread::yield();
+    }
+    auto end = chrono::steady_clock::now();
+    allocations = allocation_count.load() - allocations_before;
+    for (auto& stream_thread : threads)
+    {
+        stream_thread.join();
+    }
+    return chrono::duration<double, nano>(end - start).count();
+}
+
+// Draw the order a thread's events visit the paths in. Ranks are given to
+//  the paths at random, so the popular ones are no particular paths.
+vector<uint32_t> make_sequence(unsigned long num_events,
+                               unsigned long num_paths, bool zipf,
+                               unsigned int seed)
+{
+    mt19937 random(seed);
+    vector<uint32_t> path_of_rank(num_paths);
+    for (unsigned long rank = 0; rank < num_paths; rank++)
+    {
+        path_of_rank[rank] = rank;
+    }
+    shuffle(path_of_rank.begin(), path_of_rank.end(), random);
+    vector<double> cumulative(num_paths);
+    double total = 0;
+    for (unsigned long rank = 0; rank < num_paths; rank++)
+    {
+        total += zipf ? 1.0 / (rank + 1) : 1.0;
+        cumulative[rank] = total;
+    }
+    uniform_real_distribution<double> draw(0, total);
+    vector<uint32_t> sequence(num_events);
+    for (auto& path : sequence)
+    {
+        size_t rank = lower_bound(cumulative.begin(), cumulative.end(),
+                                  draw(random)) - cumulative.begin();
+        path = path_of_rank[min<size_t>(rank, num_paths - 1)];
+    }
+    return sequence;
+}
+
+int main(int argc, char * argv[])
+{
+    unsigned long num_events = argc > 1 ? strtoul(argv[1], NULL, 10)
+                                        : 1000000;
+    unsigned long num_paths = argc > 2 ? strtoul(argv[2], NULL, 10) : 4096;
+    unsigned long in_flight = argc > 3 ? strtoul(argv[3], NULL, 10) : 1024;
+    unsigned long num_threads = argc > 4 ? strtoul(argv[4], NULL, 10) : 1;
+    bool zipf = argc <= 5 || string(argv[5]) != "uniform";
+    num_paths = max(num_paths, 1ul);
+    in_flight = max(in_flight, 1ul);
+    num_threads = max(num_threads, 1ul);
+    unsigned long events_per_thread = num_events / num_threads;
+    num_events = events_per_thread * num_threads;
+
+    // Build-tree paths, a few of them longer than the 1024 bytes the old
+    // readlink buffer held
+    vector<string> paths;
+    for (unsigned long i = 0; i < num_paths; i++)
+    {
+        string path = "/srv/projects/dirmon/build/objects/module" +
+                      to_string(i % 97) + "/";
+        if (i % 512 == 0)
+        {
+            path += string(1500, 'd') + "/";
+        }
+        paths.push_back(path + "DirectoryListAuditor" + to_string(i) + ".o");
+    }
+    // Each thread visits the paths in an order of its own
+    vector<vector<uint32_t>> sequences;
+    for (unsigned long index = 0; index < num_threads; index++)
+    {
+        sequences.push_back(make_sequence(events_per_thread, num_paths,
+                                          zipf, 42 + index));
+    }
+
+    // What readlink() leaves in each reader's buffer for each event, the
+    // events in flight and each thread's path dictionary, set up (with
+    // every path already in the dictionary) before the streams start
+    vector<string> read_buffers(num_threads);
+    vector<vector<string>> old_rings(num_threads, vector<string>(in_flight));
+    vector<unordered_map<string, uint32_t>> old_dictionaries(num_threads);
+    vector<string> lookup_paths(num_threads);
+    for (unsigned long index = 0; index < num_threads; index++)
+    {
+        read_buffers[index].reserve(4096);
+        lookup_paths[index].reserve(4096);
+        for (unsigned long i = 0; i < num_paths; i++)
+        {
+            old_dictionaries[index].emplace(paths[i], i);
+        }
+    }
+    vector<size_t> old_bytes(num_threads, 0);
+    uint64_t old_allocations;
+    double old_ns = run_streams(num_threads, [&](unsigned long index)
+    {
+        string& read_buffer = read_buffers[index];
+        vector<string>& old_ring = old_rings[index];
+        const vector<uint32_t>& sequence = sequences[index];
+        unordered_map<string, uint32_t>& dictionary =
+            old_dictionaries[index];
+        string& lookup_path = lookup_paths[index];
+        for (unsigned long i = 0; i < events_per_thread; i++)
+        {
+            read_buffer.assign(paths[sequence[i]]);
+            string& slot = old_ring[i % in_flight];
+            slot = string(read_buffer);
+            lookup_path.assign(slot);
+            auto found = dictionary.find(lookup_path);
+            old_bytes[index] += slot.size() + (found != dictionary.end());
+        }
+    }, old_allocations);
+
+    cout << "events:                 " << num_events << " over " << num_paths
+         << " paths (" << (zipf ? "zipf" : "uniform") << "), " << in_flight
+         << " in flight, " << num_threads << " threads" << endl;
+    cout << "old: allocations/event: " << (double) old_allocations / num_events
+         << ", " << old_ns / num_events << " ns/event" << endl;
+
+    bool passed = true;
+    const unsigned int stripe_counts[] = {1, PathTable::DEFAULT_STRIPES};
+    for (unsigned int num_stripes : stripe_counts)
+    {
+        // Each stripe keeps an even share of the capacity, and paths don't
+        // hash perfectly evenly, so leave room for the fullest stripe
+        PathTable path_table(num_stripes);
+        path_table.set_capacity(num_paths * 2);
+        vector<vector<PathRef>> new_rings(num_threads);
+        vector<unordered_map<uint64_t, uint32_t>> new_dictionaries(
+            num_threads);
+        for (auto& new_ring : new_rings)
+        {
+            new_ring.resize(in_flight);
+        }
+        // Warm the table and the dictionaries up with every path once
+        for (unsigned long i = 0; i < num_paths; i++)
+        {
+            PathRef& slot = new_rings[0][i % in_flight];
+            slot = path_table.intern(paths[i]);
+            for (auto& dictionary : new_dictionaries)
+            {
+                dictionary.emplace((uint64_t) slot.get_generation() << 32 |
+                                   slot.get_id(), i);
+            }
+        }
+        vector<size_t> new_bytes(num_threads, 0);
+        uint64_t new_allocations;
+        double new_ns = run_streams(num_threads, [&](unsigned long index)
+        {
+            string& read_buffer = read_buffers[index];
+            vector<PathRef>& new_ring = new_rings[index];
+            const vector<uint32_t>& sequence = sequences[index];
+            unordered_map<uint64_t, uint32_t>& dictionary =
+                new_dictionaries[index];
+            for (unsigned long i = 0; i < events_per_thread; i++)
+            {
+                read_buffer.assign(paths[sequence[i]]);
+                PathRef& slot = new_ring[i % in_flight];
+                slot = path_table.intern(read_buffer);
+                auto found = dictionary.find(
+                    (uint64_t) slot.get_generation() << 32 | slot.get_id());
+                new_bytes[index] += slot.get().size() +
+                                    (found != dictionary.end());
+            }
+        }, new_allocations);
+
+        cout << "new: " << num_stripes << " stripe(s), allocations/event: "
+             << (double) new_allocations / num_events << ", "
+             << new_ns / num_events << " ns/event, "
+             << path_table.get_arena_bytes() << " arena bytes" << endl;
+        if (new_bytes != old_bytes)
+        {
+            cout << "FAIL: the paths differ" << endl;
+            passed = false;
+        }
+        if (new_allocations != 0)
+        {
+            cout << "FAIL: interning allocated" << endl;
+            passed = false;
+        }
+    }
+    if (!passed)
+    {
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
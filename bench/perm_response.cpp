@@ -0,0 +1,205 @@
+// Benchmark for answering fanotify permission events one write() per event
+//  against one writev() per read batch (as dirmon does). Marks a directory
+//  for FAN_OPEN_PERM on its own fanotify group, then opens files in it from
+//  several threads as fast as possible, once with each way of answering.
+//  Reports opens per second, reads, response syscalls and events per read
+//  for both. Needs several opener threads to get batches of more than one
+//  event, since every opener waits on its own response.
+//
+// Usage: perm_response DIRECTORY [TOTAL_OPENS] [THREADS] [FILES]
+//  Must run as root (fanotify). DIRECTORY should not be watched by a
+//  running dirmon.
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <sys/fanotify.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+struct RunResult
+{
+    double seconds;
+    uint64_t reads;
+    uint64_t response_syscalls;
+    uint64_t events;
+};
+
+// Read and answer permission events until told to stop
+void answer_events(int fanotify_fd, bool batch_responses,
+                   atomic<bool>& running, RunResult& result)
+{
+    alignas(struct fanotify_event_metadata) char buffer[65536];
+    vector<struct fanotify_response> responses;
+    vector<struct iovec> iovecs;
+    struct pollfd fanotify_poll = {fanotify_fd, POLLIN, 0};
+    while (running)
+    {
+        if (poll(&fanotify_poll, 1, 100) <= 0)
+        {
+            continue;
+        }
+        ssize_t num_bytes_read = read(fanotify_fd, buffer, sizeof(buffer));
+        if (num_bytes_read <= 0)
+        {
+            continue;
+        }
+        result.reads++;
+        responses.clear();
+        for (struct fanotify_event_metadata * event =
+                 (struct fanotify_event_metadata *) buffer;
+             FAN_EVENT_OK(event, num_bytes_read);
+             event = FAN_EVENT_NEXT(event, num_bytes_read))
+        {
+            result.events++;
+            struct fanotify_response response = {event->fd, FAN_ALLOW};
+            if (!batch_responses)
+            {
+                write(fanotify_fd, &response, sizeof(response));
+                result.response_syscalls++;
+                close(event->fd);
+            }
+            else
+            {
+                responses.push_back(response);
+            }
+        }
+        if (batch_responses)
+        {
+            iovecs.resize(responses.size());
+            for (size_t i = 0; i < responses.size(); i++)
+            {
+                iovecs[i].iov_base = &responses[i];
+                iovecs[i].iov_len = sizeof(struct fanotify_response);
+            }
+            for (size_t next = 0; next < iovecs.size();)
+            {
+                int num_iovecs = min(iovecs.size() - next, (size_t) IOV_MAX);
+                ssize_t num_bytes_written = writev(fanotify_fd, &iovecs[next],
+                                                   num_iovecs);
+                result.response_syscalls++;
+                next += num_bytes_written > 0 ?
+                        num_bytes_written / sizeof(struct fanotify_response) :
+                        1;
+            }
+            for (size_t i = 0; i < responses.size(); i++)
+            {
+                close(responses[i].fd);
+            }
+        }
+    }
+}
+
+// Open (and close) files in the directory until the shared count runs out
+void open_files(const string& directory, unsigned int num_files,
+                atomic<long>& opens_left)
+{
+    for (unsigned long i = 0; opens_left-- > 0; i++)
+    {
+        string path = directory + "/perm_response_" +
+                      to_string(i % num_files);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+    }
+}
+
+RunResult run(const string& directory, bool batch_responses, long total_opens,
+              unsigned int num_threads, unsigned int num_files)
+{
+    RunResult result = {0, 0, 0, 0};
+    int fanotify_fd = fanotify_init(FAN_CLASS_CONTENT | FAN_CLOEXEC, O_RDONLY);
+    if (fanotify_fd == -1 ||
+        fanotify_mark(fanotify_fd, FAN_MARK_ADD,
+                      FAN_OPEN_PERM | FAN_EVENT_ON_CHILD,
+                      AT_FDCWD, directory.c_str()) == -1)
+    {
+        cerr << "perm_response: cannot set up fanotify: " << strerror(errno)
+             << endl;
+        exit(1);
+    }
+    atomic<bool> running(true);
+    thread reader(answer_events, fanotify_fd, batch_responses,
+                  ref(running), ref(result));
+
+    atomic<long> opens_left(total_opens);
+    auto start = chrono::steady_clock::now();
+    vector<thread> openers;
+    for (unsigned int i = 0; i < num_threads; i++)
+    {
+        openers.emplace_back(open_files, directory, num_files,
+                             ref(opens_left));
+    }
+    for (auto opener = openers.begin(); opener != openers.end(); opener++)
+    {
+        opener->join();
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                              start).count();
+    running = false;
+    reader.join();
+    close(fanotify_fd);
+    return result;
+}
+
+void print_result(const string& name, const RunResult& result,
+                  long total_opens)
+{
+    cout << name << ": " << (uint64_t) (total_opens / result.seconds)
+         << " opens/s, " << result.reads << " reads, "
+         << result.response_syscalls << " response syscalls, "
+         << (result.reads ? (double) result.events / result.reads : 0)
+         << " events/read" << endl;
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: perm_response DIRECTORY [TOTAL_OPENS] [THREADS] "
+             << "[FILES]" << endl;
+        return 1;
+    }
+    string directory(argv[1]);
+    long total_opens = argc > 2 ? strtol(argv[2], NULL, 10) : 200000;
+    unsigned int num_threads = argc > 3 ? strtoul(argv[3], NULL, 10) : 8;
+    unsigned int num_files = argc > 4 ? strtoul(argv[4], NULL, 10) : 64;
+
+    for (unsigned int i = 0; i < num_files; i++)
+    {
+        string path = directory + "/perm_response_" + to_string(i);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd == -1)
+        {
+            cerr << "perm_response: cannot create '" << path << "': "
+                 << strerror(errno) << endl;
+            return 1;
+        }
+        close(fd);
+    }
+
+    RunResult single = run(directory, false, total_opens, num_threads,
+                           num_files);
+    RunResult batched = run(directory, true, total_opens, num_threads,
+                            num_files);
+    print_result("write per event ", single, total_opens);
+    print_result("writev per batch", batched, total_opens);
+
+    for (unsigned int i = 0; i < num_files; i++)
+    {
+        unlink((directory + "/perm_response_" + to_string(i)).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Microbenchmark for permission policy decisions. Compiles a generated rule
+//  file with many rules spread over a deep directory tree, then times
+//  decisions for paths inside and outside the ruled directories. Every
+//  decision sits on the latency path of an open() in a monitored tree, so
+//  this reports percentiles rather than just an average, and counts heap
+//  allocations made while deciding (there should be none).
+//
+// Usage: policy_lookup [RULES] [DECISIONS]
+//  Defaults to 20000 rules and 1000000 decisions. Exits with 1 if deciding
+//  allocated.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/fanotify.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../PermissionPolicy.hpp"
+#include "alloc_count.hpp"
+
+using namespace std;
+
+// Path of the directory for rule i: /srv/dN/dM/dK spreads rules over a
+//  three level tree so lookups walk a realistic depth
+string rule_directory(unsigned int i)
+{
+    return "/srv/d" + to_string(i % 97) + "/d" + to_string(i % 1009) +
+           "/d" + to_string(i);
+}
+
+int main(int argc, char * argv[])
+{
+    unsigned int num_rules = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+    unsigned long num_decisions = argc > 2 ? strtoul(argv[2], NULL, 10)
+                                           : 1000000;
+
+    // Mix of unconditional, uid and gid rules, so decisions both look up
+    // ids and walk past rules that don't match
+    char policy_filename[] = "/tmp/dirmon_policy_XXXXXX";
+    int policy_fd = mkstemp(policy_filename);
+    if (policy_fd == -1)
+    {
+        perror("policy_lookup: cannot create rule file");
+        return 1;
+    }
+    close(policy_fd);
+    {
+        ofstream policy_file(policy_filename);
+        for (unsigned int i = 0; i < num_rules; i++)
+        {
+            policy_file << (i % 2 ? "deny " : "allow ") << rule_directory(i);
+            if (i % 3 == 1)
+            {
+                policy_file << " uid=" << 1000 + i % 50;
+            }
+            else if (i % 3 == 2)
+            {
+                policy_file << " gid=" << 1000 + i % 50;
+            }
+            policy_file << "\n";
+        }
+    }
+
+    auto compile_start = chrono::steady_clock::now();
+    PermissionPolicy policy;
+    string error_message;
+    bool loaded = policy.load(policy_filename, error_message);
+    auto compile_end = chrono::steady_clock::now();
+    unlink(policy_filename);
+    if (!loaded)
+    {
+        cerr << "policy_lookup: " << error_message << endl;
+        return 1;
+    }
+
+    // Half the paths fall under a ruled directory, half miss after a
+    // couple of components
+    vector<string> paths;
+    mt19937 random(42);
+    for (unsigned int i = 0; i < 4096; i++)
+    {
+        unsigned int rule = random() % num_rules;
+        if (i % 2)
+        {
+            paths.push_back(rule_directory(rule) + "/sub/file" +
+                            to_string(i) + ".txt");
+        }
+        else
+        {
+            paths.push_back("/srv/d" + to_string(rule % 97) +
+                            "/unruled/file" + to_string(i) + ".txt");
+        }
+    }
+
+    vector<uint32_t> latencies_ns;
+    latencies_ns.reserve(num_decisions);
+    uint64_t denials = 0;
+    pid_t pid = getpid();
+    uint64_t allocations_before = allocation_count.load();
+    auto run_start = chrono::steady_clock::now();
+    for (unsigned long i = 0; i < num_decisions; i++)
+    {
+        const string& path = paths[i % paths.size()];
+        auto decision_start = chrono::steady_clock::now();
+        PolicySubject subject(pid);
+        denials += policy.decide(path, subject) == FAN_DENY;
+        auto decision_end = chrono::steady_clock::now();
+        latencies_ns.push_back(chrono::duration_cast<chrono::nanoseconds>(
+            decision_end - decision_start).count());
+    }
+    auto run_end = chrono::steady_clock::now();
+    uint64_t decision_allocations = allocation_count.load() - allocations_before;
+
+    sort(latencies_ns.begin(), latencies_ns.end());
+    auto percentile = [&latencies_ns](double fraction) {
+        return latencies_ns[min(latencies_ns.size() - 1,
+                                (size_t) (fraction * latencies_ns.size()))];
+    };
+    double run_seconds = chrono::duration<double>(run_end - run_start).count();
+    cout << "rules:            " << policy.get_rule_count() << endl;
+    cout << "compile time:     "
+         << chrono::duration<double, milli>(compile_end - compile_start).count()
+         << " ms" << endl;
+    cout << "decisions:        " << num_decisions << " (" << denials
+         << " denied)" << endl;
+    cout << "decisions/s:      " << (uint64_t) (num_decisions / run_seconds)
+         << endl;
+    cout << "latency p50:      " << percentile(0.50) << " ns" << endl;
+    cout << "latency p99:      " << percentile(0.99) << " ns" << endl;
+    cout << "latency p99.9:    " << percentile(0.999) << " ns" << endl;
+    cout << "latency max:      " << latencies_ns.back() << " ns" << endl;
+    cout << "allocations:      " << decision_allocations << endl;
+    if (decision_allocations != 0)
+    {
+        cout << "FAIL: deciding allocated" << endl;
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
@@ -0,0 +1,154 @@
+#!/bin/bash
+# Throughput and latency suite for dirmon. Runs every workload pattern (see
+# bench/workload.cpp) on a temporary directory without dirmon for a
+# baseline, then again under dirmon in each mode, and reports for each run:
+#   ops/s        operations the workload got through
+#   events/s     events dirmon read (from its metrics file)
+#   open p50/p99 open() latency of the workload, and what dirmon added to
+#                the baseline's
+#   cpu%         dirmon's CPU time over the run (100 = one core)
+#   rss MB       dirmon's peak resident memory
+#   overflows    fanotify queue overflows (events the kernel dropped)
+# dirmon bind mounts the directory onto itself like any monitored
+# directory; everything is removed again afterwards.
+#
+# Usage: bench/run_suite.sh [SECONDS] [THREADS] [FILES] [DEPTH] [FILE_BYTES]
+#   Run from the top of the repository as root, after make and make bench.
+#   Defaults to 5 second runs, 4 threads, 10000 files 4 levels deep and
+#   4096-byte files. Set PATTERNS to a space separated list of patterns
+#   and MODES to a ';' separated list of dirmon option sets to change what
+#   runs, e.g.
+#       MODES="--OPEN;--OPEN_PERM --policy=rules" bench/run_suite.sh 10
+
+SECONDS_PER_RUN=${1:-5}
+THREADS=${2:-4}
+FILES=${3:-10000}
+DEPTH=${4:-4}
+FILE_BYTES=${5:-4096}
+PATTERNS=${PATTERNS:-"open read write create mixed"}
+MODES=${MODES:-"--OPEN --MODIFY --CLOSE_WRITE --CLOSE_NOWRITE --batch-bytes=65536;--ALL;--ALL --batch-bytes=65536 --writer-threads=4;--ALL --batch-bytes=65536 --format=binary --report-fid=1"}
+
+DIRMON=./dirmon
+WORKLOAD=bench/bin/workload
+
+if [ "$(id -u)" != 0 ]; then
+    echo "run_suite: must run as root (dirmon needs it)" >&2
+    exit 2
+fi
+if [ ! -x "$DIRMON" ] || [ ! -x "$WORKLOAD" ]; then
+    echo "run_suite: run make and make bench first" >&2
+    exit 2
+fi
+
+WORK=$(mktemp -d /tmp/dirmon_bench.XXXXXX)
+TREE=$WORK/tree
+mkdir "$TREE"
+echo "$TREE" > "$WORK/monitored_directories"
+DIRMON_PID=
+clean_up() {
+    if [ -n "$DIRMON_PID" ]; then
+        kill -TERM "$DIRMON_PID" 2>/dev/null
+        wait "$DIRMON_PID" 2>/dev/null
+    fi
+    umount -l "$TREE" 2>/dev/null
+    rm -rf "$WORK"
+}
+trap clean_up EXIT
+trap 'exit 1' INT TERM
+
+CLOCK_TICKS=$(getconf CLK_TCK)
+
+# Print name=value from the RESULT line of a workload report
+result_value() {
+    echo "$1" | sed -n "s/^RESULT.* $2=\([0-9]*\).*/\1/p"
+}
+
+# Print a counter from the metrics file
+metric_value() {
+    sed -n "s/^dirmon_$1 \([0-9]*\)$/\1/p" "$WORK/metrics.prom"
+}
+
+# Print the user plus system CPU time of a process in clock ticks
+cpu_ticks() {
+    # The command name in field 2 can hold spaces, so cut after it
+    sed 's/^.*) //' "/proc/$1/stat" | awk '{ print $12 + $13 }'
+}
+
+# Run the workload once and print its report
+run_workload() {
+    "$WORKLOAD" "$TREE" "$1" "$SECONDS_PER_RUN" "$THREADS" "$FILES" \
+        "$DEPTH" "$FILE_BYTES"
+}
+
+"$WORKLOAD" "$TREE" setup 0 1 "$FILES" "$DEPTH" "$FILE_BYTES" || exit 2
+
+# The mode goes last, since it can be any length
+printf "%-7s %9s %9s %16s %18s %6s %7s %9s  %s\n" pattern ops/s events/s \
+    "open p50 (+)" "open p99 (+)" cpu% "rss MB" overflows mode
+declare -A BASE_P50 BASE_P99
+for pattern in $PATTERNS; do
+    report=$(run_workload "$pattern")
+    BASE_P50[$pattern]=$(result_value "$report" open_p50_ns)
+    BASE_P99[$pattern]=$(result_value "$report" open_p99_ns)
+    printf "%-7s %9s %9s %16s %18s %6s %7s %9s  %s\n" "$pattern" \
+        "$(result_value "$report" ops_per_s)" - "${BASE_P50[$pattern]}ns" \
+        "${BASE_P99[$pattern]}ns" - - - "(unmonitored)"
+done
+
+IFS=';' read -r -a MODE_LIST <<< "$MODES"
+for mode in "${MODE_LIST[@]}"; do
+    for pattern in $PATTERNS; do
+        rm -f "$WORK/metrics.prom" "$WORK/audit"*
+        # shellcheck disable=SC2086
+        "$DIRMON" $mode --metrics-file="$WORK/metrics.prom" \
+            --metrics-interval-ms=200 "$WORK/monitored_directories" \
+            "$WORK/audit" > "$WORK/dirmon.log" 2>&1 &
+        DIRMON_PID=$!
+        # The first metrics file shows up once dirmon is auditing
+        for attempt in $(seq 100); do
+            [ -e "$WORK/metrics.prom" ] && break
+            sleep 0.1
+        done
+        if [ ! -e "$WORK/metrics.prom" ]; then
+            echo "run_suite: dirmon $mode did not start:" >&2
+            cat "$WORK/dirmon.log" >&2
+            exit 1
+        fi
+        events_before=$(metric_value events_read_total)
+        ticks_before=$(cpu_ticks "$DIRMON_PID")
+        start_ns=$(date +%s%N)
+        report=$(run_workload "$pattern")
+        end_ns=$(date +%s%N)
+        # Let dirmon work off its backlog, which counts towards its CPU
+        sleep 1
+        ticks_after=$(cpu_ticks "$DIRMON_PID")
+        sample_ns=$(date +%s%N)
+        rss_kb=$(awk '/^VmHWM:/ { print $2 }' "/proc/$DIRMON_PID/status")
+        kill -TERM "$DIRMON_PID"
+        wait "$DIRMON_PID"
+        DIRMON_PID=
+        # dirmon writes the metrics file once more on its way out
+        events=$(( $(metric_value events_read_total) - events_before ))
+        overflows=$(metric_value queue_overflows_total)
+
+        p50=$(result_value "$report" open_p50_ns)
+        p99=$(result_value "$report" open_p99_ns)
+        awk -v mode="$mode" -v pattern="$pattern" \
+            -v ops="$(result_value "$report" ops_per_s)" \
+            -v events="$events" -v p50="$p50" -v p99="$p99" \
+            -v base_p50="${BASE_P50[$pattern]}" \
+            -v base_p99="${BASE_P99[$pattern]}" \
+            -v run_ns=$(( end_ns - start_ns )) \
+            -v sample_ns=$(( sample_ns - start_ns )) \
+            -v ticks=$(( ticks_after - ticks_before )) \
+            -v clock_ticks="$CLOCK_TICKS" -v rss_kb="$rss_kb" \
+            -v overflows="$overflows" 'BEGIN {
+                printf "%-7s %9d %9d %16s %18s %6.1f %7.1f %9d  %s\n",
+                    pattern, ops, events / (run_ns / 1e9),
+                    sprintf("%dns(%+d)", p50, p50 - base_p50),
+                    sprintf("%dns(%+d)", p99, p99 - base_p99),
+                    100 * ticks / clock_ticks / (sample_ns / 1e9),
+                    rss_kb / 1024, overflows, mode
+            }'
+    done
+done
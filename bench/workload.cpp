@@ -0,0 +1,346 @@
+// Synthetic workload generator for measuring what dirmon costs the processes
+//  it monitors. Lays out a tree of small files (DEPTH levels of directories
+//  under DIRECTORY/workload, about 16 files per leaf directory), then runs
+//  a storm of one access pattern over it from several threads for a fixed
+//  time, timing every open() the threads make:
+//      open    open and close a file without reading it
+//      read    open, read the whole file, close
+//      write   open with O_TRUNC, write FILE_BYTES, close
+//      create  create a new file, write FILE_BYTES, close, unlink
+//      mixed   50% read, 30% open, 10% write, 10% create
+//  Every thread walks the files in its own fixed pseudo-random order, so
+//  runs with the same arguments make the same accesses. Run it once on an
+//  unmonitored directory for a baseline and once under dirmon to see the
+//  latency dirmon adds (bench/run_suite.sh does both for several dirmon
+//  configurations).
+//  "setup" and "cleanup" only create or remove the tree, so a monitored
+//  run doesn't count creating it; every other pattern sets the tree up
+//  itself if it isn't there.
+//
+// Usage: workload DIRECTORY PATTERN [SECONDS] [THREADS] [FILES] [DEPTH]
+//                 [FILE_BYTES]
+//  Defaults to 5 seconds, 4 threads, 10000 files, 4 levels and 4096-byte
+//  files. The last line of the report is a RESULT line of name=value
+//  pairs for scripts.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <ftw.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Subdirectories per directory in the tree
+const unsigned int FANOUT = 4;
+// Files per leaf directory the tree aims for
+const unsigned int FILES_PER_LEAF = 16;
+
+enum Pattern { OPEN, READ, WRITE, CREATE, MIXED };
+
+// The files of the tree and the leaf directories they are in
+struct Tree
+{
+    vector<string> leaf_directories;
+    vector<string> files;
+};
+
+// What one thread did during the storm
+struct ThreadResult
+{
+    uint64_t operations = 0;
+    uint64_t failures = 0;
+    vector<uint32_t> open_latencies_ns;
+};
+
+// Lay the paths out: file i goes into leaf directory i % leaves, and a leaf's
+// path spells out its number in base FANOUT, one digit per level
+Tree plan_tree(const string& root, unsigned int num_files, unsigned int depth)
+{
+    Tree tree;
+    uint64_t max_leaves = 1;
+    for (unsigned int level = 0; level < depth && max_leaves < num_files;
+         level++)
+    {
+        max_leaves *= FANOUT;
+    }
+    uint64_t num_leaves = max<uint64_t>(1, min<uint64_t>(
+        max_leaves, num_files / FILES_PER_LEAF));
+    for (uint64_t leaf = 0; leaf < num_leaves; leaf++)
+    {
+        string path = root;
+        uint64_t digits = leaf;
+        for (unsigned int level = 0; level < depth; level++)
+        {
+            path += "/d" + to_string(digits % FANOUT);
+            digits /= FANOUT;
+        }
+        tree.leaf_directories.push_back(path);
+    }
+    for (unsigned int i = 0; i < num_files; i++)
+    {
+        tree.files.push_back(tree.leaf_directories[i % num_leaves] + "/f" +
+                             to_string(i));
+    }
+    return tree;
+}
+
+// mkdir -p
+bool make_directories(const string& path)
+{
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+    {
+        string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) == -1 && errno != EEXIST)
+        {
+            return false;
+        }
+        if (slash == string::npos)
+        {
+            return true;
+        }
+    }
+}
+
+bool create_tree(const Tree& tree, const string& contents)
+{
+    for (auto directory = tree.leaf_directories.begin();
+         directory != tree.leaf_directories.end(); directory++)
+    {
+        if (!make_directories(*directory))
+        {
+            cerr << "workload: cannot create '" << *directory << "'" << endl;
+            return false;
+        }
+    }
+    for (auto path = tree.files.begin(); path != tree.files.end(); path++)
+    {
+        int fd = open(path->c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1 ||
+            write(fd, contents.data(), contents.size()) !=
+                (ssize_t) contents.size())
+        {
+            cerr << "workload: cannot create '" << *path << "'" << endl;
+            return false;
+        }
+        close(fd);
+    }
+    return true;
+}
+
+int remove_entry(const char * path, const struct stat *, int, struct FTW *)
+{
+    remove(path);
+    return 0;
+}
+
+// Time an open() into the thread's latencies
+int timed_open(ThreadResult& result, const char * path, int flags)
+{
+    auto start = chrono::steady_clock::now();
+    int fd = open(path, flags, 0644);
+    auto end = chrono::steady_clock::now();
+    result.open_latencies_ns.push_back(
+        min<int64_t>(UINT32_MAX, chrono::duration_cast<chrono::nanoseconds>(
+                                     end - start).count()));
+    if (fd == -1)
+    {
+        result.failures++;
+    }
+    return fd;
+}
+
+// Run the pattern until running is cleared. xorshift64 seeded with the
+// thread number picks the files, so every run makes the same accesses.
+void run_storm(const Tree& tree, Pattern pattern, unsigned int thread_number,
+               const string& contents, atomic<bool>& running,
+               ThreadResult& result)
+{
+    result.open_latencies_ns.reserve(1 << 20);
+    vector<char> read_buffer(max<size_t>(contents.size(), 4096));
+    uint64_t random_state = 0x9E3779B97F4A7C15ULL * (thread_number + 1);
+    string created_prefix = "/c" + to_string(thread_number) + "_";
+    while (running.load(memory_order_relaxed))
+    {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+        const string& path = tree.files[random_state % tree.files.size()];
+        Pattern operation = pattern;
+        if (pattern == MIXED)
+        {
+            unsigned int roll = (random_state >> 32) % 10;
+            operation = roll < 5 ? READ : roll < 8 ? OPEN :
+                        roll < 9 ? WRITE : CREATE;
+        }
+        int fd;
+        switch (operation)
+        {
+            case READ:
+                fd = timed_open(result, path.c_str(), O_RDONLY);
+                if (fd != -1)
+                {
+                    while (read(fd, read_buffer.data(), read_buffer.size()) > 0)
+                    {
+                    }
+                    close(fd);
+                }
+                break;
+            case WRITE:
+                fd = timed_open(result, path.c_str(), O_WRONLY | O_TRUNC);
+                if (fd != -1)
+                {
+                    if (write(fd, contents.data(), contents.size()) == -1)
+                    {
+                        result.failures++;
+                    }
+                    close(fd);
+                }
+                break;
+            case CREATE:
+            {
+                string created =
+                    tree.leaf_directories[random_state %
+                                          tree.leaf_directories.size()] +
+                    created_prefix + to_string(result.operations);
+                fd = timed_open(result, created.c_str(),
+                                O_WRONLY | O_CREAT | O_EXCL);
+                if (fd != -1)
+                {
+                    if (write(fd, contents.data(), contents.size()) == -1)
+                    {
+                        result.failures++;
+                    }
+                    close(fd);
+                    unlink(created.c_str());
+                }
+                break;
+            }
+            default:
+                fd = timed_open(result, path.c_str(), O_RDONLY);
+                if (fd != -1)
+                {
+                    close(fd);
+                }
+                break;
+        }
+        result.operations++;
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 3)
+    {
+        cerr << "Usage: workload DIRECTORY PATTERN [SECONDS] [THREADS] "
+             << "[FILES] [DEPTH] [FILE_BYTES]" << endl;
+        cerr << "  PATTERN: open, read, write, create, mixed, setup or "
+             << "cleanup" << endl;
+        return 2;
+    }
+    string root = string(argv[1]) + "/workload";
+    string pattern_name(argv[2]);
+    double seconds = argc > 3 ? strtod(argv[3], NULL) : 5;
+    unsigned int num_threads = argc > 4 ? strtoul(argv[4], NULL, 10) : 4;
+    unsigned int num_files = argc > 5 ? strtoul(argv[5], NULL, 10) : 10000;
+    unsigned int depth = argc > 6 ? strtoul(argv[6], NULL, 10) : 4;
+    size_t file_bytes = argc > 7 ? strtoul(argv[7], NULL, 10) : 4096;
+    num_threads = max(num_threads, 1u);
+    num_files = max(num_files, 1u);
+
+    const char * pattern_names[] = {"open", "read", "write", "create",
+                                    "mixed"};
+    int pattern = -1;
+    for (int i = 0; i < 5; i++)
+    {
+        if (pattern_name == pattern_names[i])
+        {
+            pattern = i;
+        }
+    }
+    if (pattern_name == "cleanup")
+    {
+        nftw(root.c_str(), remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+        return 0;
+    }
+    if (pattern == -1 && pattern_name != "setup")
+    {
+        cerr << "workload: unknown pattern '" << pattern_name << "'" << endl;
+        return 2;
+    }
+
+    Tree tree = plan_tree(root, num_files, depth);
+    string contents(file_bytes, 'x');
+    struct stat last_file;
+    if ((pattern_name == "setup" ||
+         stat(tree.files.back().c_str(), &last_file) == -1) &&
+        !create_tree(tree, contents))
+    {
+        return 2;
+    }
+    if (pattern_name == "setup")
+    {
+        return 0;
+    }
+
+    atomic<bool> running(true);
+    vector<ThreadResult> results(num_threads);
+    vector<thread> workers;
+    auto start = chrono::steady_clock::now();
+    for (unsigned int t = 0; t < num_threads; t++)
+    {
+        workers.emplace_back(run_storm, cref(tree), (Pattern) pattern, t,
+                             cref(contents), ref(running), ref(results[t]));
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    running = false;
+    for (auto worker = workers.begin(); worker != workers.end(); worker++)
+    {
+        worker->join();
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() -
+                                              start).count();
+
+    uint64_t operations = 0;
+    uint64_t failures = 0;
+    vector<uint32_t> latencies_ns;
+    for (auto result = results.begin(); result != results.end(); result++)
+    {
+        operations += result->operations;
+        failures += result->failures;
+        latencies_ns.insert(latencies_ns.end(),
+                            result->open_latencies_ns.begin(),
+                            result->open_latencies_ns.end());
+    }
+    sort(latencies_ns.begin(), latencies_ns.end());
+    auto percentile = [&latencies_ns](double fraction) -> uint64_t {
+        if (latencies_ns.empty())
+        {
+            return 0;
+        }
+        return latencies_ns[min(latencies_ns.size() - 1,
+                                (size_t) (fraction * latencies_ns.size()))];
+    };
+    uint64_t operations_per_second = operations / elapsed;
+    cout << "pattern " << pattern_name << ": " << operations << " operations"
+         << " in " << elapsed << " s (" << operations_per_second
+         << " ops/s) on " << num_files << " files " << depth
+         << " levels deep, " << failures << " failed" << endl;
+    cout << "open() latency: p50 " << percentile(0.5) << " ns, p99 "
+         << percentile(0.99) << " ns, p99.9 " << percentile(0.999)
+         << " ns, max " << percentile(1) << " ns" << endl;
+    cout << "RESULT ops_per_s=" << operations_per_second
+         << " open_p50_ns=" << percentile(0.5)
+         << " open_p99_ns=" << percentile(0.99)
+         << " open_p999_ns=" << percentile(0.999)
+         << " failures=" << failures << endl;
+    return failures > 0 ? 1 : 0;
+}
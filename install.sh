@@ -39,6 +39,6 @@ echo "See the result of your auditing in "
 echo "/etc/dirmon/audit_file (feel free to remove this"
 echo "file if you want to clear out old info)"
 echo 
-echo "Restart your system after reconfiguring"
-echo "/etc/dirmon/monitored_directories if you want to"
-echo "monitor more directories"
\ No newline at end of file
+echo "dirmon picks up edits to /etc/dirmon/monitored_directories"
+echo "as soon as the file is saved, so there is no need to"
+echo "restart after adding or removing directories"
\ No newline at end of file